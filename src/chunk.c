@@ -0,0 +1,280 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "stats.h"
+
+#define BATCH		(8 * SHA_LANES)
+#define GEAR_SEED	0x2545f4914f6cdd1d
+#define MAX_AVG		(256 * 1024)
+#define MIN_AVG		256
+#define READ_LEN	(4 * 1024 * 1024)
+
+struct batch
+{
+	const struct chunk_opts	*opts;
+	chunk_fcn_t		*fcn;
+	void			*arg;
+	int			 num;
+	struct sha_msg		 msgs[BATCH];
+	struct chunk		 chunks[BATCH];
+	byte			 hashes[BATCH * SHA_HASH];
+};
+
+static word64 gear[256];
+
+/******************************************************************************
+ * Initialization.
+ ******************************************************************************/
+static void __attribute__((constructor))
+init(void)
+{
+	word64 x, z;
+	int i;
+
+	// The table only has to look random, and must never change.
+	x = GEAR_SEED;
+	for (i = 0; i < 256; i++)
+	{
+		z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/******************************************************************************
+ * Batching.
+ ******************************************************************************/
+static bool
+flush(struct batch *b)
+{
+	size_t hash_len;
+	int i;
+
+	if (b->num == 0)
+		return (true);
+
+	// Chunks are hashed together so they can share the kernel's lanes.
+	if (!sha_many(b->opts->type, b->msgs, b->num, b->hashes))
+		return (false);
+
+	hash_len = sha_hash_len(b->opts->type);
+	for (i = 0; i < b->num; i++)
+	{
+		memcpy(b->chunks[i].hash, &b->hashes[i * hash_len], hash_len);
+		if (!(*b->fcn)(b->arg, &b->chunks[i]))
+			return (false);
+	}
+	b->num = 0;
+
+	return (true);
+}
+
+static bool
+add(struct batch *b, const byte *data, word64 offset, size_t len)
+{
+	b->msgs[b->num].data = data;
+	b->msgs[b->num].len = len;
+	b->chunks[b->num].offset = offset;
+	b->chunks[b->num].len = len;
+	b->num++;
+
+	if (b->num < BATCH)
+		return (true);
+
+	return (flush(b));
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+chunk_init(struct chunk_opts *opts, enum sha_type type, size_t avg)
+{
+	int bits;
+
+	if (opts == NULL || sha_hash_len(type) == 0)
+		return (false);
+
+	// The average must be a power of two that the read buffer can hold.
+	if (avg < MIN_AVG || avg > MAX_AVG || (avg & (avg - 1)) != 0)
+		return (false);
+
+	opts->type = type;
+	opts->avg = avg;
+	opts->min = avg / 4;
+	opts->max = avg * 8;
+
+	// Normalized chunking: a harder mask before the average size and an
+	// easier one after it.  The top bits of the Gear hash cover the
+	// most bytes, so the masks are taken from there.
+	bits = __builtin_ctzll(avg);
+	opts->mask_s = ~(word64) 0 << (64 - (bits + 1));
+	opts->mask_l = ~(word64) 0 << (64 - (bits - 1));
+
+	return (true);
+}
+
+size_t
+chunk_next(const struct chunk_opts *opts, const byte *data, size_t len)
+{
+	size_t i, normal;
+	word64 fp;
+
+	if (len <= opts->min)
+		return (len);
+	if (len > opts->max)
+		len = opts->max;
+	normal = (len < opts->avg) ? (len) : (opts->avg);
+
+	// Nothing before the minimum size is looked at.
+	fp = 0;
+	for (i = opts->min; i < normal; i++)
+	{
+		fp = (fp << 1) + gear[data[i]];
+		if ((fp & opts->mask_s) == 0)
+			return (i + 1);
+	}
+
+	for (; i < len; i++)
+	{
+		fp = (fp << 1) + gear[data[i]];
+		if ((fp & opts->mask_l) == 0)
+			return (i + 1);
+	}
+
+	return (len);
+}
+
+bool
+chunk_buf(const struct chunk_opts *opts, const void *data, size_t len,
+	  chunk_fcn_t *fcn, void *arg)
+{
+	const byte *in;
+	struct batch b;
+	size_t cut, off;
+
+	if (opts == NULL || fcn == NULL || (data == NULL && len > 0))
+		return (false);
+
+	b.opts = opts;
+	b.fcn = fcn;
+	b.arg = arg;
+	b.num = 0;
+
+	in = data;
+	for (off = 0; off < len; off += cut)
+	{
+		cut = chunk_next(opts, &in[off], len - off);
+		if (!add(&b, &in[off], off, cut))
+			return (false);
+	}
+
+	return (flush(&b));
+}
+
+bool
+chunk_fd(const struct chunk_opts *opts, int fd, chunk_fcn_t *fcn, void *arg)
+{
+	size_t cut, have, pos;
+	struct batch b;
+	bool eof, result;
+	word64 base;
+	ssize_t len;
+	byte *buf;
+
+	if (opts == NULL || fcn == NULL)
+		return (false);
+
+	buf = malloc(READ_LEN);
+	if (buf == NULL)
+	{
+		warn("malloc");
+		return (false);
+	}
+
+	b.opts = opts;
+	b.fcn = fcn;
+	b.arg = arg;
+	b.num = 0;
+
+	base = 0;
+	have = 0;
+	eof = false;
+	result = false;
+	while (!eof || have > 0)
+	{
+		// Fill the buffer behind whatever the last pass left over.
+		while (!eof && have < READ_LEN)
+		{
+			len = stats_read(fd, &buf[have], READ_LEN - have);
+			if (len < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				warn("read");
+				goto out;
+			}
+
+			if (len == 0)
+				eof = true;
+			have += len;
+		}
+
+		// A cut at the end of the data may move once more arrives.
+		for (pos = 0; pos < have; pos += cut)
+		{
+			cut = chunk_next(opts, &buf[pos], have - pos);
+			if (!eof && pos + cut == have && cut < opts->max)
+				break;
+
+			if (!add(&b, &buf[pos], base + pos, cut))
+				goto out;
+		}
+
+		// Chunks point into the buffer, so finish them before moving.
+		if (!flush(&b))
+			goto out;
+		memmove(buf, &buf[pos], have - pos);
+		base += pos;
+		have -= pos;
+	}
+	result = true;
+
+out:
+	free(buf);
+
+	return (result);
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#ifndef __CHUNK_H
+#define __CHUNK_H
+
+#include "sha.h"
+
+#define CHUNK_AVG	(8 * 1024)
+
+struct chunk_opts
+{
+	enum sha_type	type;
+	size_t		min;
+	size_t		avg;
+	size_t		max;
+	word64		mask_s;
+	word64		mask_l;
+};
+
+struct chunk
+{
+	word64	offset;
+	size_t	len;
+	byte	hash[SHA_HASH];
+};
+
+typedef bool (chunk_fcn_t)(void *arg, const struct chunk *chunk);
+
+bool	chunk_init(struct chunk_opts *opts, enum sha_type type, size_t avg);
+size_t	chunk_next(const struct chunk_opts *opts, const byte *data,
+		   size_t len);
+bool	chunk_buf(const struct chunk_opts *opts, const void *data,
+		  size_t len, chunk_fcn_t *fcn, void *arg);
+bool	chunk_fd(const struct chunk_opts *opts, int fd, chunk_fcn_t *fcn,
+		 void *arg);
+
+#endif
@@ -0,0 +1,366 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "stats.h"
+
+#define ALIGN		4096
+#define DEPTH		4
+#define READ_LEN	(1024 * 1024)
+
+struct slot
+{
+	byte		*buf;
+	ssize_t		 len;
+	int		 error;
+	bool		 full;
+	pthread_t	 tid;
+};
+
+struct cold
+{
+	int		 fd;
+	off_t		 start;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+	bool		 stop;
+	struct slot	 slots[DEPTH];
+};
+
+struct reader
+{
+	struct cold	*c;
+	int		 index;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static byte *pool[2 * DEPTH];
+static int pool_num = 0;
+
+/******************************************************************************
+ * Buffer pool.
+ ******************************************************************************/
+static byte *
+get_buf(void)
+{
+	void *buf;
+
+	// Reuse a buffer from an earlier file where one is free.
+	buf = NULL;
+	pthread_mutex_lock(&pool_lock);
+	if (pool_num > 0)
+		buf = pool[--pool_num];
+	pthread_mutex_unlock(&pool_lock);
+	if (buf != NULL)
+		return (buf);
+
+	// Direct reads need the buffer aligned to the device's blocks.
+	if (posix_memalign(&buf, ALIGN, READ_LEN) != 0)
+	{
+		warnx("Couldn't allocate an aligned buffer.");
+		return (NULL);
+	}
+
+	return (buf);
+}
+
+static void
+put_buf(byte *buf)
+{
+	if (buf == NULL)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_num < sizeof(pool) / sizeof(*pool))
+	{
+		pool[pool_num++] = buf;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	free(buf);
+}
+
+/******************************************************************************
+ * Reading.
+ ******************************************************************************/
+static ssize_t
+fill(int fd, byte *buf, off_t off)
+{
+	ssize_t len, got;
+
+	// A short read that breaks alignment can only be the end of the
+	// file, and another direct read from there would be refused.
+	for (len = 0; len < READ_LEN; len += got)
+	{
+		got = stats_pread(fd, &buf[len], READ_LEN - len,
+				  off + len);
+		if (got < 0 && errno == EINTR)
+		{
+			got = 0;
+			continue;
+		}
+		if (got < 0)
+			return (-1);
+		if (got == 0 || got % ALIGN != 0)
+			return (len + got);
+	}
+
+	return (len);
+}
+
+static void *
+reader(void *arg)
+{
+	struct reader *r;
+	struct slot *s;
+	struct cold *c;
+	ssize_t len;
+	bool stop;
+	off_t k;
+
+	// Each reader fills one slot with every DEPTH-th part of the file.
+	r = arg;
+	c = r->c;
+	s = &c->slots[r->index];
+	for (k = r->index; ; k += DEPTH)
+	{
+		pthread_mutex_lock(&c->lock);
+		while (s->full && !c->stop)
+			pthread_cond_wait(&c->cond, &c->lock);
+		stop = c->stop;
+		pthread_mutex_unlock(&c->lock);
+		if (stop)
+			break;
+
+		len = fill(c->fd, s->buf, c->start + k * READ_LEN);
+
+		pthread_mutex_lock(&c->lock);
+		s->len = len;
+		s->error = errno;
+		s->full = true;
+		pthread_cond_broadcast(&c->cond);
+		pthread_mutex_unlock(&c->lock);
+
+		if (len < READ_LEN)
+			break;
+	}
+
+	return (NULL);
+}
+
+static bool
+whole(struct sha *ctx, int fd, off_t start, bool bypass, byte *hash)
+{
+	ssize_t len;
+	bool result;
+	byte *buf;
+
+	buf = get_buf();
+	if (buf == NULL)
+		return (false);
+
+	len = fill(fd, buf, start);
+	if (len < 0)
+		warn("pread");
+	result = (len >= 0 && sha_update(ctx, buf, len) &&
+		  sha_final(ctx, hash));
+	put_buf(buf);
+	if (!bypass && len > 0)
+		posix_fadvise(fd, start, len, POSIX_FADV_DONTNEED);
+
+	if (result && lseek(fd, start + len, SEEK_SET) < 0)
+	{
+		warn("lseek");
+		result = false;
+	}
+
+	return (result);
+}
+
+static bool
+direct(int fd, int flags)
+{
+	byte *buf;
+	bool ok;
+
+	if (fcntl(fd, F_SETFL, flags | O_DIRECT) != 0)
+		return (false);
+
+	// Some filesystems accept the flag, then refuse the reads.
+	buf = get_buf();
+	ok = (buf != NULL && pread(fd, buf, ALIGN, 0) >= 0);
+	put_buf(buf);
+	if (!ok)
+		fcntl(fd, F_SETFL, flags);
+
+	return (ok);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+sha_cold(enum sha_type type, int fd, byte *hash)
+{
+	struct reader readers[DEPTH];
+	bool bypass, result;
+	struct sha ctx;
+	int flags, i;
+	struct cold c;
+	struct slot *s;
+	struct stat st;
+	off_t k, start;
+
+	// Pipes and the like can only be read in order.
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    (start = lseek(fd, 0, SEEK_CUR)) < 0)
+		return (sha_fd(type, fd, hash));
+
+	if (!sha_init(&ctx, type))
+		return (false);
+
+	// Bypass the page cache, or failing that drop what was read.
+	// Direct reads must start on a block, so reading from the middle
+	// of one goes through the cache.
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+	{
+		warn("fcntl");
+		return (false);
+	}
+	bypass = (start % ALIGN == 0 && direct(fd, flags));
+	if (!bypass)
+		posix_fadvise(fd, start, 0, POSIX_FADV_SEQUENTIAL);
+
+	// A file that fits in one read is read on this thread, since
+	// starting the readers would cost more than the read.
+	if (st.st_size - start <= READ_LEN)
+	{
+		result = whole(&ctx, fd, start, bypass, hash);
+		if (bypass)
+			fcntl(fd, F_SETFL, flags);
+
+		return (result);
+	}
+
+	c.fd = fd;
+	c.start = start;
+	c.stop = false;
+	pthread_mutex_init(&c.lock, NULL);
+	pthread_cond_init(&c.cond, NULL);
+
+	// Keep several reads in flight while the hash catches up.
+	result = false;
+	for (i = 0; i < DEPTH; i++)
+	{
+		c.slots[i].buf = get_buf();
+		c.slots[i].full = false;
+	}
+	for (i = 0; i < DEPTH; i++)
+	{
+		readers[i].c = &c;
+		readers[i].index = i;
+		if (c.slots[i].buf == NULL ||
+		    pthread_create(&c.slots[i].tid, NULL, reader,
+				   &readers[i]) != 0)
+			break;
+	}
+	if (i < DEPTH)
+	{
+		warnx("Couldn't start readers.");
+		goto stop;
+	}
+
+	// Hash the parts in order as they arrive.
+	for (k = 0; ; k++)
+	{
+		s = &c.slots[k % DEPTH];
+		pthread_mutex_lock(&c.lock);
+		while (!s->full)
+			pthread_cond_wait(&c.cond, &c.lock);
+		pthread_mutex_unlock(&c.lock);
+
+		if (s->len < 0)
+		{
+			errno = s->error;
+			warn("pread");
+			goto stop;
+		}
+
+		if (!sha_update(&ctx, s->buf, s->len))
+			goto stop;
+		if (!bypass)
+			posix_fadvise(fd, start + k * READ_LEN, s->len,
+				      POSIX_FADV_DONTNEED);
+
+		if (s->len < READ_LEN)
+			break;
+
+		pthread_mutex_lock(&c.lock);
+		s->full = false;
+		pthread_cond_broadcast(&c.cond);
+		pthread_mutex_unlock(&c.lock);
+	}
+	result = sha_final(&ctx, hash);
+
+	// Leave the descriptor after what was hashed, as reading would.
+	if (result && lseek(fd, start + k * READ_LEN + s->len, SEEK_SET) < 0)
+	{
+		warn("lseek");
+		result = false;
+	}
+
+stop:
+	pthread_mutex_lock(&c.lock);
+	c.stop = true;
+	pthread_cond_broadcast(&c.cond);
+	pthread_mutex_unlock(&c.lock);
+
+	while (--i >= 0)
+		pthread_join(c.slots[i].tid, NULL);
+	for (i = 0; i < DEPTH; i++)
+		put_buf(c.slots[i].buf);
+
+	pthread_cond_destroy(&c.cond);
+	pthread_mutex_destroy(&c.lock);
+	if (bypass)
+		fcntl(fd, F_SETFL, flags);
+
+	return (result);
+}
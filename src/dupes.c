@@ -0,0 +1,343 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dupes.h"
+#include "pool.h"
+#include "stats.h"
+
+#define PARTIAL_LEN	(4 * 1024)
+
+struct cand
+{
+	const struct tree_entry	*entry;
+	byte			 partial[SHA_HASH];
+	byte			 full[SHA_HASH];
+	bool			 need_full;
+	bool			 have_full;
+	bool			 failed;
+};
+
+struct stage
+{
+	enum sha_type	 type;
+	struct cand	*cands;
+};
+
+/******************************************************************************
+ * Hashing stages.
+ ******************************************************************************/
+static void
+partial(void *arg, size_t index)
+{
+	const struct stage *st;
+	struct cand *c;
+	byte buf[2 * PARTIAL_LEN];
+	ssize_t len, want;
+	bool whole;
+	off_t size;
+	int fd;
+
+	st = arg;
+	c = &st->cands[index];
+	fd = open(c->entry->path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0)
+	{
+		warn("%s", c->entry->path);
+		c->failed = true;
+		return;
+	}
+
+	// Small files are read whole, which makes the partial sum final.
+	size = c->entry->size;
+	whole = (size <= sizeof(buf));
+	if (whole)
+	{
+		want = size;
+		len = stats_pread(fd, buf, size, 0);
+	}
+	else
+	{
+		want = sizeof(buf);
+		len = stats_pread(fd, buf, PARTIAL_LEN, 0);
+		if (len == PARTIAL_LEN)
+			len += stats_pread(fd, &buf[PARTIAL_LEN], PARTIAL_LEN,
+					   size - PARTIAL_LEN);
+	}
+	close(fd);
+
+	// A file that changed size since the walk can't be trusted.
+	if (len != want || !sha_buf(st->type, buf, len, c->partial))
+	{
+		warnx("%s: Couldn't read %jd bytes.", c->entry->path,
+		      (intmax_t) size);
+		c->failed = true;
+		return;
+	}
+
+	if (whole)
+	{
+		memcpy(c->full, c->partial, sizeof(c->full));
+		c->have_full = true;
+	}
+}
+
+static void
+full(void *arg, size_t index)
+{
+	const struct stage *st;
+	struct cand *c;
+	int fd;
+
+	st = arg;
+	c = &st->cands[index];
+	if (!c->need_full)
+		return;
+
+	fd = open(c->entry->path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0)
+	{
+		warn("%s", c->entry->path);
+		c->failed = true;
+		return;
+	}
+
+	if (!sha_fd(st->type, fd, c->full))
+	{
+		warnx("%s: Couldn't calculate hash.", c->entry->path);
+		c->failed = true;
+	}
+	else
+		c->have_full = true;
+	close(fd);
+}
+
+/******************************************************************************
+ * Ordering.
+ ******************************************************************************/
+static int
+by_size(const void *a, const void *b)
+{
+	const struct tree_entry *x, *y;
+
+	x = *(const struct tree_entry * const *) a;
+	y = *(const struct tree_entry * const *) b;
+	if (x->size != y->size)
+		return ((x->size < y->size) ? (-1) : (1));
+
+	return (strcmp(x->path, y->path));
+}
+
+static int
+by_partial(const void *a, const void *b)
+{
+	const struct cand *x, *y;
+	int cmp;
+
+	x = a;
+	y = b;
+	if (x->failed != y->failed)
+		return ((x->failed) ? (1) : (-1));
+	if (x->entry->size != y->entry->size)
+		return ((x->entry->size < y->entry->size) ? (-1) : (1));
+	cmp = memcmp(x->partial, y->partial, sizeof(x->partial));
+	if (cmp != 0)
+		return (cmp);
+
+	return (strcmp(x->entry->path, y->entry->path));
+}
+
+static int
+by_full(const void *a, const void *b)
+{
+	const struct cand *x, *y;
+	int cmp;
+
+	x = a;
+	y = b;
+	if (x->have_full != y->have_full)
+		return ((x->have_full) ? (-1) : (1));
+	if (x->entry->size != y->entry->size)
+		return ((x->entry->size < y->entry->size) ? (-1) : (1));
+	cmp = memcmp(x->full, y->full, sizeof(x->full));
+	if (cmp != 0)
+		return (cmp);
+
+	return (strcmp(x->entry->path, y->entry->path));
+}
+
+static size_t
+run_len(const struct cand *cands, size_t num, size_t i,
+	int (*cmp)(const void *, const void *))
+{
+	size_t j;
+
+	for (j = i + 1; j < num; j++)
+	{
+		if (cands[j].failed || cmp(&cands[i], &cands[j]) != 0)
+			break;
+	}
+
+	return (j - i);
+}
+
+static int
+same_partial(const void *a, const void *b)
+{
+	const struct cand *x, *y;
+
+	x = a;
+	y = b;
+	if (x->entry->size != y->entry->size)
+		return (1);
+
+	return (memcmp(x->partial, y->partial, sizeof(x->partial)));
+}
+
+static int
+same_full(const void *a, const void *b)
+{
+	const struct cand *x, *y;
+
+	x = a;
+	y = b;
+	if (!x->have_full || !y->have_full || x->entry->size != y->entry->size)
+		return (1);
+
+	return (memcmp(x->full, y->full, sizeof(x->full)));
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+dupes_find(enum sha_type type, const struct tree_entry *entries, size_t num,
+	   int threads, struct dupe **dupes, size_t *num_dupes)
+{
+	const struct tree_entry **sorted;
+	size_t group, i, j, n, num_cands;
+	struct cand *cands;
+	struct dupe *out;
+	struct stage st;
+
+	if ((entries == NULL && num > 0) || dupes == NULL || num_dupes == NULL)
+		return (false);
+	if (threads < 1)
+		threads = 1;
+
+	// Bucket by size; only sizes shared by several files are candidates.
+	// Empty files are all alike and left out.
+	sorted = malloc(num * sizeof(*sorted) + 1);
+	cands = malloc(num * sizeof(*cands) + 1);
+	if (sorted == NULL || cands == NULL)
+	{
+		warn("malloc");
+		free(sorted);
+		free(cands);
+		return (false);
+	}
+
+	n = 0;
+	for (i = 0; i < num; i++)
+	{
+		if (!entries[i].failed && entries[i].size > 0)
+			sorted[n++] = &entries[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), by_size);
+
+	num_cands = 0;
+	for (i = 0; i < n; i = j)
+	{
+		for (j = i + 1; j < n && sorted[j]->size == sorted[i]->size;
+		     j++)
+			;
+		if (j - i < 2)
+			continue;
+
+		for (; i < j; i++)
+		{
+			memset(&cands[num_cands], 0, sizeof(*cands));
+			cands[num_cands++].entry = sorted[i];
+		}
+	}
+	free(sorted);
+
+	// Sum the head and tail of every candidate.
+	st.type = type;
+	st.cands = cands;
+	pool_run(partial, &st, num_cands, threads);
+
+	// Only files whose partial sums still collide are read in full.
+	qsort(cands, num_cands, sizeof(*cands), by_partial);
+	for (i = 0; i < num_cands && !cands[i].failed; i += n)
+	{
+		n = run_len(cands, num_cands, i, same_partial);
+		for (j = i; n > 1 && j < i + n; j++)
+			cands[j].need_full = !cands[j].have_full;
+	}
+	pool_run(full, &st, num_cands, threads);
+
+	// Report each group of identical files in path order.
+	qsort(cands, num_cands, sizeof(*cands), by_full);
+	out = malloc(num_cands * sizeof(*out) + 1);
+	if (out == NULL)
+	{
+		warn("malloc");
+		free(cands);
+		return (false);
+	}
+
+	*num_dupes = 0;
+	group = 0;
+	for (i = 0; i < num_cands && cands[i].have_full; i += n)
+	{
+		n = run_len(cands, num_cands, i, same_full);
+		if (n < 2)
+			continue;
+
+		for (j = i; j < i + n; j++)
+		{
+			out[*num_dupes].entry = cands[j].entry;
+			memcpy(out[*num_dupes].hash, cands[j].full,
+			       sizeof(out[*num_dupes].hash));
+			out[*num_dupes].group = group;
+			(*num_dupes)++;
+		}
+		group++;
+	}
+
+	free(cands);
+	*dupes = out;
+
+	return (true);
+}
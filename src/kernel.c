@@ -0,0 +1,375 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "kernel.h"
+#include "sha.h"
+#include "tune.h"
+
+#define ENV_KERNEL	"SHA_KERNEL"
+#define FAMILIES	3
+
+/******************************************************************************
+ * CPU features.
+ ******************************************************************************/
+static bool
+generic(void)
+{
+	return (true);
+}
+
+#ifdef KERNEL_X86
+static bool
+shani(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return (false);
+
+	if (!(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return (false);
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return (false);
+
+	return ((b & bit_SHA) != 0);
+}
+
+static bool
+avx2(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return (false);
+
+	if (!(c & bit_OSXSAVE) || !(c & bit_AVX))
+		return (false);
+
+	// Check the OS saves the YMM registers.
+	__asm__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+	if ((a & 0x6) != 0x6)
+		return (false);
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return (false);
+
+	return ((b & bit_AVX2) != 0);
+}
+#endif
+
+/******************************************************************************
+ * Kernel table, best first within each algorithm.  Single-stream kernels
+ * also serve batches, one lane at a time.
+ ******************************************************************************/
+static const struct sha_kernel kernels[] = {
+#ifdef KERNEL_X86
+	{
+		.name = "shani",
+		.type = SHA1,
+		.supported = shani,
+		.fcn32 = sha1_shani,
+		.lanes = 1
+	},
+	{
+		.name = "shani",
+		.type = SHA256,
+		.supported = shani,
+		.fcn32 = sha256_shani,
+		.lanes = 1
+	},
+	{
+		.name = "avx2",
+		.type = SHA256,
+		.supported = avx2,
+		.lanes = 8,
+		.many32 = sha256_avx2
+	},
+	{
+		.name = "avx2",
+		.type = SHA512,
+		.supported = avx2,
+		.lanes = 4,
+		.many64 = sha512_avx2
+	},
+#endif
+	{
+		.name = "generic2",
+		.type = SHA256,
+		.supported = generic,
+		.lanes = 2,
+		.many32 = sha256_generic2
+	},
+	{
+		.name = "generic2",
+		.type = SHA512,
+		.supported = generic,
+		.lanes = 2,
+		.many64 = sha512_generic2
+	},
+	{
+		.name = "generic",
+		.type = SHA1,
+		.supported = generic,
+		.fcn32 = sha1_generic,
+		.lanes = 1
+	},
+	{
+		.name = "generic",
+		.type = SHA256,
+		.supported = generic,
+		.fcn32 = sha256_generic,
+		.lanes = 1
+	},
+	{
+		.name = "generic",
+		.type = SHA512,
+		.supported = generic,
+		.fcn64 = sha512_generic,
+		.lanes = 1
+	}
+};
+
+static const int num_kernels = sizeof(kernels) / sizeof(struct sha_kernel);
+
+static const struct sha_kernel *selected[FAMILIES];
+static const struct sha_kernel *selected_many[FAMILIES];
+
+// The choice made at startup, which sha_kernel_reset() goes back to.
+static const struct sha_kernel *startup[FAMILIES];
+static const struct sha_kernel *startup_many[FAMILIES];
+
+/******************************************************************************
+ * Utility functions.
+ ******************************************************************************/
+static int
+family(enum sha_type type)
+{
+	// Truncated variants share their parent's compression function.
+	switch (type)
+	{
+	case SHA1:
+		return (0);
+
+	case SHA224:
+	case SHA256:
+		return (1);
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (2);
+
+	default:
+		return (-1);
+	}
+}
+
+static bool
+single(const struct sha_kernel *kernel)
+{
+	return (kernel->fcn32 != NULL || kernel->fcn64 != NULL);
+}
+
+static const struct sha_kernel *
+find(int fam, const char *name, bool many)
+{
+	int i;
+
+	for (i = 0; i < num_kernels; i++)
+	{
+		if (family(kernels[i].type) != fam)
+			continue;
+
+		// Multi-lane kernels can't hash a single stream.
+		if (!many && !single(&kernels[i]))
+			continue;
+
+		if (name != NULL && strcmp(kernels[i].name, name) != 0)
+			continue;
+
+		if ((*kernels[i].supported)())
+			return (&kernels[i]);
+	}
+
+	return (NULL);
+}
+
+// Allow specific kernels to be forced from the environment.
+static void
+force(void)
+{
+	char *env, *name, *names;
+	bool found;
+	int fam;
+
+	env = getenv(ENV_KERNEL);
+	if (env == NULL)
+		return;
+
+	names = strdup(env);
+	if (names == NULL)
+		return;
+
+	for (name = strtok(names, ","); name != NULL;
+	     name = strtok(NULL, ","))
+	{
+		found = false;
+		for (fam = 0; fam < FAMILIES; fam++)
+		{
+			if (find(fam, name, true) == NULL)
+				continue;
+
+			if (find(fam, name, false) != NULL)
+				selected[fam] = find(fam, name, false);
+			selected_many[fam] = find(fam, name, true);
+			found = true;
+		}
+
+		if (!found)
+			warnx("%s: Kernel %s is unknown or unsupported.",
+			      ENV_KERNEL, name);
+	}
+
+	free(names);
+}
+
+__attribute__((constructor))
+static void
+init(void)
+{
+	int fam;
+
+	// Pick the best supported kernels for each algorithm.
+	for (fam = 0; fam < FAMILIES; fam++)
+	{
+		selected[fam] = find(fam, NULL, false);
+		selected_many[fam] = find(fam, NULL, true);
+	}
+
+	// Settings tuned for the host come next, and the environment last.
+	tune_init();
+	force();
+
+	for (fam = 0; fam < FAMILIES; fam++)
+	{
+		startup[fam] = selected[fam];
+		startup_many[fam] = selected_many[fam];
+	}
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+const struct sha_kernel *
+sha_kernel(enum sha_type type)
+{
+	int fam;
+
+	fam = family(type);
+	if (fam < 0)
+		return (NULL);
+
+	return (selected[fam]);
+}
+
+const struct sha_kernel *
+sha_kernel_many(enum sha_type type)
+{
+	int fam;
+
+	fam = family(type);
+	if (fam < 0)
+		return (NULL);
+
+	return (selected_many[fam]);
+}
+
+const struct sha_kernel *
+sha_kernels(int *num)
+{
+	if (num != NULL)
+		*num = num_kernels;
+
+	return (kernels);
+}
+
+bool
+sha_kernel_select(enum sha_type type, const char *name)
+{
+	const struct sha_kernel *kernel;
+	int fam;
+
+	fam = family(type);
+	if (fam < 0)
+		return (false);
+
+	// A null name restores the best supported kernels.
+	if (name == NULL)
+	{
+		selected[fam] = find(fam, NULL, false);
+		selected_many[fam] = find(fam, NULL, true);
+		return (true);
+	}
+
+	kernel = find(fam, name, true);
+	if (kernel == NULL)
+		return (false);
+
+	// Multi-lane kernels only replace the batch kernel.
+	if (single(kernel))
+		selected[fam] = kernel;
+	selected_many[fam] = kernel;
+
+	return (true);
+}
+
+bool
+sha_kernel_reset(enum sha_type type)
+{
+	int fam;
+
+	fam = family(type);
+	if (fam < 0)
+		return (false);
+
+	// Undo any selection made since startup, keeping tuned settings
+	// and the environment's choice.
+	selected[fam] = startup[fam];
+	selected_many[fam] = startup_many[fam];
+
+	return (true);
+}
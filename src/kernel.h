@@ -0,0 +1,52 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#ifndef __KERNEL_H
+#define __KERNEL_H
+
+#include "sha.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#endif
+
+void	sha1_generic(word32 *H, const byte *blocks, size_t num);
+void	sha256_generic(word32 *H, const byte *blocks, size_t num);
+void	sha512_generic(word64 *H, const byte *blocks, size_t num);
+
+void	sha256_generic2(word32 *H[], const byte *blocks[], size_t num);
+void	sha512_generic2(word64 *H[], const byte *blocks[], size_t num);
+
+#ifdef KERNEL_X86
+void	sha1_shani(word32 *H, const byte *blocks, size_t num);
+void	sha256_shani(word32 *H, const byte *blocks, size_t num);
+
+void	sha256_avx2(word32 *H[], const byte *blocks[], size_t num);
+void	sha512_avx2(word64 *H[], const byte *blocks[], size_t num);
+#endif
+
+#endif
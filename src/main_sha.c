@@ -30,93 +30,867 @@
 
 #include <err.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "chunk.h"
+#include "dupes.h"
+#include "pool.h"
 #include "sha.h"
+#include "storm.h"
+#include "tree.h"
+
+struct mode
+{
+	const char	*name;
+	enum sha_type	 type;
+	char		*(*fcn)(int fd);
+};
+
+static const struct mode modes[] = {
+	{ "1",       SHA1,       sha1       },
+	{ "224",     SHA224,     sha224     },
+	{ "256",     SHA256,     sha256     },
+	{ "384",     SHA384,     sha384     },
+	{ "512",     SHA512,     sha512     },
+	{ "512/224", SHA512_224, sha512_224 },
+	{ "512/256", SHA512_256, sha512_256 }
+};
+
+static const int num_modes = sizeof(modes) / sizeof(struct mode);
+
+struct parts
+{
+	enum sha_type	 type;
+	int		 fd;
+	off_t		 size;
+	off_t		 part_len;
+	byte		*hashes;
+	bool		 failed;
+};
+
+static struct chunk_opts chunks;
+static size_t chunk_avg = 0;
+static off_t part_len = 0;
+static off_t range_len = -1;
+static off_t range_off = -1;
+static int threads = 1;
+static bool cold = false;
+static bool map = false;
+
+enum stats
+{
+	STATS_NONE,
+	STATS_HUMAN,
+	STATS_JSON
+};
+
+static enum stats stats = STATS_NONE;
+
+static const struct option long_opts[] = {
+	{ "autotune", no_argument,       NULL, 'A' },
+	{ "stats",    optional_argument, NULL, 'T' },
+	{ "tee",      optional_argument, NULL, 'E' },
+	{ NULL,       0,                 NULL, 0   }
+};
 
 static void
 usage(const char *name)
 {
 	fprintf(stderr,
-		"Usage: %s mode [file]\n\n"
+		"Usage: %s [-bDlrSux] [-C size] [-I io] [-j threads]\n"
+		"       [-k kernel] [-P size] [-R offset[,length]]\n"
+		"       [--stats[=json]] mode [file]\n"
+		"       %s --tee[=fd] mode\n"
+		"       %s --autotune mode path\n\n"
 		"Calculates the message digest of a file or stream.\n"
-		"Valid modes are: 1, 224, 256, 384, and 512.\n"
-		"If no filename is given, STDIN is read.\n",
-		name);
+		"Valid modes are: 1, 224, 256, 384, 512, 512/224, and\n"
+		"512/256.\n"
+		"If no filename is given, STDIN is read.\n"
+		"\n"
+		"  -b    Hash many small files at once: each is read\n"
+		"        whole, through io_uring where the kernel has\n"
+		"        it, and hashed in batches.  Combines with -r.\n"
+		"  -C    Split each file into content-defined chunks\n"
+		"        averaging the given size, a power of two, and\n"
+		"        print the offset, length, and digest of each.\n"
+		"  -D    Report groups of identical files below each\n"
+		"        directory.  Only files sharing a size have their\n"
+		"        first and last 4 KiB hashed, and only those still\n"
+		"        alike are hashed in full.  Empty files are left\n"
+		"        out.\n"
+		"  -I    Read whole files with read, mmap, or direct,\n"
+		"        the same as -u, over any tuned setting.\n"
+		"  -j    Threads for recursive mode (default: one per\n"
+		"        CPU).\n"
+		"  -k    Force the named kernel, where it is supported.\n"
+		"  -l    List the kernels and which are selected.\n"
+		"  -P    Print the offset, length, and digest of each\n"
+		"        part of the given size, hashed in parallel.\n"
+		"  -R    Only hash the given byte range.\n"
+		"  -r    Hash every regular file below each directory,\n"
+		"        printed in sorted path order.  Symbolic links to\n"
+		"        directories aren't followed.\n"
+		"  -S    Skip symbolic links in recursive mode.\n"
+		"  -u    Read whole files around the page cache, with\n"
+		"        O_DIRECT where the filesystem allows it.\n"
+		"  -x    Stay on the filesystem of each directory given.\n"
+		"\n"
+		"  --autotune  Time kernels, reads, and threads against\n"
+		"        the file or directory given, and save the fastest\n"
+		"        to the file named by SHA_TUNE (default:\n"
+		"        /etc/sha.conf), which later runs load.\n"
+		"  --tee  Copy STDIN to STDOUT while hashing it, and\n"
+		"        write the digest to the given descriptor\n"
+		"        (default: STDERR).  Between pipes the copy is\n"
+		"        made with tee(2), without passing through sha.\n"
+		"  --stats  On exit, report bytes and calls read, blocks\n"
+		"        compressed, and the time spent reading and hashing\n"
+		"        to STDERR, as text or as JSON.\n"
+		"\n"
+		"Sizes may end in K, M, or G.\n"
+		"\n"
+		"The SHA_KERNEL environment variable may also hold a\n"
+		"comma-separated list of kernels to force.\n",
+		name, name, name);
 
 	exit(EXIT_FAILURE);
 }
 
-int
-main(int argc, const char **argv)
+static void
+print_stats(void)
 {
-	const char *filename;
-	int fd, i, type;
-	char *hash;
+	struct sha_stats st;
+	double hash, io;
 
-	// Ensure proper comand line.
-	if (argc < 2)
-		usage(argv[0]);
-	type = atoi(argv[1]);
+	sha_stats_get(&st);
+	io = st.io_ns / 1e9;
+	hash = st.hash_ns / 1e9;
 
-	// Handle STDIN.
-	if (argc == 2)
+	if (stats == STATS_JSON)
 	{
-		filename = "-";
-		fd = STDIN_FILENO;
-		argc++;
+		fprintf(stderr,
+			"{\"bytes_read\": %" PRIu64 ", \"reads\": %" PRIu64
+			", \"short_reads\": %" PRIu64 ", \"blocks\": %" PRIu64
+			", \"io_seconds\": %.6f, \"hash_seconds\": %.6f}\n",
+			st.bytes_read, st.reads, st.short_reads, st.blocks,
+			io, hash);
+		return;
 	}
 
-	// Run through each file.
-	for (i = 2; i < argc; i++)
+	fprintf(stderr,
+		"Bytes read:   %" PRIu64 "\n"
+		"Reads:        %" PRIu64 " (%" PRIu64 " short)\n"
+		"Blocks:       %" PRIu64 "\n"
+		"Reading:      %.6f s\n"
+		"Hashing:      %.6f s\n",
+		st.bytes_read, st.reads, st.short_reads, st.blocks, io,
+		hash);
+
+	// Time is summed over threads, so only the split is meaningful.
+	if (io + hash > 0)
 	{
-		// Open file.
-		if (filename == NULL)
+		fprintf(stderr,
+			"Mostly %s-bound, %.0f%% of the time hashing.\n",
+			(io > hash) ? ("I/O") : ("CPU"),
+			100 * hash / (io + hash));
+	}
+}
+
+static void
+list_kernels(void)
+{
+	static const enum sha_type types[] = {
+		SHA1, SHA256, SHA512
+	};
+	const struct sha_kernel *kernels;
+	int i, j, num_kernels;
+	const char *state;
+
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; i < sizeof(types) / sizeof(enum sha_type); i++)
+	{
+		for (j = 0; j < num_kernels; j++)
 		{
-			filename = argv[i];
-			fd = open(filename, O_RDONLY);
-			if (fd < 0)
-				err(EXIT_FAILURE, "open");
+			if (kernels[j].type != types[i])
+				continue;
+
+			if (!(*kernels[j].supported)())
+				state = "unsupported";
+			else if (sha_kernel(types[i]) == &kernels[j] &&
+				 sha_kernel_many(types[i]) == &kernels[j])
+				state = "selected";
+			else if (sha_kernel(types[i]) == &kernels[j])
+				state = "selected for streams";
+			else if (sha_kernel_many(types[i]) == &kernels[j])
+				state = "selected for batches";
+			else
+				state = "supported";
+
+			printf("%-8s %-8s %d lane%s\t%s\n", sha_name(types[i]),
+			       kernels[j].name, kernels[j].lanes,
+			       (kernels[j].lanes == 1) ? " " : "s", state);
+		}
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+static off_t
+parse_size(const char *str, char **end)
+{
+	unsigned long long size;
+
+	size = strtoull(str, end, 10);
+	switch (**end)
+	{
+	case 'G':
+		size *= 1024;
+		// Fall through.
+	case 'M':
+		size *= 1024;
+		// Fall through.
+	case 'K':
+		size *= 1024;
+		(*end)++;
+	}
+
+	return (size);
+}
+
+static const struct mode *
+find_mode(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_modes; i++)
+	{
+		if (strcmp(modes[i].name, name) == 0)
+			return (&modes[i]);
+	}
+
+	return (NULL);
+}
+
+static void
+select_kernel(const char *name)
+{
+	static const enum sha_type types[] = {
+		SHA1, SHA256, SHA512
+	};
+	bool found;
+	int i;
+
+	found = false;
+	for (i = 0; i < sizeof(types) / sizeof(enum sha_type); i++)
+	{
+		if (sha_kernel_select(types[i], name))
+			found = true;
+	}
+
+	if (!found)
+		errx(EXIT_FAILURE, "Kernel %s is unknown or unsupported.",
+		     name);
+}
+
+static void
+print_hash(enum sha_type type, const byte *hash, const char *path)
+{
+	char hex[2 * SHA_HASH + 1];
+
+	sha_hex(hash, sha_hash_len(type), hex);
+	printf("%s  %s\n", hex, path);
+}
+
+static void
+print_record(enum sha_type type, off_t offset, off_t len, const byte *hash)
+{
+	char hex[2 * SHA_HASH + 1];
+
+	sha_hex(hash, sha_hash_len(type), hex);
+	printf("%ju %ju %s\n", (uintmax_t) offset, (uintmax_t) len, hex);
+}
+
+static bool
+print_chunk(void *arg, const struct chunk *chunk)
+{
+	const struct chunk_opts *opts;
+
+	opts = arg;
+	print_record(opts->type, chunk->offset, chunk->len, chunk->hash);
+
+	return (true);
+}
+
+static void
+hash_part(void *arg, size_t index)
+{
+	struct parts *p;
+	off_t len, off;
+
+	p = arg;
+	off = index * p->part_len;
+	len = p->size - off;
+	if (len > p->part_len)
+		len = p->part_len;
+
+	if (!sha_range(p->type, p->fd, off, len,
+		       &p->hashes[index * sha_hash_len(p->type)]))
+		p->failed = true;
+}
+
+static bool
+print_parts(enum sha_type type, int fd)
+{
+	struct parts p;
+	struct stat st;
+	size_t i, num;
+	off_t off;
+
+	// Parts are hashed by position, which needs a regular file.
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		warnx("Parts can only be taken from regular files.");
+		return (false);
+	}
+
+	p.type = type;
+	p.fd = fd;
+	p.size = st.st_size;
+	p.part_len = part_len;
+	p.failed = false;
+	num = (st.st_size + part_len - 1) / part_len;
+	p.hashes = malloc(num * sha_hash_len(type) + 1);
+	if (p.hashes == NULL)
+	{
+		warn("malloc");
+		return (false);
+	}
+
+	pool_run(hash_part, &p, num, threads);
+
+	for (i = 0; !p.failed && i < num; i++)
+	{
+		off = i * part_len;
+		print_record(type, off,
+			     (p.size - off < part_len) ? (p.size - off) :
+			     (part_len), &p.hashes[i * sha_hash_len(type)]);
+	}
+	free(p.hashes);
+
+	return (!p.failed);
+}
+
+static bool
+print_range(enum sha_type type, int fd, const char *filename)
+{
+	char hex[2 * SHA_HASH + 1];
+	byte hash[SHA_HASH];
+	struct stat st;
+	off_t len;
+
+	// Without a length the range runs to the end of the file.
+	len = range_len;
+	if (len < 0)
+	{
+		if (fstat(fd, &st) != 0 || range_off > st.st_size)
+		{
+			warnx("Offset %ju is past the end of %s.",
+			      (uintmax_t) range_off, filename);
+			return (false);
+		}
+		len = st.st_size - range_off;
+	}
+
+	if (!sha_range(type, fd, range_off, len, hash))
+		return (false);
+
+	sha_hex(hash, sha_hash_len(type), hex);
+	printf("%s  %s\n", hex, filename);
+
+	return (true);
+}
+
+static bool
+print_file(const struct mode *mode, int fd, const char *filename)
+{
+	char hex[2 * SHA_HASH + 1];
+	byte hash[SHA_HASH];
+	char *str;
+
+	// Records come first, followed by the name of the file they're from.
+	if (chunk_avg > 0)
+	{
+		if (!chunk_fd(&chunks, fd, print_chunk, &chunks))
+			return (false);
+		printf("%s\n", filename);
+		return (true);
+	}
+
+	if (part_len > 0)
+	{
+		if (!print_parts(mode->type, fd))
+			return (false);
+		printf("%s\n", filename);
+		return (true);
+	}
+
+	if (range_off >= 0)
+		return (print_range(mode->type, fd, filename));
+
+	if (cold || map)
+	{
+		if (!((cold) ? (sha_cold) : (sha_map))(mode->type, fd, hash))
+			return (false);
+		sha_hex(hash, sha_hash_len(mode->type), hex);
+		printf("%s  %s\n", hex, filename);
+		return (true);
+	}
+
+	// Calculate the message digest.
+	str = (*mode->fcn)(fd);
+	if (str == NULL)
+		return (false);
+
+	// Print the message digest.
+	printf("%s  %s\n", str, filename);
+	free(str);
+
+	return (true);
+}
+
+static bool
+hash_tree(const char *root, const struct tree_opts *opts)
+{
+	struct tree_entry *entries;
+	size_t i, num;
+	bool result;
+
+	if (!tree_hash(root, opts, &entries, &num))
+		return (false);
+
+	// Failed entries were already reported.
+	result = true;
+	for (i = 0; i < num; i++)
+	{
+		if (entries[i].failed)
+			result = false;
+		else
+			printf("%s  %s\n", entries[i].hash, entries[i].path);
+	}
+
+	tree_free(entries, num);
+
+	return (result);
+}
+
+static bool
+find_dupes(enum sha_type type, char **roots, int num_roots,
+	   const struct tree_opts *opts)
+{
+	struct tree_entry *all, *entries, *grown;
+	size_t i, num, num_all, num_dupes;
+	struct dupe *dupes;
+	bool result;
+	int r;
+
+	// Gather every file from every root before comparing any.
+	all = NULL;
+	num_all = 0;
+	result = true;
+	for (r = 0; r < num_roots; r++)
+	{
+		if (!tree_hash(roots[r], opts, &entries, &num))
+		{
+			result = false;
+			continue;
 		}
 
-		// Calculate the message digest.
-		switch (type)
+		grown = realloc(all, (num_all + num) * sizeof(*all) + 1);
+		if (grown == NULL)
+			err(EXIT_FAILURE, "realloc");
+		all = grown;
+		memcpy(&all[num_all], entries, num * sizeof(*entries));
+		num_all += num;
+		free(entries);
+	}
+
+	for (i = 0; i < num_all; i++)
+	{
+		if (all[i].failed)
+			result = false;
+	}
+
+	if (!dupes_find(type, all, num_all, opts->threads, &dupes,
+			&num_dupes))
+		errx(EXIT_FAILURE, "Couldn't compare files.");
+
+	// Groups are separated by blank lines.
+	for (i = 0; i < num_dupes; i++)
+	{
+		if (i > 0 && dupes[i].group != dupes[i - 1].group)
+			printf("\n");
+		print_hash(type, dupes[i].hash, dupes[i].entry->path);
+	}
+
+	free(dupes);
+	tree_free(all, num_all);
+
+	return (result);
+}
+
+static bool
+storm(enum sha_type type, char **paths, int num_paths, bool recurse,
+      const struct tree_opts *opts)
+{
+	struct tree_entry *all, *entries, *grown;
+	struct storm_opts storm_opts;
+	size_t i, num, num_all;
+	byte *hashes;
+	bool result;
+	int r;
+
+	// Only list the trees; the sizes come back with the contents.
+	all = NULL;
+	num_all = 0;
+	result = true;
+	for (r = 0; r < num_paths; r++)
+	{
+		if (!recurse)
 		{
-		case 1:
-			hash = sha1(fd);
+			entries = calloc(1, sizeof(*entries));
+			if (entries == NULL ||
+			    (entries->path = strdup(paths[r])) == NULL)
+				err(EXIT_FAILURE, "malloc");
+			entries->size = -1;
+			num = 1;
+		}
+		else if (!tree_hash(paths[r], opts, &entries, &num))
+		{
+			result = false;
+			continue;
+		}
+
+		grown = realloc(all, (num_all + num) * sizeof(*all) + 1);
+		if (grown == NULL)
+			err(EXIT_FAILURE, "realloc");
+		all = grown;
+		memcpy(&all[num_all], entries, num * sizeof(*entries));
+		num_all += num;
+		free(entries);
+	}
+
+	hashes = malloc(num_all * sha_hash_len(type) + 1);
+	if (hashes == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memset(&storm_opts, 0, sizeof(storm_opts));
+	storm_opts.type = type;
+	storm_opts.threads = opts->threads;
+	if (!storm_hash(&storm_opts, all, num_all, hashes))
+		errx(EXIT_FAILURE, "Couldn't calculate hashes.");
+
+	// Failed entries were already reported.
+	for (i = 0; i < num_all; i++)
+	{
+		if (all[i].failed)
+			result = false;
+		else
+			print_hash(type, &hashes[i * sha_hash_len(type)],
+				   all[i].path);
+	}
+
+	free(hashes);
+	tree_free(all, num_all);
+
+	return (result);
+}
+
+static bool
+pass(enum sha_type type, int digest_fd)
+{
+	char hex[2 * SHA_HASH + 1];
+	byte hash[SHA_HASH];
+
+	// The digest goes out only once the whole stream has.
+	if (!sha_tee(type, STDIN_FILENO, STDOUT_FILENO, hash))
+		return (false);
+
+	sha_hex(hash, sha_hash_len(type), hex);
+	if (dprintf(digest_fd, "%s  -\n", hex) < 0)
+	{
+		warn("dprintf");
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+autotune(enum sha_type type, const char *target)
+{
+	static const enum sha_type types[SHA_TUNE_FAMILIES] = {
+		SHA1, SHA256, SHA512
+	};
+	struct sha_tune tune;
+	const char *path;
+	int f;
+
+	path = sha_tune_path();
+	if (path == NULL)
+		errx(EXIT_FAILURE, "SHA_TUNE is empty, so there's nowhere to "
+		     "save the settings.");
+
+	fprintf(stderr, "Calibrating against %s...\n", target);
+	if (!sha_tune_run(type, target, &tune) || !sha_tune_save(path, &tune))
+		return (false);
+
+	printf("io %s\nread_len %zu\nthreads %d\n",
+	       (tune.io == SHA_IO_MMAP) ? ("mmap") :
+	       (tune.io == SHA_IO_DIRECT) ? ("direct") : ("read"),
+	       tune.read_len, tune.threads);
+	for (f = 0; f < SHA_TUNE_FAMILIES; f++)
+	{
+		if (tune.kernel[f][0] != '\0')
+			printf("%s kernel %s\n", sha_name(types[f]),
+			       tune.kernel[f]);
+		if (tune.batch[f][0] != '\0')
+			printf("%s batch %s\n", sha_name(types[f]),
+			       tune.batch[f]);
+	}
+	printf("Saved to %s.\n", path);
+
+	return (true);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sha_tune tuned;
+	struct tree_opts opts;
+	const struct mode *mode;
+	const char *filename;
+	bool batch, dupes, no_symlinks, one_fs, recurse, result, tune;
+	int digest_fd, fd, flag, i;
+	char *end;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	batch = dupes = no_symlinks = one_fs = recurse = tune = false;
+	digest_fd = -1;
+
+	// Settings saved by --autotune are the defaults.
+	sha_tune_get(&tuned);
+	if (tuned.threads > 0)
+		threads = tuned.threads;
+	cold = (tuned.io == SHA_IO_DIRECT);
+	map = (tuned.io == SHA_IO_MMAP);
+
+	// Parse the command-line switches.
+	while ((flag = getopt_long(argc, argv, "bC:DhI:j:k:lP:R:rSux",
+				   long_opts, NULL)) != -1)
+	{
+		switch (flag)
+		{
+		case 'A':
+			tune = true;
+			break;
+
+		case 'E':
+			digest_fd = STDERR_FILENO;
+			if (optarg != NULL)
+				digest_fd = strtol(optarg, &end, 10);
+			if ((optarg != NULL && *end != '\0') || digest_fd < 0)
+				usage(argv[0]);
+			break;
+
+		case 'T':
+			if (optarg == NULL)
+				stats = STATS_HUMAN;
+			else if (strcmp(optarg, "json") == 0)
+				stats = STATS_JSON;
+			else
+				usage(argv[0]);
+			break;
+
+		case 'b':
+			batch = true;
+			break;
+
+		case 'C':
+			chunk_avg = strtoul(optarg, &end, 10);
+			if (*end != '\0' || chunk_avg == 0)
+				usage(argv[0]);
 			break;
 
-		case 224:
-			hash = sha224(fd);
+		case 'D':
+			dupes = true;
 			break;
 
-		case 256:
-			hash = sha256(fd);
+		case 'I':
+			if (strcmp(optarg, "read") != 0 &&
+			    strcmp(optarg, "mmap") != 0 &&
+			    strcmp(optarg, "direct") != 0)
+				usage(argv[0]);
+			cold = (strcmp(optarg, "direct") == 0);
+			map = (strcmp(optarg, "mmap") == 0);
 			break;
 
-		case 384:
-			hash = sha384(fd);
+		case 'j':
+			threads = strtol(optarg, &end, 10);
+			if (*end != '\0' || threads < 1)
+				usage(argv[0]);
 			break;
 
-		case 512:
-			hash = sha512(fd);
+		case 'P':
+			part_len = parse_size(optarg, &end);
+			if (*end != '\0' || part_len <= 0)
+				usage(argv[0]);
+			break;
+
+		case 'R':
+			range_off = parse_size(optarg, &end);
+			if (*end == ',')
+				range_len = parse_size(end + 1, &end);
+			if (*end != '\0' || range_off < 0 || range_len < -1)
+				usage(argv[0]);
+			break;
+
+		case 'r':
+			recurse = true;
+			break;
+
+		case 'S':
+			no_symlinks = true;
+			break;
+
+		case 'u':
+			cold = true;
+			map = false;
+			break;
+
+		case 'x':
+			one_fs = true;
+			break;
+
+		case 'k':
+			select_kernel(optarg);
+			break;
+
+		case 'l':
+			list_kernels();
 			break;
 
 		default:
 			usage(argv[0]);
 		}
+	}
 
-		if (hash == NULL)
-			errx(EXIT_FAILURE, "Couldn't calculate hash.");
+	// Report the counters however the run ends.
+	if (stats != STATS_NONE)
+	{
+		sha_stats_enable(true);
+		atexit(print_stats);
+	}
+
+	// Ensure proper comand line.
+	if (optind >= argc)
+		usage(argv[0]);
+	mode = find_mode(argv[optind]);
+	if (mode == NULL)
+		usage(argv[0]);
+	if (chunk_avg > 0 && !chunk_init(&chunks, mode->type, chunk_avg))
+		errx(EXIT_FAILURE, "Chunk size %zu is not a power of two "
+		     "from 256 to 256K.", chunk_avg);
 
-		// Print the message digest.
-		printf("%s  %s\n", hash, filename);
+	if (digest_fd >= 0)
+	{
+		if (argc != optind + 1)
+			usage(argv[0]);
+		result = pass(mode->type, digest_fd);
+
+		return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+	}
+
+	if (tune)
+	{
+		if (argc != optind + 2)
+			usage(argv[0]);
+		result = autotune(mode->type, argv[optind + 1]);
+
+		return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.threads = threads;
+	opts.no_symlinks = no_symlinks;
+	opts.one_fs = one_fs;
+
+	if (dupes)
+	{
+		if (argc == optind + 1)
+			usage(argv[0]);
+		result = find_dupes(mode->type, &argv[optind + 1],
+				    argc - optind - 1, &opts);
+
+		return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+	}
+
+	if (batch && argc > optind + 1)
+	{
+		opts.no_size = true;
+		result = storm(mode->type, &argv[optind + 1],
+			       argc - optind - 1, recurse, &opts);
+
+		return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+	}
+
+	// Walk each tree, carrying on past unreadable entries.
+	if (recurse && argc > optind + 1)
+	{
+		opts.type = mode->type;
+		opts.fcn = (cold) ? (sha_cold) : (map) ? (sha_map) : (sha_fd);
+		result = true;
+		for (i = optind + 1; i < argc; i++)
+		{
+			if (!hash_tree(argv[i], &opts))
+				result = false;
+		}
+
+		return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+	}
+
+	// Handle STDIN.
+	filename = NULL;
+	if (argc == optind + 1)
+	{
+		filename = "-";
+		fd = STDIN_FILENO;
+		argc++;
+	}
+
+	// Run through each file.
+	for (i = optind + 1; i < argc; i++)
+	{
+		// Open file.
+		if (filename == NULL)
+		{
+			filename = argv[i];
+			fd = open(filename, O_RDONLY);
+			if (fd < 0)
+				err(EXIT_FAILURE, "open");
+		}
+
+		if (!print_file(mode, fd, filename))
+			errx(EXIT_FAILURE, "Couldn't calculate hash.");
 
 		// Clean up.
 		filename = NULL;
-		free(hash);
 		close(fd);
 	}
 
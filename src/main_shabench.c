@@ -0,0 +1,615 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <linux/perf_event.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "sha.h"
+
+#define BATCH_NUM	64
+#define DEFAULT_MIN	16
+#define DEFAULT_MAX	(64 << 20)
+#define DEFAULT_TIME	0.25
+#define MAX_REPS	(1 << 24)
+#define STEP		4
+#define TEMPLATE	"/shabench.XXXXXX"
+#define WRITE_CHUNK	(1 << 20)
+
+enum source
+{
+	SRC_MEM		= 1 << 0,
+	SRC_FILE	= 1 << 1,
+	SRC_BATCH	= 1 << 2
+};
+
+struct algo
+{
+	const char	*mode;
+	enum sha_type	 type;
+	char		*(*fd)(int fd);
+};
+
+struct sample
+{
+	double		secs;
+	uint64_t	tsc;
+	uint64_t	cycles;
+	uint64_t	instrs;
+};
+
+static const struct algo algos[] = {
+	{ "1",       SHA1,       sha1       },
+	{ "224",     SHA224,     sha224     },
+	{ "256",     SHA256,     sha256     },
+	{ "384",     SHA384,     sha384     },
+	{ "512",     SHA512,     sha512     },
+	{ "512/224", SHA512_224, sha512_224 },
+	{ "512/256", SHA512_256, sha512_256 }
+};
+
+static const int num_algos = sizeof(algos) / sizeof(struct algo);
+
+static bool csv = false;
+static double min_time = DEFAULT_TIME;
+static int perf_cycles = -1;
+static int perf_instrs = -1;
+
+/******************************************************************************
+ * Utility functions.
+ ******************************************************************************/
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-chp] [-a mode] [-d dir] [-k kernel] [-m size]\n"
+		"       [-M size] [-s source] [-t secs]\n"
+		"\n"
+		"Measures the throughput of each message digest and each\n"
+		"supported kernel over a range of message sizes, growing by a\n"
+		"factor of %d.\n"
+		"\n"
+		"  -a    Only run the given mode (1, 224, 256, 384, 512,\n"
+		"        512/224, 512/256).\n"
+		"  -c    Print comma-separated values.\n"
+		"  -d    Directory for temporary files (default: /tmp).\n"
+		"  -h    Display this message.\n"
+		"  -k    Only run the named kernel.\n"
+		"  -m    Smallest message size (default: %d).\n"
+		"  -M    Largest message size (default: %dM).\n"
+		"  -p    Read hardware counters with perf_event_open.\n"
+		"  -s    Message source: mem, file, batch, or all (default:\n"
+		"        mem).  Batches hold %d messages of each size.\n"
+		"  -t    Minimum seconds per measurement (default: %.2f).\n"
+		"\n"
+		"Sizes may be suffixed with K, M, or G.\n",
+		name, STEP, DEFAULT_MIN, DEFAULT_MAX >> 20, BATCH_NUM,
+		DEFAULT_TIME);
+
+	exit(EXIT_FAILURE);
+}
+
+static size_t
+parse_size(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 10);
+	switch (*end)
+	{
+	case 'G':
+	case 'g':
+		size <<= 10;
+		// Fall through.
+	case 'M':
+	case 'm':
+		size <<= 10;
+		// Fall through.
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	if (end == str || *end != '\0' || size == 0)
+		errx(EXIT_FAILURE, "Invalid size: %s", str);
+
+	return (size);
+}
+
+static const char *
+format_size(size_t size)
+{
+	static char buf[32];
+
+	if (size >= (1 << 30) && size % (1 << 30) == 0)
+		snprintf(buf, sizeof(buf), "%zuG", size >> 30);
+	else if (size >= (1 << 20) && size % (1 << 20) == 0)
+		snprintf(buf, sizeof(buf), "%zuM", size >> 20);
+	else if (size >= (1 << 10) && size % (1 << 10) == 0)
+		snprintf(buf, sizeof(buf), "%zuK", size >> 10);
+	else
+		snprintf(buf, sizeof(buf), "%zu", size);
+
+	return (buf);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static uint64_t
+tsc(void)
+{
+#ifdef HAVE_TSC
+	return (__rdtsc());
+#else
+	return (0);
+#endif
+}
+
+/******************************************************************************
+ * Hardware counters.
+ ******************************************************************************/
+static int
+perf_open(uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static void
+perf_init(void)
+{
+	perf_cycles = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+	perf_instrs = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+
+	if (perf_cycles < 0 || perf_instrs < 0)
+	{
+		warn("perf_event_open, falling back to the timestamp counter");
+		if (perf_cycles >= 0)
+			close(perf_cycles);
+		if (perf_instrs >= 0)
+			close(perf_instrs);
+		perf_cycles = perf_instrs = -1;
+	}
+}
+
+static void
+perf_start(int fd)
+{
+	if (fd < 0)
+		return;
+
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static uint64_t
+perf_stop(int fd)
+{
+	uint64_t count;
+
+	if (fd < 0)
+		return (0);
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+		return (0);
+
+	return (count);
+}
+
+/******************************************************************************
+ * Message sources.
+ ******************************************************************************/
+static int
+make_file(const char *dir, const byte *buf, size_t size)
+{
+	char path[PATH_MAX];
+	size_t chunk, done;
+	ssize_t len;
+	int fd;
+
+	// Create an anonymous temporary file.
+	snprintf(path, sizeof(path), "%s" TEMPLATE, dir);
+	fd = mkstemp(path);
+	if (fd < 0)
+		err(EXIT_FAILURE, "mkstemp");
+	unlink(path);
+
+	// Fill it with the same bytes as the in-memory message.
+	for (done = 0; done < size; done += len)
+	{
+		chunk = size - done;
+		if (chunk > WRITE_CHUNK)
+			chunk = WRITE_CHUNK;
+
+		len = write(fd, buf + done, chunk);
+		if (len <= 0)
+			err(EXIT_FAILURE, "write");
+	}
+
+	return (fd);
+}
+
+static const char *
+source_name(enum source src)
+{
+	switch (src)
+	{
+	case SRC_MEM:
+		return ("mem");
+
+	case SRC_FILE:
+		return ("file");
+
+	default:
+		return ("batch");
+	}
+}
+
+static void
+hash_once(const struct algo *algo, enum source src, const byte *buf,
+	  int fd, size_t size)
+{
+	static byte hashes[BATCH_NUM * SHA_HASH];
+	struct sha_msg msgs[BATCH_NUM];
+	byte hash[SHA_HASH];
+	char *hex;
+	int i;
+
+	switch (src)
+	{
+	case SRC_MEM:
+		if (!sha_buf(algo->type, buf, size, hash))
+			errx(EXIT_FAILURE, "Couldn't calculate hash.");
+		break;
+
+	case SRC_FILE:
+		if (lseek(fd, 0, SEEK_SET) != 0)
+			err(EXIT_FAILURE, "lseek");
+		hex = (*algo->fd)(fd);
+		if (hex == NULL)
+			errx(EXIT_FAILURE, "Couldn't calculate hash.");
+		free(hex);
+		break;
+
+	case SRC_BATCH:
+		for (i = 0; i < BATCH_NUM; i++)
+		{
+			msgs[i].data = buf;
+			msgs[i].len = size;
+		}
+		if (!sha_many(algo->type, msgs, BATCH_NUM, hashes))
+			errx(EXIT_FAILURE, "Couldn't calculate hashes.");
+		break;
+	}
+}
+
+static void
+measure(const struct algo *algo, enum source src, const byte *buf, int fd,
+	size_t size, long reps, struct sample *s)
+{
+	uint64_t start_tsc;
+	double start;
+	long i;
+
+	perf_start(perf_cycles);
+	perf_start(perf_instrs);
+	start = now();
+	start_tsc = tsc();
+
+	for (i = 0; i < reps; i++)
+		hash_once(algo, src, buf, fd, size);
+
+	s->tsc = tsc() - start_tsc;
+	s->secs = now() - start;
+	s->cycles = perf_stop(perf_cycles);
+	s->instrs = perf_stop(perf_instrs);
+}
+
+/******************************************************************************
+ * Reporting.
+ ******************************************************************************/
+static void
+print_header(void)
+{
+	if (csv)
+	{
+		printf("algorithm,kernel,source,size,iterations,seconds,"
+		       "mb_per_sec,cycles_per_byte,cycle_source,"
+		       "instructions_per_byte\n");
+		return;
+	}
+
+	printf("%-11s %-8s %-5s %6s %10s %10s %8s %8s\n", "algo", "kernel",
+	       "src", "size", "iters", "MB/s", "cyc/B", "ins/B");
+}
+
+static void
+print_sample(const struct algo *algo, enum source src, size_t size,
+	     long reps, const struct sample *s)
+{
+	const char *cycle_source, *kernel;
+	double bytes, cpb, ipb;
+
+	bytes = (double) size * reps;
+	kernel = sha_kernel(algo->type)->name;
+	if (src == SRC_BATCH)
+	{
+		bytes *= BATCH_NUM;
+		kernel = sha_kernel_many(algo->type)->name;
+	}
+
+	// Prefer real core cycles over the constant-rate timestamp counter.
+	cycle_source = "none";
+	cpb = ipb = 0;
+	if (s->cycles > 0)
+	{
+		cycle_source = "perf";
+		cpb = s->cycles / bytes;
+		ipb = s->instrs / bytes;
+	}
+	else if (s->tsc > 0)
+	{
+		cycle_source = "tsc";
+		cpb = s->tsc / bytes;
+	}
+
+	if (csv)
+	{
+		printf("%s,%s,%s,%zu,%ld,%.6f,%.2f,%.3f,%s,%.3f\n",
+		       sha_name(algo->type), kernel, source_name(src), size,
+		       reps,
+		       s->secs, bytes / s->secs / 1e6, cpb, cycle_source, ipb);
+		return;
+	}
+
+	printf("%-11s %-8s %-5s %6s %10ld %10.2f %8.2f %8.2f\n",
+	       sha_name(algo->type), kernel, source_name(src),
+	       format_size(size), reps,
+	       bytes / s->secs / 1e6, cpb, ipb);
+}
+
+/******************************************************************************
+ * Main.
+ ******************************************************************************/
+static void
+bench(const struct algo *algo, enum source src, const byte *buf, int fd,
+      size_t size)
+{
+	struct sample s;
+	double reps;
+
+	// Warm up and estimate the cost of a single run.
+	measure(algo, src, buf, fd, size, 1, &s);
+
+	// Repeat for long enough to get a stable reading.
+	reps = (s.secs > 0) ? (min_time / s.secs) : (MAX_REPS);
+	if (reps < 1)
+		reps = 1;
+	if (reps > MAX_REPS)
+		reps = MAX_REPS;
+	measure(algo, src, buf, fd, size, reps, &s);
+
+	print_sample(algo, src, size, reps, &s);
+}
+
+static void
+bench_kernels(const struct algo *algo, const char *name, int srcs,
+	      const byte *buf, int fd, size_t size)
+{
+	const struct sha_kernel *kernels;
+	int i, num_kernels;
+
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; i < num_kernels; i++)
+	{
+		if (name != NULL && strcmp(name, kernels[i].name) != 0)
+			continue;
+
+		// Skip kernels for other algorithms or other CPUs.
+		if (!sha_kernel_select(algo->type, kernels[i].name))
+			continue;
+
+		// Multi-lane kernels only hash batches.
+		if (sha_kernel(algo->type) == &kernels[i])
+		{
+			if (srcs & SRC_MEM)
+				bench(algo, SRC_MEM, buf, fd, size);
+			if (srcs & SRC_FILE)
+				bench(algo, SRC_FILE, buf, fd, size);
+		}
+		if (sha_kernel_many(algo->type) == &kernels[i])
+		{
+			if (srcs & SRC_BATCH)
+				bench(algo, SRC_BATCH, buf, fd, size);
+		}
+	}
+
+	sha_kernel_reset(algo->type);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *dir, *kernel, *mode;
+	size_t max, min, size;
+	int fd, flag, i, srcs;
+	bool pflag;
+	byte *buf;
+
+	// Parse the command-line switches.
+	dir = "/tmp";
+	kernel = NULL;
+	max = DEFAULT_MAX;
+	min = DEFAULT_MIN;
+	mode = NULL;
+	pflag = false;
+	srcs = SRC_MEM;
+	while ((flag = getopt(argc, argv, "a:cd:hk:m:M:ps:t:")) != -1)
+	{
+		switch (flag)
+		{
+		case 'a':
+			mode = optarg;
+			break;
+
+		case 'c':
+			csv = true;
+			break;
+
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'k':
+			kernel = optarg;
+			break;
+
+		case 'm':
+			min = parse_size(optarg);
+			break;
+
+		case 'M':
+			max = parse_size(optarg);
+			break;
+
+		case 'p':
+			pflag = true;
+			break;
+
+		case 's':
+			if (strcmp(optarg, "mem") == 0)
+				srcs = SRC_MEM;
+			else if (strcmp(optarg, "file") == 0)
+				srcs = SRC_FILE;
+			else if (strcmp(optarg, "batch") == 0)
+				srcs = SRC_BATCH;
+			else if (strcmp(optarg, "all") == 0)
+				srcs = SRC_MEM | SRC_FILE | SRC_BATCH;
+			else
+				usage(argv[0]);
+			break;
+
+		case 't':
+			min_time = atof(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || min > max || min_time <= 0)
+		usage(argv[0]);
+
+	// Check the requested mode exists.
+	if (mode != NULL)
+	{
+		for (i = 0; i < num_algos; i++)
+		{
+			if (strcmp(mode, algos[i].mode) == 0)
+				break;
+		}
+
+		if (i == num_algos)
+			usage(argv[0]);
+	}
+
+	if (pflag)
+		perf_init();
+
+	// Prepare a message of the largest size, reused for all smaller ones.
+	buf = malloc(max);
+	if (buf == NULL)
+		err(EXIT_FAILURE, "malloc");
+	for (size = 0; size < max; size++)
+		buf[size] = size * 251 + 17;
+
+	print_header();
+	for (size = min; size <= max; size *= STEP)
+	{
+		fd = -1;
+		if (srcs & SRC_FILE)
+			fd = make_file(dir, buf, size);
+
+		for (i = 0; i < num_algos; i++)
+		{
+			if (mode != NULL && strcmp(mode, algos[i].mode) != 0)
+				continue;
+
+			bench_kernels(&algos[i], kernel, srcs, buf, fd, size);
+		}
+
+		if (fd >= 0)
+			close(fd);
+
+		// Don't wrap around when stepping past the largest size.
+		if (size > SIZE_MAX / STEP)
+			break;
+	}
+
+	free(buf);
+
+	return (EXIT_SUCCESS);
+}
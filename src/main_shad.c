@@ -0,0 +1,124 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/signalfd.h>
+
+#include <err.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "shad.h"
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-h] [-k kernel] [-s socket]\n\n"
+		"Serves message digests to local clients over a Unix\n"
+		"socket.  Requests arriving together are hashed in one\n"
+		"batch per algorithm, so small payloads from many clients\n"
+		"share the lanes of the batch kernels.\n"
+		"\n"
+		"  -h    Display this message.\n"
+		"  -k    Force the named kernel, where it is supported.\n"
+		"  -s    Socket path (default: %s).\n",
+		name, SHAD_SOCKET);
+
+	exit(EXIT_FAILURE);
+}
+
+static void
+select_kernel(const char *name)
+{
+	static const enum sha_type types[] = {
+		SHA1, SHA256, SHA512
+	};
+	bool found;
+	int i;
+
+	found = false;
+	for (i = 0; i < sizeof(types) / sizeof(enum sha_type); i++)
+	{
+		if (sha_kernel_select(types[i], name))
+			found = true;
+	}
+
+	if (!found)
+		errx(EXIT_FAILURE, "Kernel %s is unknown or unsupported.",
+		     name);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *path;
+	int flag, sock, stop;
+	sigset_t mask;
+	bool result;
+
+	path = SHAD_SOCKET;
+	while ((flag = getopt(argc, argv, "hk:s:")) != -1)
+	{
+		switch (flag)
+		{
+		case 'k':
+			select_kernel(optarg);
+			break;
+
+		case 's':
+			path = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	// Termination signals end the event loop, so the socket is removed.
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	stop = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (stop < 0)
+		err(EXIT_FAILURE, "signalfd");
+
+	sock = shad_listen(path);
+	if (sock < 0)
+		return (EXIT_FAILURE);
+
+	result = shad_serve(sock, stop);
+
+	close(sock);
+	unlink(path);
+
+	return ((result) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+}
@@ -0,0 +1,233 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shad.h"
+
+#define DEFAULT_DEPTH	256
+#define DEFAULT_LEN	64
+#define DEFAULT_NUM	100000
+#define SHM_LEN		(16 * 1024 * 1024)
+
+struct algo
+{
+	const char	*name;
+	enum sha_type	 type;
+};
+
+static const struct algo algos[] = {
+	{ "1",       SHA1       },
+	{ "224",     SHA224     },
+	{ "256",     SHA256     },
+	{ "384",     SHA384     },
+	{ "512",     SHA512     },
+	{ "512/224", SHA512_224 },
+	{ "512/256", SHA512_256 }
+};
+
+static const int num_algos = sizeof(algos) / sizeof(struct algo);
+
+static word64 state = 0x9e3779b97f4a7c15;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-hm] [-a mode] [-d depth] [-l length]\n"
+		"       [-n requests] [-s socket]\n\n"
+		"Stands in for a service using shad: sends random payloads,\n"
+		"keeping several requests in flight, and checks every\n"
+		"digest returned.\n"
+		"\n"
+		"  -a    Mode (default: 256).\n"
+		"  -d    Requests in flight (default: %d).\n"
+		"  -h    Display this message.\n"
+		"  -l    Longest payload (default: %d).\n"
+		"  -m    Pass payloads through shared memory.\n"
+		"  -n    Number of requests (default: %d).\n"
+		"  -s    Socket path (default: %s).\n",
+		name, DEFAULT_DEPTH, DEFAULT_LEN, DEFAULT_NUM, SHAD_SOCKET);
+
+	exit(EXIT_FAILURE);
+}
+
+static word64
+next(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1d);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+int
+main(int argc, char **argv)
+{
+	long depth, done, i, max_len, mismatches, num, sent;
+	struct shad_resp resp;
+	struct shad_req *reqs;
+	byte hash[SHA_HASH];
+	enum sha_type type;
+	const char *path;
+	int fd, flag, shm;
+	double start;
+	bool use_shm;
+	byte *data;
+
+	path = SHAD_SOCKET;
+	type = SHA256;
+	depth = DEFAULT_DEPTH;
+	max_len = DEFAULT_LEN;
+	num = DEFAULT_NUM;
+	use_shm = false;
+	while ((flag = getopt(argc, argv, "a:d:hl:mn:s:")) != -1)
+	{
+		switch (flag)
+		{
+		case 'a':
+			for (i = 0; i < num_algos; i++)
+			{
+				if (strcmp(algos[i].name, optarg) == 0)
+					break;
+			}
+			if (i == num_algos)
+				usage(argv[0]);
+			type = algos[i].type;
+			break;
+
+		case 'd':
+			depth = atol(optarg);
+			break;
+
+		case 'l':
+			max_len = atol(optarg);
+			break;
+
+		case 'm':
+			use_shm = true;
+			break;
+
+		case 'n':
+			num = atol(optarg);
+			break;
+
+		case 's':
+			path = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || depth < 1 || max_len < 0 ||
+	    max_len > SHAD_MAX_LEN || num < 0)
+		usage(argv[0]);
+
+	fd = shad_connect(path);
+	if (fd < 0)
+		err(EXIT_FAILURE, "%s", path);
+
+	// Payloads are taken from one random region, shared if asked.
+	shm = memfd_create("shadc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm < 0 || ftruncate(shm, SHM_LEN) != 0)
+		err(EXIT_FAILURE, "memfd_create");
+	data = mmap(NULL, SHM_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, shm,
+		    0);
+	if (data == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+	for (i = 0; i < SHM_LEN; i++)
+		data[i] = next() >> 56;
+	if (use_shm)
+	{
+		if (!shad_map(fd, shm, SHM_LEN) || !shad_recv(fd, &resp) ||
+		    resp.status != SHAD_OK)
+			errx(EXIT_FAILURE, "Couldn't share payloads.");
+	}
+
+	reqs = calloc(depth, sizeof(*reqs));
+	if (reqs == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	// Keep the pipeline full, checking replies as they come back.
+	mismatches = 0;
+	start = now();
+	for (sent = done = 0; done < num;)
+	{
+		while (sent < num && sent - done < depth)
+		{
+			reqs[sent % depth].id = sent;
+			reqs[sent % depth].op = (use_shm) ? (SHAD_SHM) :
+			    (SHAD_HASH);
+			reqs[sent % depth].type = type;
+			reqs[sent % depth].len = next() % (max_len + 1);
+			reqs[sent % depth].offset = next() %
+			    (SHM_LEN - reqs[sent % depth].len + 1);
+			if (!shad_send(fd, &reqs[sent % depth],
+				       &data[reqs[sent % depth].offset]))
+				err(EXIT_FAILURE, "send");
+			sent++;
+		}
+
+		if (!shad_recv(fd, &resp))
+			errx(EXIT_FAILURE, "Connection lost.");
+		if (resp.id != done % 0x100000000)
+			errx(EXIT_FAILURE, "Reply %u out of order.", resp.id);
+
+		sha_buf(type, &data[reqs[done % depth].offset],
+			reqs[done % depth].len, hash);
+		if (resp.status != SHAD_OK || resp.len != sha_hash_len(type) ||
+		    memcmp(resp.hash, hash, resp.len) != 0)
+			mismatches++;
+		done++;
+	}
+
+	printf("%ld requests in %.3f s, %.0f per second, %ld mismatches.\n",
+	       num, now() - start, num / (now() - start), mismatches);
+
+	return ((mismatches == 0) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
+}
@@ -31,6 +31,7 @@
 #include <dlfcn.h>
 #include <dirent.h>
 #include <err.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,9 +39,12 @@
 #include <unistd.h>
 
 #include "sha.h"
+#include "test_sums.h"
 #include "testify.h"
 
 #define MAX_LEN(max, s)		(((max) < strlen((s))) ? strlen((s)) : max)
+#define PERF_REPEAT		100
+#define PERF_TOLERANCE		10
 #define TEST_INFO		"test"
 #define TEST_DIR		"obj"
 #define TEST_PREFIX		"test_"
@@ -54,6 +58,7 @@ struct unit_test
 	test_fcn_t	*test;
 	const char	*name;
 	const char	*summary;
+	double		 baseline;
 };
 
 static struct unit_test tests[] = {
@@ -86,20 +91,151 @@ static struct unit_test tests[] = {
 		.test = test_sha512,
 		.name = "SHA-512",
 		.summary = "Exercises the SHA-512 implementation."
+	},
+	{
+		.test = test_sha512_224,
+		.name = "SHA-512/224",
+		.summary = "Exercises the SHA-512/224 implementation."
+	},
+	{
+		.test = test_sha512_256,
+		.name = "SHA-512/256",
+		.summary = "Exercises the SHA-512/256 implementation."
+	},
+	{
+		.test = test_kernels,
+		.name = "Kernels",
+		.summary = "Compares all kernels against the reference on "
+			   "random messages."
+	},
+	{
+		.test = test_tree,
+		.name = "Tree",
+		.summary = "Hashes a directory tree on several threads."
+	},
+	{
+		.test = test_dupes,
+		.name = "Dupes",
+		.summary = "Finds identical files among near misses."
+	},
+	{
+		.test = test_chunk,
+		.name = "Chunk",
+		.summary = "Splits data into content-defined chunks."
+	},
+	{
+		.test = test_range,
+		.name = "Range",
+		.summary = "Hashes byte ranges of one file from several "
+			   "threads."
+	},
+	{
+		.test = test_cold,
+		.name = "Cold",
+		.summary = "Hashes files around the page cache."
+	},
+	{
+		.test = test_shad,
+		.name = "Shad",
+		.summary = "Serves pipelined requests from several clients."
+	},
+	{
+		.test = test_slab,
+		.name = "Slab",
+		.summary = "Interleaves many streams from a slab of contexts."
+	},
+	{
+		.test = test_sha256d,
+		.name = "SHA-256d",
+		.summary = "Double SHA-256, streamed and batched, on every "
+			   "kernel."
+	},
+	{
+		.test = test_merkle,
+		.name = "Merkle",
+		.summary = "Builds Merkle trees over SHA-256 leaves."
+	},
+	{
+		.test = test_stats,
+		.name = "Stats",
+		.summary = "Counts reads and blocks across threads."
+	},
+	{
+		.test = test_storm,
+		.name = "Storm",
+		.summary = "Batches many small files, with and without "
+			   "io_uring."
+	},
+	{
+		.test = test_step,
+		.name = "Step",
+		.summary = "Resumes hashing a non-blocking pipe."
+	},
+	{
+		.test = test_hpp,
+		.name = "C++",
+		.summary = "Compares constexpr digests with the runtime ones."
+	},
+	{
+		.test = test_sparse,
+		.name = "Sparse",
+		.summary = "Hashes holes from memory, reading only data."
+	},
+	{
+		.test = test_tune,
+		.name = "Tune",
+		.summary = "Saves, loads, and applies per-host settings."
+	},
+	{
+		.test = test_tee,
+		.name = "Tee",
+		.summary = "Hashes a stream while passing it through."
 	}
 };
 
 static const int num_tests = sizeof(tests) / sizeof(struct unit_test);
 
+static bool pflag = false;
+static FILE *record = NULL;
+static int tolerance = PERF_TOLERANCE;
+
 static bool
 run_test(struct unit_test *test)
 {
+	double mbps;
+	bool result;
+
 	// Sanity check.
 	assert(test != NULL);
 
 	fprintf(stderr, "Executing test %s...\n", test->name);
 
-	return ((*test->test)());
+	test_perf.secs = 0;
+	test_perf.bytes = 0;
+	result = (*test->test)();
+
+	// Only tests that hash files have a throughput.
+	if (!pflag || test_perf.bytes == 0 || test_perf.secs <= 0)
+		return (result);
+
+	mbps = test_perf.bytes / test_perf.secs / 1e6;
+	fprintf(stderr, "%s: %" PRIu64 " bytes in %.3f s, %.2f MB/s.\n",
+		test->name, test_perf.bytes, test_perf.secs, mbps);
+
+	if (record != NULL)
+		fprintf(record, "%s %.2f\n", test->name, mbps);
+
+	// Check against the stored baseline.
+	if (test->baseline > 0 &&
+	    mbps < test->baseline * (100 - tolerance) / 100)
+	{
+		fprintf(stderr, "%s: Throughput is more than %d%% below the "
+			"baseline of %.2f MB/s.\n", test->name, tolerance,
+			test->baseline);
+		result = false;
+	}
+
+	return (result);
 }
 
 static struct unit_test *
@@ -119,6 +255,37 @@ find_test(const char *name)
 	return (NULL);
 }
 
+static void
+load_baseline(const char *path)
+{
+	struct unit_test *test;
+	char name[64];
+	double mbps;
+	FILE *fp;
+
+	// Sanity check.
+	assert(path != NULL);
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(EXIT_FAILURE, "%s", path);
+
+	// Each line holds a test name and its throughput in MB/s.
+	while (fscanf(fp, "%63s %lf", name, &mbps) == 2)
+	{
+		test = find_test(name);
+		if (test == NULL)
+		{
+			fprintf(stderr, "Can't find test %s.\n", name);
+			continue;
+		}
+
+		test->baseline = mbps;
+	}
+
+	fclose(fp);
+}
+
 static void
 print_usage(const char *name)
 {
@@ -128,13 +295,23 @@ print_usage(const char *name)
 	assert(name != NULL);
 
 	fprintf(stderr,
-		"Usage: %s [-ahl] [name ...]\n"
+		"Usage: %s [-ahp] [-b file] [-B file] [-n num] [-t pct] "
+		"[name ...]\n"
 		"\n"
 		"  -a    Run all tests.\n"
+		"  -b    Fail tests whose throughput falls below the baseline\n"
+		"        stored in file.  Implies -p.\n"
+		"  -B    Record the measured throughput to file as a new\n"
+		"        baseline.  Implies -p.\n"
 		"  -h    Display this message.\n"
+		"  -n    Hash each test vector num times in performance mode\n"
+		"        (default: %d).\n"
+		"  -p    Performance mode, reporting the throughput of tests.\n"
+		"  -t    Tolerated slowdown against the baseline, in percent\n"
+		"        (default: %d).\n"
 		"\n"
 		"The following tests have been defined:\n",
-		name);
+		name, PERF_REPEAT, PERF_TOLERANCE);
 
 	// Determine the length of the longest test name.
 	len = 0;
@@ -152,14 +329,18 @@ print_usage(const char *name)
 int
 main(int argc, char **argv)
 {
-	int failed, flag, i, num_names, passed;
+	int failed, flag, i, num_names, passed, repeat;
+	const char *baseline, *path;
 	struct unit_test *test;
 	char **names;
 	bool aflag;
 
 	// Parse the command-line switches.
 	aflag = false;
-	while ((flag = getopt(argc, argv, "ah")) != -1)
+	baseline = NULL;
+	path = NULL;
+	repeat = PERF_REPEAT;
+	while ((flag = getopt(argc, argv, "ab:B:hn:pt:")) != -1)
 	{
 		switch (flag)
 		{
@@ -167,11 +348,53 @@ main(int argc, char **argv)
 			aflag = true;
 			break;
 
+		case 'b':
+			baseline = optarg;
+			pflag = true;
+			break;
+
+		case 'B':
+			path = optarg;
+			pflag = true;
+			break;
+
+		case 'n':
+			repeat = atoi(optarg);
+			if (repeat < 1)
+				print_usage(argv[0]);
+			break;
+
+		case 'p':
+			pflag = true;
+			break;
+
+		case 't':
+			tolerance = atoi(optarg);
+			if (tolerance < 0 || tolerance > 100)
+				print_usage(argv[0]);
+			break;
+
 		default:
 			print_usage(argv[0]);
 		}
 	}
 
+	// Set up performance mode.
+	if (pflag)
+	{
+		test_perf.repeat = repeat;
+
+		if (baseline != NULL)
+			load_baseline(baseline);
+
+		if (path != NULL)
+		{
+			record = fopen(path, "w");
+			if (record == NULL)
+				err(EXIT_FAILURE, "%s", path);
+		}
+	}
+
 	// The remaining arguments are test names
 	names = &argv[optind];
 	num_names = argc - optind;
@@ -215,5 +438,8 @@ main(int argc, char **argv)
 
 	fprintf(stderr, "%d tests passed, %d tests failed.\n", passed, failed);
 
-	return (EXIT_SUCCESS);
+	if (record != NULL)
+		fclose(record);
+
+	return ((failed == 0) ? (EXIT_SUCCESS) : (EXIT_FAILURE));
 }
@@ -0,0 +1,247 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "merkle.h"
+#include "pool.h"
+#include "stats.h"
+
+#define NODE		SHA32_HASH
+#define PAIR		(2 * NODE)
+#define RUN		4096
+
+// A pair is exactly one block, so its padding is always the same block.
+static const byte PAD_PAIR[SHA32_BLK] = {
+	[0] = 0x80,
+	[SHA32_BLK - 2] = (PAIR * 8 >> 8) & 0xFF,
+	[SHA32_BLK - 1] = (PAIR * 8 >> 0) & 0xFF
+};
+
+struct level
+{
+	const struct sha_kernel	*kernel;
+	const word32		*init;
+	const byte		*in;
+	size_t			 num;
+	byte			*out;
+};
+
+static void
+store(const word32 *H, byte *out)
+{
+	int i;
+
+	for (i = 0; i < NODE; i++)
+		out[i] = 0xFF & (H[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static void
+pairs(const struct sha_kernel *kernel, const word32 *init, const byte *in,
+      size_t num, byte *out)
+{
+	word32 *H[SHA_LANES], lanes[SHA_LANES][NODE / sizeof(word32)];
+	const byte *blocks[SHA_LANES];
+	size_t i, j, n;
+	word64 start;
+	int width;
+
+	// Each pair is one message block and then the padding block, run
+	// across the lanes together.  Idle lanes repeat the first pair.
+	width = kernel->lanes;
+	for (i = 0; i < num; i += n)
+	{
+		n = (num - i < width) ? (num - i) : (width);
+		for (j = 0; j < width; j++)
+		{
+			memcpy(lanes[j], init, sizeof(lanes[j]));
+			H[j] = lanes[j];
+			blocks[j] = &in[(i + ((j < n) ? (j) : (0))) * PAIR];
+		}
+
+		start = (stats_enabled) ? (stats_start()) : (0);
+		if (kernel->many32 != NULL)
+		{
+			(*kernel->many32)(H, blocks, 1);
+			for (j = 0; j < width; j++)
+				blocks[j] = PAD_PAIR;
+			(*kernel->many32)(H, blocks, 1);
+		}
+		else
+		{
+			(*kernel->fcn32)(H[0], blocks[0], 1);
+			(*kernel->fcn32)(H[0], PAD_PAIR, 1);
+		}
+		if (start != 0)
+			stats_hash(start, 2 * width);
+
+		for (j = 0; j < n; j++)
+			store(lanes[j], &out[(i + j) * NODE]);
+	}
+}
+
+static void
+run(void *arg, size_t index)
+{
+	const struct level *l = arg;
+	size_t first, num;
+
+	// Each job is a run of neighbouring pairs, the roots of adjacent
+	// subtrees one level up.
+	first = index * RUN;
+	num = (l->num - first < RUN) ? (l->num - first) : (RUN);
+	pairs(l->kernel, l->init, &l->in[first * PAIR], num,
+	      &l->out[first * NODE]);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+merkle_build(const byte *leaves, size_t num, const struct merkle_opts *opts,
+	     struct merkle *tree)
+{
+	byte *bufs[2], odd[PAIR], *out;
+	struct sha32 ctx;
+	struct level l;
+	size_t width;
+	int threads;
+
+	if ((leaves == NULL && num > 0) || tree == NULL)
+		return (false);
+
+	memset(tree, 0, sizeof(*tree));
+	if (num == 0)
+	{
+		warnx("A Merkle tree needs at least one leaf.");
+		return (false);
+	}
+
+	// Find the initial hash value and the batch kernel.
+	ctx.type = SHA256;
+	if (!sha32_init(&ctx))
+		return (false);
+	l.kernel = sha_kernel_many(SHA256);
+	if (l.kernel == NULL)
+		return (false);
+	l.init = ctx.H;
+	threads = (opts != NULL && opts->threads > 1) ? (opts->threads) : (1);
+
+	// Without kept levels, two buffers take turns, since every level
+	// fits in the space of the one below it.
+	bufs[0] = bufs[1] = NULL;
+	if (opts == NULL || !opts->keep)
+	{
+		bufs[0] = malloc(((num + 1) / 2) * NODE);
+		bufs[1] = malloc(((num + 3) / 4) * NODE);
+		if (bufs[0] == NULL || bufs[1] == NULL)
+		{
+			warn("malloc");
+			free(bufs[0]);
+			free(bufs[1]);
+			return (false);
+		}
+	}
+
+	tree->levels[0] = leaves;
+	tree->widths[0] = num;
+	tree->num_levels = 1;
+	for (width = num; width > 1; width = (width + 1) / 2)
+	{
+		if (bufs[0] != NULL)
+		{
+			out = bufs[(tree->num_levels - 1) % 2];
+		}
+		else
+		{
+			out = malloc(((width + 1) / 2) * NODE);
+			if (out == NULL)
+			{
+				warn("malloc");
+				merkle_free(tree);
+				return (false);
+			}
+		}
+
+		l.in = tree->levels[tree->num_levels - 1];
+		l.num = width / 2;
+		l.out = out;
+		pool_run(run, &l, (l.num + RUN - 1) / RUN, threads);
+
+		// An odd node is either paired with itself or promoted.
+		if (width % 2 == 1)
+		{
+			if (opts != NULL && opts->duplicate)
+			{
+				memcpy(odd, &l.in[(width - 1) * NODE], NODE);
+				memcpy(&odd[NODE], odd, NODE);
+				pairs(l.kernel, l.init, odd, 1,
+				      &out[(width / 2) * NODE]);
+			}
+			else
+			{
+				memcpy(&out[(width / 2) * NODE],
+				       &l.in[(width - 1) * NODE], NODE);
+			}
+		}
+
+		tree->levels[tree->num_levels] = out;
+		tree->widths[tree->num_levels] = (width + 1) / 2;
+		tree->num_levels++;
+	}
+
+	memcpy(tree->root, tree->levels[tree->num_levels - 1], NODE);
+
+	// Levels in the shared buffers don't outlive the call.
+	if (bufs[0] != NULL)
+	{
+		free(bufs[0]);
+		free(bufs[1]);
+		memset(&tree->levels[1], 0,
+		       (MERKLE_LEVELS - 1) * sizeof(tree->levels[1]));
+	}
+
+	return (true);
+}
+
+void
+merkle_free(struct merkle *tree)
+{
+	int i;
+
+	if (tree == NULL)
+		return;
+
+	// Level 0 belongs to the caller.
+	for (i = 1; i < tree->num_levels; i++)
+	{
+		free((void *) tree->levels[i]);
+		tree->levels[i] = NULL;
+	}
+}
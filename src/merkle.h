@@ -0,0 +1,59 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#ifndef __MERKLE_H
+#define __MERKLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha.h"
+
+#define MERKLE_LEVELS	65
+
+struct merkle_opts
+{
+	int	threads;
+	bool	duplicate;	// Pair an odd last node with itself.
+	bool	keep;		// Keep every level, for building proofs.
+};
+
+// Level 0 is the caller's leaves and the last level is the root.  Other
+// levels are only kept when asked for.
+struct merkle
+{
+	byte		 root[SHA32_HASH];
+	int		 num_levels;
+	size_t		 widths[MERKLE_LEVELS];
+	const byte	*levels[MERKLE_LEVELS];
+};
+
+bool	merkle_build(const byte *leaves, size_t num,
+		     const struct merkle_opts *opts, struct merkle *tree);
+void	merkle_free(struct merkle *tree);
+
+#endif
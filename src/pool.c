@@ -0,0 +1,80 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <pthread.h>
+
+#include "pool.h"
+
+struct pool
+{
+	pool_fcn_t	*fcn;
+	void		*arg;
+	size_t		 num;
+	size_t		 next;
+};
+
+static void *
+runner(void *arg)
+{
+	struct pool *p;
+	size_t i;
+
+	p = arg;
+	while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) <
+	       p->num)
+		(*p->fcn)(p->arg, i);
+
+	return (NULL);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+void
+pool_run(pool_fcn_t *fcn, void *arg, size_t num, int threads)
+{
+	pthread_t tids[(threads > 1) ? (threads - 1) : (1)];
+	int i, started;
+	struct pool p;
+
+	p.fcn = fcn;
+	p.arg = arg;
+	p.num = num;
+	p.next = 0;
+
+	// The calling thread takes a share of the work too.
+	started = 0;
+	for (i = 1; i < threads && i < num; i++)
+	{
+		if (pthread_create(&tids[started], NULL, runner, &p) != 0)
+			break;
+		started++;
+	}
+	runner(&p);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+}
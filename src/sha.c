@@ -0,0 +1,628 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "stats.h"
+#include "tune.h"
+
+#define READ_LEN	(64 * 1024)
+#define SECTOR		512
+
+static const byte zeros[READ_LEN];
+
+/******************************************************************************
+ * Sparse files.
+ ******************************************************************************/
+static bool
+fill(struct sha *ctx, off_t len)
+{
+	size_t n;
+
+	// Holes read as zeros, so they're hashed straight from memory.
+	for (; len > 0; len -= n)
+	{
+		n = (len < sizeof(zeros)) ? (len) : (sizeof(zeros));
+		if (!sha_update(ctx, zeros, n))
+			return (false);
+	}
+
+	return (true);
+}
+
+static bool
+copy(struct sha *ctx, int fd, off_t off, off_t end, byte *buf, size_t len)
+{
+	ssize_t got;
+	size_t want;
+
+	while (off < end)
+	{
+		want = (end - off < len) ? (end - off) : (len);
+		got = stats_pread(fd, buf, want, off);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+		{
+			// The file shrank underneath us.
+			if (got == 0)
+				errno = EIO;
+			return (false);
+		}
+
+		if (!sha_update(ctx, buf, got))
+			return (false);
+		off += got;
+	}
+
+	return (true);
+}
+
+static bool
+sparse(struct sha *ctx, int fd, off_t pos, off_t end, byte *buf, size_t len)
+{
+	off_t data, hole;
+
+	// Only the extents holding data are read.
+	while (pos < end)
+	{
+		data = lseek(fd, pos, SEEK_DATA);
+		if (data < 0 && errno == ENXIO)
+			data = end;
+		else if (data < 0)
+			return (false);
+		if (data > end)
+			data = end;
+		if (!fill(ctx, data - pos))
+			return (false);
+		if (data == end)
+			break;
+
+		hole = lseek(fd, data, SEEK_HOLE);
+		if (hole < 0)
+			return (false);
+		if (hole > end)
+			hole = end;
+		if (!copy(ctx, fd, data, hole, buf, len))
+			return (false);
+		pos = hole;
+	}
+
+	// Anything appended since is read as usual.
+	return (lseek(fd, end, SEEK_SET) == end);
+}
+
+/******************************************************************************
+ * Reading.
+ ******************************************************************************/
+static enum sha_step
+step(struct sha *ctx, int fd, byte *hash, byte *buf, size_t buf_len)
+{
+	ssize_t len;
+
+	// Everything the descriptor has ready is consumed, so this also
+	// suits edge-triggered epoll.  All state lives in the context.
+	while ((len = stats_read(fd, buf, buf_len)) != 0)
+	{
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (SHA_STEP_MORE);
+
+			return (SHA_STEP_ERROR);
+		}
+
+		if (!sha_update(ctx, buf, len))
+		{
+			errno = EINVAL;
+			return (SHA_STEP_ERROR);
+		}
+	}
+
+	if (!sha_final(ctx, hash))
+	{
+		errno = EINVAL;
+		return (SHA_STEP_ERROR);
+	}
+
+	return (SHA_STEP_DONE);
+}
+
+/******************************************************************************
+ * Mapped files.
+ ******************************************************************************/
+static pthread_once_t bus_once = PTHREAD_ONCE_INIT;
+static struct sigaction bus_prev;
+static __thread sigjmp_buf *bus_jmp;
+
+static void
+bus(int sig, siginfo_t *info, void *uctx)
+{
+	// A file mapped by sha_map() on this thread was cut short.
+	if (bus_jmp != NULL)
+		siglongjmp(*bus_jmp, 1);
+
+	// Anything else is handled as it would have been without us.
+	if (bus_prev.sa_flags & SA_SIGINFO)
+	{
+		(*bus_prev.sa_sigaction)(sig, info, uctx);
+	}
+	else if (bus_prev.sa_handler != SIG_DFL &&
+		 bus_prev.sa_handler != SIG_IGN)
+	{
+		(*bus_prev.sa_handler)(sig);
+	}
+	else
+	{
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+}
+
+static void
+bus_init(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = bus;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGBUS, &sa, &bus_prev) != 0)
+		warn("sigaction");
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+const char *
+sha_name(enum sha_type type)
+{
+	switch (type)
+	{
+	case SHA1:
+		return ("SHA-1");
+
+	case SHA224:
+		return ("SHA-224");
+
+	case SHA256:
+		return ("SHA-256");
+
+	case SHA384:
+		return ("SHA-384");
+
+	case SHA512:
+		return ("SHA-512");
+
+	case SHA512_224:
+		return ("SHA-512/224");
+
+	case SHA512_256:
+		return ("SHA-512/256");
+
+	default:
+		return (NULL);
+	}
+}
+
+size_t
+sha_hash_len(enum sha_type type)
+{
+	switch (type)
+	{
+	case SHA1:
+		return (160 / 8);
+
+	case SHA224:
+		return (224 / 8);
+
+	case SHA256:
+		return (256 / 8);
+
+	case SHA384:
+		return (384 / 8);
+
+	case SHA512:
+		return (512 / 8);
+
+	case SHA512_224:
+		return (224 / 8);
+
+	case SHA512_256:
+		return (256 / 8);
+
+	default:
+		return (0);
+	}
+}
+
+void
+sha_hex(const byte *hash, size_t len, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		hex[2 * i + 0] = digits[hash[i] >> 4];
+		hex[2 * i + 1] = digits[hash[i] & 0xF];
+	}
+	hex[2 * len] = '\0';
+}
+
+bool
+sha_init(struct sha *ctx, enum sha_type type)
+{
+	if (ctx == NULL)
+		return (false);
+
+	ctx->ctx.type = type;
+	switch (type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		ctx->ctx.s32.type = type;
+		return (sha32_init(&ctx->ctx.s32));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		ctx->ctx.s64.type = type;
+		return (sha64_init(&ctx->ctx.s64));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_update(struct sha *ctx, const void *data, size_t len)
+{
+	if (ctx == NULL)
+		return (false);
+
+	switch (ctx->ctx.type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_update(&ctx->ctx.s32, data, len));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_update(&ctx->ctx.s64, data, len));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_final(struct sha *ctx, byte *hash)
+{
+	if (ctx == NULL)
+		return (false);
+
+	switch (ctx->ctx.type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_final(&ctx->ctx.s32, hash));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_final(&ctx->ctx.s64, hash));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_copy(struct sha *dst, const struct sha *src)
+{
+	if (dst == NULL || src == NULL)
+		return (false);
+
+	switch (src->ctx.type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_copy(&dst->ctx.s32, &src->ctx.s32));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_copy(&dst->ctx.s64, &src->ctx.s64));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_prefixed(const struct sha *prefix, const void *data, size_t len,
+	     byte *hash)
+{
+	if (prefix == NULL)
+		return (false);
+
+	switch (prefix->ctx.type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_prefixed(&prefix->ctx.s32, data, len, hash));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_prefixed(&prefix->ctx.s64, data, len, hash));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_buf(enum sha_type type, const void *data, size_t len, byte *hash)
+{
+	switch (type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_buf(type, data, len, hash));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_buf(type, data, len, hash));
+
+	default:
+		return (false);
+	}
+}
+
+bool
+sha_fd(enum sha_type type, int fd, byte *hash)
+{
+	byte stack[READ_LEN], *buf;
+	struct pollfd pfd;
+	struct sha ctx;
+	struct stat st;
+	bool done, result;
+	size_t len;
+	off_t pos;
+
+	if (!sha_init(&ctx, type))
+		return (false);
+
+	// Tuned reads larger than the stack buffer come from the heap.
+	buf = stack;
+	len = tune_read_len;
+	if (len > sizeof(stack))
+		buf = malloc(len);
+	if (buf == NULL || len == 0)
+	{
+		buf = stack;
+		len = sizeof(stack);
+	}
+
+	// A regular file with fewer blocks than bytes has holes to skip.
+	result = true;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_blocks * SECTOR < st.st_size &&
+	    (pos = lseek(fd, 0, SEEK_CUR)) >= 0 && pos < st.st_size &&
+	    !sparse(&ctx, fd, pos, st.st_size, buf, len))
+	{
+		warn("read");
+		result = false;
+	}
+
+	// A non-blocking descriptor is waited on rather than given up on.
+	for (done = !result; !done;)
+	{
+		switch (step(&ctx, fd, hash, buf, len))
+		{
+		case SHA_STEP_DONE:
+			done = true;
+			break;
+
+		case SHA_STEP_MORE:
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			{
+				warn("poll");
+				result = false;
+				done = true;
+			}
+			break;
+
+		default:
+			warn("read");
+			result = false;
+			done = true;
+		}
+	}
+
+	if (buf != stack)
+		free(buf);
+
+	return (result);
+}
+
+bool
+sha_map(enum sha_type type, int fd, byte *hash)
+{
+	struct sha ctx;
+	struct stat st;
+	sigjmp_buf jmp;
+	const byte *p;
+	bool result;
+	off_t pos;
+
+	// Only regular files can be mapped; anything else is read.
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    (pos = lseek(fd, 0, SEEK_CUR)) < 0 || pos >= st.st_size)
+		return (sha_fd(type, fd, hash));
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return (sha_fd(type, fd, hash));
+	madvise((void *) p, st.st_size, MADV_SEQUENTIAL);
+
+	// Pages cut off by a concurrent truncate raise SIGBUS, which would
+	// kill the process; the file is read from the start instead.
+	pthread_once(&bus_once, bus_init);
+	if (sigsetjmp(jmp, 1) != 0)
+	{
+		bus_jmp = NULL;
+		munmap((void *) p, st.st_size);
+		warnx("File shrank while mapped; reading it instead.");
+		if (lseek(fd, pos, SEEK_SET) < 0)
+			return (false);
+
+		return (sha_fd(type, fd, hash));
+	}
+	bus_jmp = &jmp;
+
+	// Page faults do the reading, so it's counted without a time.
+	stats_io(0, st.st_size - pos, st.st_size - pos);
+	result = sha_init(&ctx, type) &&
+		 sha_update(&ctx, &p[pos], st.st_size - pos) &&
+		 sha_final(&ctx, hash);
+	bus_jmp = NULL;
+	munmap((void *) p, st.st_size);
+
+	// Leave the descriptor where reading it would have.
+	lseek(fd, st.st_size, SEEK_SET);
+
+	return (result);
+}
+
+enum sha_step
+sha_fd_step(struct sha *ctx, int fd, byte *hash)
+{
+	byte buf[READ_LEN];
+
+	return (step(ctx, fd, hash, buf, sizeof(buf)));
+}
+
+bool
+sha_range(enum sha_type type, int fd, off_t offset, off_t len, byte *hash)
+{
+	byte buf[READ_LEN];
+	struct sha ctx;
+	ssize_t got;
+	size_t want;
+
+	if (offset < 0 || len < 0 || !sha_init(&ctx, type))
+		return (false);
+
+	// Reading by position leaves the shared file offset alone, so many
+	// threads can hash ranges of one descriptor at once.
+	while (len > 0)
+	{
+		want = (len < sizeof(buf)) ? (len) : (sizeof(buf));
+		got = stats_pread(fd, buf, want, offset);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			warn("pread");
+			return (false);
+		}
+
+		if (got == 0)
+		{
+			warnx("Range ends past the end of the file.");
+			return (false);
+		}
+
+		if (!sha_update(&ctx, buf, got))
+			return (false);
+
+		offset += got;
+		len -= got;
+	}
+
+	return (sha_final(&ctx, hash));
+}
+
+bool
+sha_many(enum sha_type type, const struct sha_msg *msgs, size_t num,
+	 byte *hashes)
+{
+	switch (type)
+	{
+	case SHA1:
+	case SHA224:
+	case SHA256:
+		return (sha32_many(type, msgs, num, hashes));
+
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		return (sha64_many(type, msgs, num, hashes));
+
+	default:
+		return (false);
+	}
+}
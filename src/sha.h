@@ -28,9 +28,16 @@
 #ifndef __SHA_H
 #define __SHA_H
 
+#include <sys/types.h>
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef uint8_t byte;
 typedef uint32_t word32;
 typedef uint64_t word64;
@@ -41,36 +48,61 @@ enum sha_type
 	SHA224,
 	SHA256,
 	SHA384,
-	SHA512
+	SHA512,
+	SHA512_224,
+	SHA512_256
+};
+
+struct sha_msg
+{
+	const void	*data;
+	size_t		 len;
 };
 
+#define SHA_LINE	64
+
 /******************************************************************************
  * 32-bit
  ******************************************************************************/
 #define SHA32_BLK	(512 / 8)
 #define SHA32_HASH	(256 / 8)
 
+// Contexts hold one block and no text, filling two cache lines.
 struct sha32
 {
 	enum sha_type	type;
+	word32	block_len;
+	word64	message_len;
 	word32	H[SHA32_HASH / sizeof(word32)];
 	union
 	{
-		byte	bytes[2 * SHA32_BLK / sizeof(byte)];
-		word32	words[2 * SHA32_BLK / sizeof(word32)];
+		byte	bytes[SHA32_BLK / sizeof(byte)];
+		word32	words[SHA32_BLK / sizeof(word32)];
 	} block;
-	word32	block_len;
-	word64	message_len;
-	char	hash[SHA32_HASH * 2 + 1];
-};
+} __attribute__((aligned(SHA_LINE)));
 
 char	*sha1(int fd);
 char	*sha224(int fd);
 char	*sha256(int fd);
 
+bool	 sha1_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+bool	 sha224_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+bool	 sha256_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+
+bool	 sha256d(const void *data, size_t len, byte *hash);
+bool	 sha256d_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+
 bool	 sha32_init(struct sha32 *ctx);
 bool	 sha32_add(struct sha32 *ctx, int len);
-bool	 sha32_calc(struct sha32 *ctx);
+bool	 sha32_update(struct sha32 *ctx, const void *data, size_t len);
+bool	 sha32_final(struct sha32 *ctx, byte *hash);
+bool	 sha32_copy(struct sha32 *dst, const struct sha32 *src);
+bool	 sha32_prefixed(const struct sha32 *prefix, const void *data,
+			size_t len, byte *hash);
+bool	 sha32_buf(enum sha_type type, const void *data, size_t len,
+		   byte *hash);
+bool	 sha32_many(enum sha_type type, const struct sha_msg *msgs, size_t num,
+		    byte *hashes);
 
 /******************************************************************************
  * 64-bit
@@ -78,25 +110,172 @@ bool	 sha32_calc(struct sha32 *ctx);
 #define SHA64_BLK	(1024 / 8)
 #define SHA64_HASH	(512 / 8)
 
+// Contexts hold one block and no text, filling four cache lines.
 struct sha64
 {
 	enum sha_type	type;
+	word32	block_len;
+	word64	message_len[2];
 	word64	H[SHA64_HASH / sizeof(word64)];
 	union
 	{
-		byte	bytes[2 * SHA64_BLK / sizeof(byte)];
-		word64	words[2 * SHA64_BLK / sizeof(word64)];
+		byte	bytes[SHA64_BLK / sizeof(byte)];
+		word64	words[SHA64_BLK / sizeof(word64)];
 	} block;
-	word64	block_len;
-	word64	message_len[2];
-	char	hash[SHA64_HASH * 2 + 1];
-};
+} __attribute__((aligned(SHA_LINE)));
 
 char	*sha384(int fd);
 char	*sha512(int fd);
+char	*sha512_224(int fd);
+char	*sha512_256(int fd);
+
+bool	 sha384_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+bool	 sha512_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+bool	 sha512_224_many(const struct sha_msg *msgs, size_t num, byte *hashes);
+bool	 sha512_256_many(const struct sha_msg *msgs, size_t num, byte *hashes);
 
 bool	 sha64_init(struct sha64 *ctx);
 bool	 sha64_add(struct sha64 *ctx, int len);
-bool	 sha64_calc(struct sha64 *ctx);
+bool	 sha64_update(struct sha64 *ctx, const void *data, size_t len);
+bool	 sha64_final(struct sha64 *ctx, byte *hash);
+bool	 sha64_copy(struct sha64 *dst, const struct sha64 *src);
+bool	 sha64_prefixed(const struct sha64 *prefix, const void *data,
+			size_t len, byte *hash);
+bool	 sha64_buf(enum sha_type type, const void *data, size_t len,
+		   byte *hash);
+bool	 sha64_many(enum sha_type type, const struct sha_msg *msgs, size_t num,
+		    byte *hashes);
+
+/******************************************************************************
+ * Kernels
+ ******************************************************************************/
+#define SHA_LANES	8
+
+struct sha_kernel
+{
+	const char	*name;
+	enum sha_type	 type;
+	bool		 (*supported)(void);
+
+	// Single-stream kernels.
+	void		 (*fcn32)(word32 *H, const byte *blocks, size_t num);
+	void		 (*fcn64)(word64 *H, const byte *blocks, size_t num);
+
+	// Multi-lane kernels, advancing each lane by num blocks.
+	int		 lanes;
+	void		 (*many32)(word32 *H[], const byte *blocks[],
+				   size_t num);
+	void		 (*many64)(word64 *H[], const byte *blocks[],
+				   size_t num);
+};
+
+const struct sha_kernel	*sha_kernel(enum sha_type type);
+const struct sha_kernel	*sha_kernel_many(enum sha_type type);
+const struct sha_kernel	*sha_kernels(int *num);
+bool			 sha_kernel_select(enum sha_type type,
+					   const char *name);
+bool			 sha_kernel_reset(enum sha_type type);
+
+/******************************************************************************
+ * Generic
+ ******************************************************************************/
+#define SHA_HASH	SHA64_HASH
+
+// Both contexts lead with their type, which the generic one shares.
+struct sha
+{
+	union
+	{
+		enum sha_type	type;
+		struct sha32	s32;
+		struct sha64	s64;
+	} ctx;
+};
+
+struct sha_slab;
+
+// Progress of sha_fd_step() on a descriptor that may not be ready.
+enum sha_step
+{
+	SHA_STEP_ERROR,		// Read failed; errno says why.
+	SHA_STEP_MORE,		// Would block; call again when readable.
+	SHA_STEP_DONE		// End of file; the hash is written.
+};
+
+// Totals across all threads, counted while stats are enabled.
+struct sha_stats
+{
+	word64	bytes_read;
+	word64	reads;
+	word64	short_reads;
+	word64	blocks;
+	word64	io_ns;
+	word64	hash_ns;
+};
+
+// Whole-file I/O, as chosen for the host by sha --autotune.
+enum sha_io
+{
+	SHA_IO_READ,
+	SHA_IO_MMAP,
+	SHA_IO_DIRECT
+};
+
+#define SHA_TUNE_FAMILIES	3
+#define SHA_TUNE_NAME		16
+
+// Settings loaded at startup from sha_tune_path().  Zero or an empty name
+// means the default.  Kernels are per family: SHA-1, SHA-256, SHA-512.
+struct sha_tune
+{
+	enum sha_io	io;
+	size_t		read_len;
+	int		threads;
+	char		kernel[SHA_TUNE_FAMILIES][SHA_TUNE_NAME];
+	char		batch[SHA_TUNE_FAMILIES][SHA_TUNE_NAME];
+};
+
+const char	*sha_name(enum sha_type type);
+size_t		 sha_hash_len(enum sha_type type);
+void		 sha_hex(const byte *hash, size_t len, char *hex);
+
+bool		 sha_init(struct sha *ctx, enum sha_type type);
+bool		 sha_update(struct sha *ctx, const void *data, size_t len);
+bool		 sha_final(struct sha *ctx, byte *hash);
+bool		 sha_copy(struct sha *dst, const struct sha *src);
+bool		 sha_prefixed(const struct sha *prefix, const void *data,
+			      size_t len, byte *hash);
+bool		 sha_buf(enum sha_type type, const void *data, size_t len,
+			 byte *hash);
+bool		 sha_fd(enum sha_type type, int fd, byte *hash);
+enum sha_step	 sha_fd_step(struct sha *ctx, int fd, byte *hash);
+bool		 sha_map(enum sha_type type, int fd, byte *hash);
+bool		 sha_cold(enum sha_type type, int fd, byte *hash);
+bool		 sha_tee(enum sha_type type, int in, int out, byte *hash);
+bool		 sha_range(enum sha_type type, int fd, off_t offset,
+			   off_t len, byte *hash);
+bool		 sha_many(enum sha_type type, const struct sha_msg *msgs,
+			  size_t num, byte *hashes);
+
+struct sha_slab	*sha_slab_create(void);
+void		 sha_slab_destroy(struct sha_slab *slab);
+struct sha	*sha_slab_alloc(struct sha_slab *slab);
+void		 sha_slab_free(struct sha_slab *slab, struct sha *ctx);
+
+void		 sha_stats_enable(bool on);
+void		 sha_stats_get(struct sha_stats *stats);
+void		 sha_stats_reset(void);
+
+const char	*sha_tune_path(void);
+void		 sha_tune_get(struct sha_tune *tune);
+bool		 sha_tune_load(const char *path, struct sha_tune *tune);
+bool		 sha_tune_apply(const struct sha_tune *tune);
+bool		 sha_tune_save(const char *path, const struct sha_tune *tune);
+bool		 sha_tune_run(enum sha_type type, const char *path,
+			      struct sha_tune *tune);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
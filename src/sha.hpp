@@ -0,0 +1,285 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#ifndef __SHA_HPP
+#define __SHA_HPP
+
+// SHA-1 and SHA-2 for C++20.  Each function is constexpr, so a digest of
+// a constant string is computed by the compiler.  Anything else is handed
+// to sha_buf() and the same kernels as the C library.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+#include "consts.h"
+#include "sha.h"
+
+namespace shapp
+{
+
+template <std::size_t N>
+using digest = std::array<std::uint8_t, N>;
+
+namespace detail
+{
+
+inline constexpr std::uint32_t K_1[] = { SHA_K_1 };
+inline constexpr std::uint32_t K_2[] = { SHA_K_2 };
+inline constexpr std::uint32_t H_1[] = { SHA_H_1, 0, 0, 0 };
+inline constexpr std::uint32_t H_224[] = { SHA_H_224 };
+inline constexpr std::uint32_t H_256[] = { SHA_H_256 };
+
+inline constexpr std::uint64_t K_64[] = { SHA_K_64 };
+inline constexpr std::uint64_t H_384[] = { SHA_H_384 };
+inline constexpr std::uint64_t H_512[] = { SHA_H_512 };
+inline constexpr std::uint64_t H_512_224[] = { SHA_H_512_224 };
+inline constexpr std::uint64_t H_512_256[] = { SHA_H_512_256 };
+
+template <typename W>
+constexpr W
+rotr(W x, int n)
+{
+	return ((x >> n) | (x << (sizeof(W) * 8 - n)));
+}
+
+template <typename W>
+constexpr W
+load(const std::uint8_t *p)
+{
+	W w = 0;
+
+	for (std::size_t i = 0; i < sizeof(W); i++)
+		w = (w << 8) | p[i];
+
+	return (w);
+}
+
+constexpr void
+block_sha1(std::uint32_t *H, const std::uint8_t *blk)
+{
+	std::uint32_t W[80], a, b, c, d, e, f, T;
+	int t;
+
+	for (t = 0; t < 16; t++)
+		W[t] = load<std::uint32_t>(&blk[4 * t]);
+	for (; t < 80; t++)
+		W[t] = rotr<std::uint32_t>(W[t - 3] ^ W[t - 8] ^ W[t - 14] ^
+					   W[t - 16], 31);
+
+	a = H[0];
+	b = H[1];
+	c = H[2];
+	d = H[3];
+	e = H[4];
+	for (t = 0; t < 80; t++)
+	{
+		if (t < 20)
+			f = (b & c) ^ (~b & d);
+		else if (t >= 40 && t < 60)
+			f = (b & c) ^ (b & d) ^ (c & d);
+		else
+			f = b ^ c ^ d;
+
+		T = rotr<std::uint32_t>(a, 27) + f + e + K_1[t / 20] + W[t];
+		e = d;
+		d = c;
+		c = rotr<std::uint32_t>(b, 2);
+		b = a;
+		a = T;
+	}
+
+	H[0] += a;
+	H[1] += b;
+	H[2] += c;
+	H[3] += d;
+	H[4] += e;
+}
+
+// SHA-256 and SHA-512 differ only in word size, rotations and rounds.
+template <typename W>
+constexpr void
+block_sha2(W *H, const std::uint8_t *blk)
+{
+	constexpr bool wide = sizeof(W) == 8;
+	constexpr int rounds = (wide) ? (80) : (64);
+	W w[80], v[8], T1, T2;
+	int i, t;
+
+	for (t = 0; t < 16; t++)
+		w[t] = load<W>(&blk[sizeof(W) * t]);
+	for (; t < rounds; t++)
+	{
+		W s0, s1;
+
+		if constexpr (wide)
+		{
+			s0 = rotr(w[t - 15], 1) ^ rotr(w[t - 15], 8) ^
+			     (w[t - 15] >> 7);
+			s1 = rotr(w[t - 2], 19) ^ rotr(w[t - 2], 61) ^
+			     (w[t - 2] >> 6);
+		}
+		else
+		{
+			s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^
+			     (w[t - 15] >> 3);
+			s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^
+			     (w[t - 2] >> 10);
+		}
+		w[t] = s1 + w[t - 7] + s0 + w[t - 16];
+	}
+
+	for (i = 0; i < 8; i++)
+		v[i] = H[i];
+	for (t = 0; t < rounds; t++)
+	{
+		W S0, S1, k;
+
+		if constexpr (wide)
+		{
+			S0 = rotr(v[0], 28) ^ rotr(v[0], 34) ^ rotr(v[0], 39);
+			S1 = rotr(v[4], 14) ^ rotr(v[4], 18) ^ rotr(v[4], 41);
+			k = K_64[t];
+		}
+		else
+		{
+			S0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+			S1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+			k = K_2[t];
+		}
+
+		T1 = v[7] + S1 + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k + w[t];
+		T2 = S0 + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		for (i = 7; i > 0; i--)
+			v[i] = v[i - 1];
+		v[4] += T1;
+		v[0] = T1 + T2;
+	}
+
+	for (i = 0; i < 8; i++)
+		H[i] += v[i];
+}
+
+// Pads and hashes a whole message, then writes the first N bytes of H.
+template <typename W, std::size_t N, bool sha1>
+constexpr digest<N>
+hash(const W *init, std::string_view msg)
+{
+	constexpr std::size_t blk = 16 * sizeof(W);
+	constexpr std::size_t len_bytes = 2 * sizeof(W);
+	std::uint8_t tail[2 * blk] = {};
+	std::size_t i, off, rest;
+	std::uint64_t bits;
+	digest<N> out = {};
+	W H[8] = {};
+
+	for (i = 0; i < 8; i++)
+		H[i] = init[i];
+
+	for (off = 0; msg.size() - off >= blk; off += blk)
+	{
+		std::uint8_t b[blk] = {};
+
+		for (i = 0; i < blk; i++)
+			b[i] = static_cast<std::uint8_t>(msg[off + i]);
+		if constexpr (sha1)
+			block_sha1(H, b);
+		else
+			block_sha2(H, b);
+	}
+
+	// The length only ever needs the low 64 bits here.
+	rest = msg.size() - off;
+	for (i = 0; i < rest; i++)
+		tail[i] = static_cast<std::uint8_t>(msg[off + i]);
+	tail[rest] = 0x80;
+	rest = (rest + 1 + len_bytes > blk) ? (2 * blk) : (blk);
+	bits = static_cast<std::uint64_t>(msg.size()) * 8;
+	for (i = 0; i < 8; i++)
+		tail[rest - 1 - i] = static_cast<std::uint8_t>(bits >> (8 * i));
+
+	for (off = 0; off < rest; off += blk)
+	{
+		if constexpr (sha1)
+			block_sha1(H, &tail[off]);
+		else
+			block_sha2(H, &tail[off]);
+	}
+
+	for (i = 0; i < N; i++)
+	{
+		out[i] = static_cast<std::uint8_t>(
+		    H[i / sizeof(W)] >> (8 * (sizeof(W) - 1 - i % sizeof(W))));
+	}
+
+	return (out);
+}
+
+template <std::size_t N>
+inline digest<N>
+runtime(enum sha_type type, std::string_view msg)
+{
+	std::uint8_t hash[SHA_HASH];
+	digest<N> out = {};
+
+	if (sha_buf(type, msg.data(), msg.size(), hash))
+	{
+		for (std::size_t i = 0; i < N; i++)
+			out[i] = hash[i];
+	}
+
+	return (out);
+}
+
+} // namespace detail
+
+#define SHAPP_DEFINE(name, type, W, N, init, sha1)			\
+	constexpr digest<N>						\
+	name(std::string_view msg)					\
+	{								\
+		if (std::is_constant_evaluated())			\
+			return (detail::hash<W, N, sha1>(init, msg));	\
+		return (detail::runtime<N>(type, msg));			\
+	}
+
+SHAPP_DEFINE(sha1, SHA1, std::uint32_t, 20, detail::H_1, true)
+SHAPP_DEFINE(sha224, SHA224, std::uint32_t, 28, detail::H_224, false)
+SHAPP_DEFINE(sha256, SHA256, std::uint32_t, 32, detail::H_256, false)
+SHAPP_DEFINE(sha384, SHA384, std::uint64_t, 48, detail::H_384, false)
+SHAPP_DEFINE(sha512, SHA512, std::uint64_t, 64, detail::H_512, false)
+SHAPP_DEFINE(sha512_224, SHA512_224, std::uint64_t, 28, detail::H_512_224,
+	     false)
+SHAPP_DEFINE(sha512_256, SHA512_256, std::uint64_t, 32, detail::H_512_256,
+	     false)
+
+#undef SHAPP_DEFINE
+
+} // namespace shapp
+
+#endif
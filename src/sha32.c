@@ -25,67 +25,79 @@
  * SUCH DAMAGE.
  ******************************************************************************/
 
-#include <arpa/inet.h>
-
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "consts.h"
+#include "kernel.h"
 #include "sha.h"
+#include "stats.h"
 
+#define LEN_BYTES	sizeof(word64)
+#define SHORT_LEN	(SHA32_BLK - LEN_BYTES - 1)
 #define ROUNDS_SHA1	80
 #define ROUNDS_SHA2	64
 #define SCHED		16
+#define LEN_D		(SHA32_HASH * 8)
+#define ONE_D		0x80000000
 
 typedef word32 word;
 
+struct lane
+{
+	const byte	*data;
+	size_t		 num;
+	byte		 tail[2 * SHA32_BLK];
+	size_t		 tail_num;
+	word		 H[SHA32_HASH / sizeof(word)];
+	size_t		 index;
+	bool		 busy;
+};
+
+struct order
+{
+	size_t		blocks;
+	size_t		index;
+};
+
 /******************************************************************************
  * Constants and initial values.
  ******************************************************************************/
 static const word K_1[] = {
-	0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+	SHA_K_1
 };
 
 static const word K_2[] = {
-	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-
-	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-
-	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-
-	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-
-	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-
-	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-
-	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-
-	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	SHA_K_2
 };
 
 static const word H_1[] = {
-	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	SHA_H_1
 };
 
 static const word H_224[] = {
-	0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
-	0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+	SHA_H_224
 };
 
 static const word H_256[] = {
-	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	SHA_H_256
+};
+
+// The second pass of SHA-256d always hashes one 32-byte digest, so the
+// second half of its block is always the same padding and length.
+static const byte PAD_D[SHA32_BLK - SHA32_HASH] = {
+	[0] = 0x80,
+	[SHA32_BLK - SHA32_HASH - 2] = (LEN_D >> 8) & 0xFF,
+	[SHA32_BLK - SHA32_HASH - 1] = (LEN_D >> 0) & 0xFF
 };
 
 /******************************************************************************
@@ -118,6 +130,23 @@ SHR(byte n, word x)
 	return (x >> n);
 }
 
+static word
+load(const byte *b)
+{
+	return (((word) b[0] << 24) | ((word) b[1] << 16) |
+		((word) b[2] << 8) | ((word) b[3] << 0));
+}
+
+static void
+store(const word *H, byte *hash, size_t len)
+{
+	size_t i;
+
+	// Write the words out in big-endian order.
+	for (i = 0; i < len; i++)
+		hash[i] = 0xFF & (H[i / 4] >> (24 - 8 * (i % 4)));
+}
+
 static word
 Ch(word x, word y, word z)
 {
@@ -161,143 +190,270 @@ sigma1(word x)
 }
 
 /******************************************************************************
- * Hashing functions.
+ * Generic kernels.
  ******************************************************************************/
-static bool
-pad(struct sha32 *ctx)
+void
+sha1_generic(word *H, const byte *blocks, size_t num)
 {
-	word index, len_b;
-	word64 len_m;
-	bool extra;
-
-	// Sanity check.
-	assert(ctx != NULL);
-
-	// Determine if an extra block will be needed.
-	len_b = ctx->block_len;
-	extra = (SHA32_BLK < len_b + sizeof(len_m) + 1);
-
-	// Zero all remaining space.
-	memset(&ctx->block.bytes[len_b], 0, 2 * SHA32_BLK - len_b);
+	word a, b, c, d, e, T, W[ROUNDS_SHA1];
+	word (*f[])(word, word, word) = {
+		Ch, Parity, Maj, Parity
+	};
+	byte t;
 
-	// Add trailing '1'.
-	ctx->block.bytes[len_b] = 0x80;
+	for (; num > 0; num--, blocks += SHA32_BLK)
+	{
+		// Prepare the message schedule.
+		for (t = 0; t < ROUNDS_SHA1; t++)
+		{
+			if (t < SCHED)
+			{
+				W[t] = load(&blocks[t * sizeof(word)]);
+			}
+			else
+			{
+				W[t] = W[t - 3];
+				W[t] ^= W[t - 8];
+				W[t] ^= W[t - 14];
+				W[t] ^= W[t - 16];
+				W[t] = ROTL(1, W[t]);
+			}
+		}
 
-	// Add message length.
-	index = (!extra) ? (1) : (2);
-	len_m = (ctx->message_len + len_b) * 8;
-	ctx->block.bytes[index * SHA32_BLK - 8] = 0xFF & (len_m >> 56);
-	ctx->block.bytes[index * SHA32_BLK - 7] = 0xFF & (len_m >> 48);
-	ctx->block.bytes[index * SHA32_BLK - 6] = 0xFF & (len_m >> 40);
-	ctx->block.bytes[index * SHA32_BLK - 5] = 0xFF & (len_m >> 32);
-	ctx->block.bytes[index * SHA32_BLK - 4] = 0xFF & (len_m >> 24);
-	ctx->block.bytes[index * SHA32_BLK - 3] = 0xFF & (len_m >> 16);
-	ctx->block.bytes[index * SHA32_BLK - 2] = 0xFF & (len_m >> 8);
-	ctx->block.bytes[index * SHA32_BLK - 1] = 0xFF & (len_m >> 0);
+		// Initialize the working variables.
+		a = H[0];
+		b = H[1];
+		c = H[2];
+		d = H[3];
+		e = H[4];
 
-	// Add block.
-	if (!sha32_add(ctx, SHA32_BLK))
-		return (false);
+		// Run through each round.
+		for (t = 0; t < ROUNDS_SHA1; t++)
+		{
+			T = ROTL(5, a) + (*f[t / 20])(b, c, d) + e +
+			    K_1[t / 20] + W[t];
+			e = d;
+			d = c;
+			c = ROTL(30, b);
+			b = a;
+			a = T;
+		}
 
-	// Add extra block.
-	if (extra)
-	{
-		memcpy(&ctx->block.bytes[0], &ctx->block.bytes[SHA32_BLK],
-		       SHA32_BLK);
-		if (!sha32_add(ctx, SHA32_BLK))
-			return (false);
+		// Compute the intermediate hash value.
+		H[0] += a;
+		H[1] += b;
+		H[2] += c;
+		H[3] += d;
+		H[4] += e;
 	}
-
-	return (true);
 }
 
-static void
-hash1(struct sha32 *ctx)
+void
+sha256_generic(word *H, const byte *blocks, size_t num)
 {
-	word a, b, c, d, e, T, W[ROUNDS_SHA1];
-	word (*f[])(word, word, word) = {
-		Ch, Parity, Maj, Parity
-	};
+	word a, b, c, d, e, f, g, h, T1, T2, W[ROUNDS_SHA2];
 	byte t;
 
-	// Sanity check.
-	assert(ctx != NULL);
-
-	// Prepare the message schedule.
-	for (t = 0; t < ROUNDS_SHA1; t++)
+	for (; num > 0; num--, blocks += SHA32_BLK)
 	{
-		if (t < SCHED)
+		// Prepare the message schedule.
+		for (t = 0; t < ROUNDS_SHA2; t++)
 		{
-			W[t] = ntohl(ctx->block.words[t]);
+			if (t < SCHED)
+			{
+				W[t] = load(&blocks[t * sizeof(word)]);
+			}
+			else
+			{
+				W[t] = 0;
+				W[t] += sigma1(W[t - 2]);
+				W[t] += W[t - 7];
+				W[t] += sigma0(W[t - 15]);
+				W[t] += W[t - 16];
+			}
 		}
-		else
+
+		// Initialize the working variables.
+		a = H[0];
+		b = H[1];
+		c = H[2];
+		d = H[3];
+		e = H[4];
+		f = H[5];
+		g = H[6];
+		h = H[7];
+
+		// Run through each round.
+		for (t = 0; t < ROUNDS_SHA2; t++)
 		{
-			W[t] = W[t - 3];
-			W[t] ^= W[t - 8];
-			W[t] ^= W[t - 14];
-			W[t] ^= W[t - 16];
-			W[t] = ROTL(1, W[t]);
+			T1 = h + Sigma1(e) + Ch(e, f, g) + K_2[t] + W[t];
+			T2 = Sigma0(a) + Maj(a, b, c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + T1;
+			d = c;
+			c = b;
+			b = a;
+			a = T1 + T2;
 		}
+
+		// Compute the intermediate hash value.
+		H[0] += a;
+		H[1] += b;
+		H[2] += c;
+		H[3] += d;
+		H[4] += e;
+		H[5] += f;
+		H[6] += g;
+		H[7] += h;
 	}
+}
 
-	// Initialize the working variables.
-	a = ctx->H[0];
-	b = ctx->H[1];
-	c = ctx->H[2];
-	d = ctx->H[3];
-	e = ctx->H[4];
+void
+sha256_generic2(word *H[], const byte *blocks[], size_t num)
+{
+	word a0, b0, c0, d0, e0, f0, g0, h0, T1, T2, W0[ROUNDS_SHA2];
+	word a1, b1, c1, d1, e1, f1, g1, h1, U1, U2, W1[ROUNDS_SHA2];
+	size_t i, off;
+	byte t;
 
-	// Run through each round.
-	for (t = 0; t < ROUNDS_SHA1; t++)
+	// Two independent messages advance in the same loop, so each round
+	// of one can issue while the other waits on its dependency chain.
+	for (off = 0; num > 0; num--, off += SHA32_BLK)
 	{
-		T = ROTL(5, a) + (*f[t / 20])(b, c, d) + e + K_1[t / 20] + W[t];
-		e = d;
-		d = c;
-		c = ROTL(30, b);
-		b = a;
-		a = T;
-	}
+		// Prepare both message schedules.
+		for (t = 0; t < ROUNDS_SHA2; t++)
+		{
+			if (t < SCHED)
+			{
+				i = off + t * sizeof(word);
+				W0[t] = load(&blocks[0][i]);
+				W1[t] = load(&blocks[1][i]);
+			}
+			else
+			{
+				W0[t] = sigma1(W0[t - 2]) + W0[t - 7] +
+				    sigma0(W0[t - 15]) + W0[t - 16];
+				W1[t] = sigma1(W1[t - 2]) + W1[t - 7] +
+				    sigma0(W1[t - 15]) + W1[t - 16];
+			}
+		}
+
+		// Initialize the working variables.
+		a0 = H[0][0];
+		b0 = H[0][1];
+		c0 = H[0][2];
+		d0 = H[0][3];
+		e0 = H[0][4];
+		f0 = H[0][5];
+		g0 = H[0][6];
+		h0 = H[0][7];
+		a1 = H[1][0];
+		b1 = H[1][1];
+		c1 = H[1][2];
+		d1 = H[1][3];
+		e1 = H[1][4];
+		f1 = H[1][5];
+		g1 = H[1][6];
+		h1 = H[1][7];
+
+		// Run through each round, interleaved.
+		for (t = 0; t < ROUNDS_SHA2; t++)
+		{
+			T1 = h0 + Sigma1(e0) + Ch(e0, f0, g0) + K_2[t] + W0[t];
+			U1 = h1 + Sigma1(e1) + Ch(e1, f1, g1) + K_2[t] + W1[t];
+			T2 = Sigma0(a0) + Maj(a0, b0, c0);
+			U2 = Sigma0(a1) + Maj(a1, b1, c1);
+			h0 = g0;
+			h1 = g1;
+			g0 = f0;
+			g1 = f1;
+			f0 = e0;
+			f1 = e1;
+			e0 = d0 + T1;
+			e1 = d1 + U1;
+			d0 = c0;
+			d1 = c1;
+			c0 = b0;
+			c1 = b1;
+			b0 = a0;
+			b1 = a1;
+			a0 = T1 + T2;
+			a1 = U1 + U2;
+		}
 
-	// Compute the intermediate hash value.
-	ctx->H[0] += a;
-        ctx->H[1] += b;
-        ctx->H[2] += c;
-        ctx->H[3] += d;
-        ctx->H[4] += e;
+		// Compute the intermediate hash values.
+		H[0][0] += a0;
+		H[0][1] += b0;
+		H[0][2] += c0;
+		H[0][3] += d0;
+		H[0][4] += e0;
+		H[0][5] += f0;
+		H[0][6] += g0;
+		H[0][7] += h0;
+		H[1][0] += a1;
+		H[1][1] += b1;
+		H[1][2] += c1;
+		H[1][3] += d1;
+		H[1][4] += e1;
+		H[1][5] += f1;
+		H[1][6] += g1;
+		H[1][7] += h1;
+	}
 }
 
 static void
-hash2(struct sha32 *ctx)
+sha256d_generic(word *H)
 {
 	word a, b, c, d, e, f, g, h, T1, T2, W[ROUNDS_SHA2];
 	byte t;
 
-	// Prepare the message schedule.
-	for (t = 0; t < ROUNDS_SHA2; t++)
+	// The first digest fills the first half of the block, and the
+	// constant padding the rest.
+	for (t = 0; t < SCHED / 2; t++)
+		W[t] = H[t];
+	W[8] = ONE_D;
+	for (t = 9; t < SCHED - 1; t++)
+		W[t] = 0;
+	W[15] = LEN_D;
+
+	// Words 8 to 15 are constant, so their terms in the schedule either
+	// vanish or fold into constants until word 32.
+	W[16] = sigma0(W[1]) + W[0];
+	W[17] = sigma1(LEN_D) + sigma0(W[2]) + W[1];
+	W[18] = sigma1(W[16]) + sigma0(W[3]) + W[2];
+	W[19] = sigma1(W[17]) + sigma0(W[4]) + W[3];
+	W[20] = sigma1(W[18]) + sigma0(W[5]) + W[4];
+	W[21] = sigma1(W[19]) + sigma0(W[6]) + W[5];
+	W[22] = sigma1(W[20]) + LEN_D + sigma0(W[7]) + W[6];
+	W[23] = sigma1(W[21]) + W[16] + sigma0(ONE_D) + W[7];
+	W[24] = sigma1(W[22]) + W[17] + ONE_D;
+	W[25] = sigma1(W[23]) + W[18];
+	W[26] = sigma1(W[24]) + W[19];
+	W[27] = sigma1(W[25]) + W[20];
+	W[28] = sigma1(W[26]) + W[21];
+	W[29] = sigma1(W[27]) + W[22];
+	W[30] = sigma1(W[28]) + W[23] + sigma0(LEN_D);
+	W[31] = sigma1(W[29]) + W[24] + sigma0(W[16]) + LEN_D;
+	for (t = 32; t < ROUNDS_SHA2; t++)
 	{
-		if (t < SCHED)
-		{
-			W[t] = ntohl(ctx->block.words[t]);
-		}
-		else
-		{
-			W[t] = 0;
-			W[t] += sigma1(W[t - 2]);
-			W[t] += W[t - 7];
-			W[t] += sigma0(W[t - 15]);
-			W[t] += W[t - 16];
-		}
+		W[t] = 0;
+		W[t] += sigma1(W[t - 2]);
+		W[t] += W[t - 7];
+		W[t] += sigma0(W[t - 15]);
+		W[t] += W[t - 16];
 	}
 
 	// Initialize the working variables.
-	a = ctx->H[0];
-	b = ctx->H[1];
-	c = ctx->H[2];
-	d = ctx->H[3];
-	e = ctx->H[4];
-	f = ctx->H[5];
-	g = ctx->H[6];
-	h = ctx->H[7];
+	a = H_256[0];
+	b = H_256[1];
+	c = H_256[2];
+	d = H_256[3];
+	e = H_256[4];
+	f = H_256[5];
+	g = H_256[6];
+	h = H_256[7];
 
 	// Run through each round.
 	for (t = 0; t < ROUNDS_SHA2; t++)
@@ -314,88 +470,490 @@ hash2(struct sha32 *ctx)
 		a = T1 + T2;
 	}
 
-	// Compute the intermediate hash value.
-	ctx->H[0] += a;
-        ctx->H[1] += b;
-        ctx->H[2] += c;
-        ctx->H[3] += d;
-        ctx->H[4] += e;
-        ctx->H[5] += f;
-        ctx->H[6] += g;
-        ctx->H[7] += h;
+	// Compute the final hash value.
+	H[0] = H_256[0] + a;
+	H[1] = H_256[1] + b;
+	H[2] = H_256[2] + c;
+	H[3] = H_256[3] + d;
+	H[4] = H_256[4] + e;
+	H[5] = H_256[5] + f;
+	H[6] = H_256[6] + g;
+	H[7] = H_256[7] + h;
 }
 
-static char *
-sha32(int fd, enum sha_type type)
+/******************************************************************************
+ * x86 SHA extension kernels.
+ ******************************************************************************/
+#ifdef KERNEL_X86
+__attribute__((target("sha,sse4.1,ssse3")))
+void
+sha1_shani(word *H, const byte *blocks, size_t num)
 {
-	word bytes_left, bytes_read;
-	struct sha32 ctx;
-	char *hash;
+	__m128i ABCD, ABCD_SAVE, E, E0, E0_SAVE, E_PREV, MASK, M[4];
+	int g;
 
-	if (type != SHA1 && type != SHA224 && type != SHA256)
-		return (NULL);
+	// Load the state, with A in the most significant lane.
+	MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	ABCD = _mm_loadu_si128((const __m128i *) H);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	E0 = _mm_set_epi32(H[4], 0, 0, 0);
 
-	// Initialize context.
-	ctx.type = type;
-	if (!sha32_init(&ctx))
-		return (NULL);
-
-	// Run each through each block.
-	while (true)
+	for (; num > 0; num--, blocks += SHA32_BLK)
 	{
-		// Initial read to fill block.
-		bytes_left = SHA32_BLK;
-		bytes_read = read(fd, ctx.block.bytes, bytes_left);
-
-		// End of file.
-		if (bytes_read == 0)
-			break;
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+		E_PREV = E0;
 
-		// Read error.
-		if (bytes_read < 0)
+		// Each group of four rounds consumes four schedule words.
+#pragma GCC unroll 20
+		for (g = 0; g < ROUNDS_SHA1 / 4; g++)
 		{
-			warn("read");
-			return (NULL);
+			if (g < SCHED / 4)
+			{
+				M[g] = _mm_loadu_si128((const __m128i *)
+						       &blocks[16 * g]);
+				M[g] = _mm_shuffle_epi8(M[g], MASK);
+			}
+			else
+			{
+				M[g & 3] = _mm_sha1msg1_epu32(M[g & 3],
+							      M[(g + 1) & 3]);
+				M[g & 3] = _mm_xor_si128(M[g & 3],
+							 M[(g + 2) & 3]);
+				M[g & 3] = _mm_sha1msg2_epu32(M[g & 3],
+							      M[(g + 3) & 3]);
+			}
+
+			if (g == 0)
+				E = _mm_add_epi32(E_PREV, M[0]);
+			else
+				E = _mm_sha1nexte_epu32(E_PREV, M[g & 3]);
+
+			E_PREV = ABCD;
+			switch (g / 5)
+			{
+			case 0:
+				ABCD = _mm_sha1rnds4_epu32(ABCD, E, 0);
+				break;
+
+			case 1:
+				ABCD = _mm_sha1rnds4_epu32(ABCD, E, 1);
+				break;
+
+			case 2:
+				ABCD = _mm_sha1rnds4_epu32(ABCD, E, 2);
+				break;
+
+			default:
+				ABCD = _mm_sha1rnds4_epu32(ABCD, E, 3);
+				break;
+			}
 		}
 
-		// Keep trying to fill block if not yet full.
-		bytes_left -= bytes_read;
-		while (bytes_left > 0)
+		// Compute the intermediate hash value.
+		E0 = _mm_sha1nexte_epu32(E_PREV, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	// Store the state.
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	_mm_storeu_si128((__m128i *) H, ABCD);
+	H[4] = _mm_extract_epi32(E0, 3);
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void
+sha256_shani(word *H, const byte *blocks, size_t num)
+{
+	__m128i ABEF_SAVE, CDGH_SAVE, MASK, MSG, STATE0, STATE1, TMP, M[4];
+	int g;
+
+	// Rearrange the state into the ABEF/CDGH lanes the instructions use.
+	MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	TMP = _mm_loadu_si128((const __m128i *) &H[0]);
+	STATE1 = _mm_loadu_si128((const __m128i *) &H[4]);
+	TMP = _mm_shuffle_epi32(TMP, 0xB1);
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+	for (; num > 0; num--, blocks += SHA32_BLK)
+	{
+		ABEF_SAVE = STATE0;
+		CDGH_SAVE = STATE1;
+
+		// Each group of four rounds consumes four schedule words.
+#pragma GCC unroll 16
+		for (g = 0; g < ROUNDS_SHA2 / 4; g++)
 		{
-			bytes_read = read(fd, ctx.block.bytes, bytes_left);
+			if (g < SCHED / 4)
+			{
+				M[g] = _mm_loadu_si128((const __m128i *)
+						       &blocks[16 * g]);
+				M[g] = _mm_shuffle_epi8(M[g], MASK);
+			}
+			else
+			{
+				TMP = _mm_sha256msg1_epu32(M[g & 3],
+							   M[(g + 1) & 3]);
+				TMP = _mm_add_epi32(TMP,
+				    _mm_alignr_epi8(M[(g + 3) & 3],
+						    M[(g + 2) & 3], 4));
+				M[g & 3] = _mm_sha256msg2_epu32(TMP,
+								M[(g + 3) & 3]);
+			}
 
-			// End of file.
-			if (bytes_read == 0)
-				break;
+			MSG = _mm_add_epi32(M[g & 3],
+			    _mm_loadu_si128((const __m128i *) &K_2[4 * g]));
+			STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+			MSG = _mm_shuffle_epi32(MSG, 0x0E);
+			STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+		}
+
+		// Compute the intermediate hash value.
+		STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+		STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+	}
+
+	// Put the state back in order.
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+	_mm_storeu_si128((__m128i *) &H[0], STATE0);
+	_mm_storeu_si128((__m128i *) &H[4], STATE1);
+}
+
+/******************************************************************************
+ * x86 AVX2 multi-lane kernels.
+ ******************************************************************************/
+#define AVX2_LANES	8
+#define ROTR_8(n, x)	_mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+					_mm256_slli_epi32((x), 32 - (n)))
+
+__attribute__((target("avx2")))
+static inline __m256i
+load_8(const byte *blocks[], size_t off)
+{
+	return (_mm256_set_epi32(
+	    load(&blocks[7][off]), load(&blocks[6][off]),
+	    load(&blocks[5][off]), load(&blocks[4][off]),
+	    load(&blocks[3][off]), load(&blocks[2][off]),
+	    load(&blocks[1][off]), load(&blocks[0][off])));
+}
 
-			// Read error.
-			if (bytes_read < 0)
+__attribute__((target("avx2")))
+void
+sha256_avx2(word *H[], const byte *blocks[], size_t num)
+{
+	__m256i a, b, c, d, e, f, g, h, S[8], T1, T2, W[ROUNDS_SHA2];
+	word lanes[AVX2_LANES];
+	size_t off;
+	int i, t;
+
+	// Transpose the chaining values so each vector holds one word.
+	for (i = 0; i < 8; i++)
+	{
+		S[i] = _mm256_set_epi32(H[7][i], H[6][i], H[5][i], H[4][i],
+					H[3][i], H[2][i], H[1][i], H[0][i]);
+	}
+
+	for (off = 0; num > 0; num--, off += SHA32_BLK)
+	{
+		// Prepare the message schedule.
+		for (t = 0; t < ROUNDS_SHA2; t++)
+		{
+			if (t < SCHED)
 			{
-				warn("read");
-				return (NULL);
+				W[t] = load_8(blocks,
+					      off + t * sizeof(word));
+				continue;
 			}
 
-			bytes_left -= bytes_read;
+			T1 = _mm256_xor_si256(ROTR_8(17, W[t - 2]),
+					      ROTR_8(19, W[t - 2]));
+			T1 = _mm256_xor_si256(T1, _mm256_srli_epi32(W[t - 2],
+								    10));
+			T2 = _mm256_xor_si256(ROTR_8(7, W[t - 15]),
+					      ROTR_8(18, W[t - 15]));
+			T2 = _mm256_xor_si256(T2, _mm256_srli_epi32(W[t - 15],
+								    3));
+			T1 = _mm256_add_epi32(T1, W[t - 7]);
+			T2 = _mm256_add_epi32(T2, W[t - 16]);
+			W[t] = _mm256_add_epi32(T1, T2);
 		}
 
-		// Run block through.
-		bytes_read = SHA32_BLK - bytes_left;
-		if (!sha32_add(&ctx, bytes_read))
-			return (NULL);
+		// Initialize the working variables.
+		a = S[0];
+		b = S[1];
+		c = S[2];
+		d = S[3];
+		e = S[4];
+		f = S[5];
+		g = S[6];
+		h = S[7];
+
+		// Run through each round.
+		for (t = 0; t < ROUNDS_SHA2; t++)
+		{
+			T1 = _mm256_xor_si256(ROTR_8(6, e), ROTR_8(11, e));
+			T1 = _mm256_xor_si256(T1, ROTR_8(25, e));
+			T1 = _mm256_add_epi32(T1, h);
+			T1 = _mm256_add_epi32(T1, _mm256_xor_si256(
+			    _mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+			T1 = _mm256_add_epi32(T1, _mm256_add_epi32(W[t],
+			    _mm256_set1_epi32(K_2[t])));
+
+			T2 = _mm256_xor_si256(ROTR_8(2, a), ROTR_8(13, a));
+			T2 = _mm256_xor_si256(T2, ROTR_8(22, a));
+			T2 = _mm256_add_epi32(T2, _mm256_or_si256(
+			    _mm256_and_si256(a, b),
+			    _mm256_and_si256(c, _mm256_or_si256(a, b))));
+
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32(d, T1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32(T1, T2);
+		}
+
+		// Compute the intermediate hash value.
+		S[0] = _mm256_add_epi32(S[0], a);
+		S[1] = _mm256_add_epi32(S[1], b);
+		S[2] = _mm256_add_epi32(S[2], c);
+		S[3] = _mm256_add_epi32(S[3], d);
+		S[4] = _mm256_add_epi32(S[4], e);
+		S[5] = _mm256_add_epi32(S[5], f);
+		S[6] = _mm256_add_epi32(S[6], g);
+		S[7] = _mm256_add_epi32(S[7], h);
+	}
+
+	// Transpose the chaining values back.
+	for (i = 0; i < 8; i++)
+	{
+		_mm256_storeu_si256((__m256i *) lanes, S[i]);
+		for (t = 0; t < AVX2_LANES; t++)
+			H[t][i] = lanes[t];
+	}
+}
+#endif
+
+/******************************************************************************
+ * Hashing functions.
+ ******************************************************************************/
+static void
+compress(const struct sha_kernel *kernel, word *H, const byte *blocks,
+	 size_t num)
+{
+	word64 start;
+
+	start = (stats_enabled) ? (stats_start()) : (0);
+	(*kernel->fcn32)(H, blocks, num);
+	if (start != 0)
+		stats_hash(start, num);
+}
+
+static void
+compress_many(const struct sha_kernel *kernel, word *H[],
+	      const byte *blocks[], size_t num)
+{
+	word64 start;
+
+	// Idle lanes are counted, since the kernel runs them all the same.
+	start = (stats_enabled) ? (stats_start()) : (0);
+	if (kernel->many32 != NULL)
+		(*kernel->many32)(H, blocks, num);
+	else
+		(*kernel->fcn32)(H[0], blocks[0], num);
+	if (start != 0)
+		stats_hash(start, num * kernel->lanes);
+}
+
+static bool
+pad(struct sha32 *ctx)
+{
+	word len_b;
+	word64 len_m;
+	bool extra;
+
+	// Sanity check.
+	assert(ctx != NULL);
+
+	// Determine if an extra block will be needed.
+	len_b = ctx->block_len;
+	extra = (SHA32_BLK < len_b + sizeof(len_m) + 1);
+
+	// Count the message length before the extra block moves it.
+	len_m = (ctx->message_len + len_b) * 8;
+
+	// Add trailing '1' and zero the rest of the block.
+	ctx->block.bytes[len_b] = 0x80;
+	memset(&ctx->block.bytes[len_b + 1], 0, SHA32_BLK - len_b - 1);
+
+	// Run the block when the length doesn't fit, and pad a fresh one.
+	if (extra)
+	{
+		if (!sha32_add(ctx, SHA32_BLK))
+			return (false);
+		memset(ctx->block.bytes, 0, SHA32_BLK);
+	}
+
+	// Add message length.
+	ctx->block.bytes[SHA32_BLK - 8] = 0xFF & (len_m >> 56);
+	ctx->block.bytes[SHA32_BLK - 7] = 0xFF & (len_m >> 48);
+	ctx->block.bytes[SHA32_BLK - 6] = 0xFF & (len_m >> 40);
+	ctx->block.bytes[SHA32_BLK - 5] = 0xFF & (len_m >> 32);
+	ctx->block.bytes[SHA32_BLK - 4] = 0xFF & (len_m >> 24);
+	ctx->block.bytes[SHA32_BLK - 3] = 0xFF & (len_m >> 16);
+	ctx->block.bytes[SHA32_BLK - 2] = 0xFF & (len_m >> 8);
+	ctx->block.bytes[SHA32_BLK - 1] = 0xFF & (len_m >> 0);
+
+	// Add block.
+	return (sha32_add(ctx, SHA32_BLK));
+}
+
+static const word *
+initial(enum sha_type type, int *num)
+{
+	switch (type)
+	{
+	case SHA1:
+		*num = sizeof(H_1) / sizeof(word);
+		return (H_1);
+
+	case SHA224:
+		*num = sizeof(H_224) / sizeof(word);
+		return (H_224);
+
+	case SHA256:
+		*num = sizeof(H_256) / sizeof(word);
+		return (H_256);
+
+	default:
+		return (NULL);
 	}
+}
+
+static char *
+sha32(int fd, enum sha_type type)
+{
+	byte bin[SHA32_HASH];
+	char *hash;
+
+	if (type != SHA1 && type != SHA224 && type != SHA256)
+		return (NULL);
 
-	// Calculate the hash.
-	if (!sha32_calc(&ctx))
+	// The generic reader also waits on non-blocking descriptors.
+	if (!sha_fd(type, fd, bin))
 		return (NULL);
 
-	// Copy hash for caller.
-	hash = strdup(ctx.hash);
+	// Translate it to hex digits for the caller.
+	hash = malloc(2 * sha_hash_len(type) + 1);
 	if (hash == NULL)
-		warn("strdup");
+	{
+		warn("malloc");
+		return (NULL);
+	}
+	sha_hex(bin, sha_hash_len(type), hash);
 
 	return (hash);
 }
 
+static int
+compare(const void *a, const void *b)
+{
+	const struct order *x, *y;
+
+	x = a;
+	y = b;
+	if (x->blocks == y->blocks)
+		return (0);
+
+	return ((x->blocks > y->blocks) ? (-1) : (1));
+}
+
+static size_t
+tail(byte *blocks, const byte *data, size_t len)
+{
+	word64 len_m;
+	size_t num, rem;
+	int i;
+
+	// Determine if an extra block will be needed.
+	rem = len % SHA32_BLK;
+	num = (rem + LEN_BYTES + 1 <= SHA32_BLK) ? (1) : (2);
+
+	// Copy the trailing partial block and zero the rest.
+	memset(blocks, 0, num * SHA32_BLK);
+	if (rem > 0)
+		memcpy(blocks, &data[len - rem], rem);
+
+	// Add trailing '1' and the message length.
+	blocks[rem] = 0x80;
+	len_m = (word64) len * 8;
+	for (i = 1; i <= LEN_BYTES; i++, len_m >>= 8)
+		blocks[num * SHA32_BLK - i] = 0xFF & len_m;
+
+	return (num);
+}
+
+static bool
+single(enum sha_type type, const void *data, size_t len, byte *hash)
+{
+	const struct sha_kernel *kernel;
+	word H[SHA32_HASH / sizeof(word)];
+	byte block[SHA32_BLK];
+	const word *init;
+	int i, num;
+
+	// Build the one padded block on the stack.
+	init = initial(type, &num);
+	kernel = sha_kernel(type);
+	if (init == NULL || kernel == NULL)
+		return (false);
+	for (i = 0; i < num; i++)
+		H[i] = init[i];
+	tail(block, data, len);
+
+	compress(kernel, H, block, 1);
+	store(H, hash, sha_hash_len(type));
+
+	return (true);
+}
+
+static void
+second(const struct sha_kernel *kernel, const byte *digest, byte *hash)
+{
+	word H[SHA32_HASH / sizeof(word)];
+	byte block[SHA32_BLK];
+	word64 start;
+	int i;
+
+	// The generic kernel has a specialization with the padding folded
+	// into its schedule; others take the digest with the padding block.
+	if (kernel->fcn32 == sha256_generic)
+	{
+		for (i = 0; i < SHA32_HASH / sizeof(word); i++)
+			H[i] = load(&digest[i * sizeof(word)]);
+		start = (stats_enabled) ? (stats_start()) : (0);
+		sha256d_generic(H);
+		if (start != 0)
+			stats_hash(start, 1);
+	}
+	else
+	{
+		memcpy(block, digest, SHA32_HASH);
+		memcpy(&block[SHA32_HASH], PAD_D, sizeof(PAD_D));
+		memcpy(H, H_256, sizeof(H));
+		compress(kernel, H, block, 1);
+	}
+
+	store(H, hash, SHA32_HASH);
+}
+
 /******************************************************************************
  * Public functions.
  ******************************************************************************/
@@ -417,6 +975,100 @@ sha256(int fd)
 	return (sha32(fd, SHA256));
 }
 
+bool
+sha1_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha32_many(SHA1, msgs, num, hashes));
+}
+
+bool
+sha224_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha32_many(SHA224, msgs, num, hashes));
+}
+
+bool
+sha256_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha32_many(SHA256, msgs, num, hashes));
+}
+
+bool
+sha256d(const void *data, size_t len, byte *hash)
+{
+	const struct sha_kernel *kernel;
+	byte digest[SHA32_HASH];
+
+	if (hash == NULL)
+		return (false);
+
+	kernel = sha_kernel(SHA256);
+	if (kernel == NULL || !sha32_buf(SHA256, data, len, digest))
+		return (false);
+
+	second(kernel, digest, hash);
+
+	return (true);
+}
+
+bool
+sha256d_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	word *H[SHA_LANES], lanes[SHA_LANES][SHA32_HASH / sizeof(word)];
+	byte padded[SHA_LANES][SHA32_BLK];
+	const struct sha_kernel *kernel;
+	const byte *blocks[SHA_LANES];
+	size_t i, j, k, n;
+	int width;
+
+	// The first pass is an ordinary batch, leaving binary digests in
+	// place for the second.
+	if (!sha32_many(SHA256, msgs, num, hashes))
+		return (false);
+
+	kernel = sha_kernel_many(SHA256);
+	if (kernel == NULL)
+		return (false);
+	width = kernel->lanes;
+
+	if (width == 1)
+	{
+		for (i = 0; i < num; i++)
+		{
+			second(kernel, &hashes[i * SHA32_HASH],
+			       &hashes[i * SHA32_HASH]);
+		}
+
+		return (true);
+	}
+
+	// Every second pass is one block, so lanes are simply filled in
+	// order; idle lanes repeat the first message.
+	for (i = 0; i < num; i += n)
+	{
+		n = (num - i < width) ? (num - i) : (width);
+		for (j = 0; j < width; j++)
+		{
+			k = i + ((j < n) ? (j) : (0));
+			memcpy(padded[j], &hashes[k * SHA32_HASH], SHA32_HASH);
+			memcpy(&padded[j][SHA32_HASH], PAD_D, sizeof(PAD_D));
+			memcpy(lanes[j], H_256, sizeof(lanes[j]));
+			H[j] = lanes[j];
+			blocks[j] = padded[j];
+		}
+
+		compress_many(kernel, H, blocks, 1);
+
+		for (j = 0; j < n; j++)
+		{
+			store(lanes[j], &hashes[(i + j) * SHA32_HASH],
+			      SHA32_HASH);
+		}
+	}
+
+	return (true);
+}
+
 bool
 sha32_init(struct sha32 *ctx)
 {
@@ -427,33 +1079,15 @@ sha32_init(struct sha32 *ctx)
 		return (false);
 
 	// Set the initial hash value.
-	switch (ctx->type)
-	{
-	case SHA1:
-		H = H_1;
-		num = sizeof(H_1) / sizeof(word);
-		break;
-
-	case SHA224:
-		H = H_224;
-		num = sizeof(H_224) / sizeof(word);
-		break;
-
-	case SHA256:
-		H = H_256;
-		num = sizeof(H_256) / sizeof(word);
-		break;
-
-	default:
+	H = initial(ctx->type, &num);
+	if (H == NULL)
 		return (false);
-	}
 
 	for (i = 0; i < num; i++)
 		ctx->H[i] = H[i];
 
 	ctx->block_len = 0;
 	ctx->message_len = 0;
-	ctx->hash[0] = '\0';
 
 	return (true);
 }
@@ -461,6 +1095,8 @@ sha32_init(struct sha32 *ctx)
 bool
 sha32_add(struct sha32 *ctx, int len)
 {
+	const struct sha_kernel *kernel;
+
 	if (ctx == NULL || len > SHA32_BLK)
 		return (false);
 
@@ -469,21 +1105,11 @@ sha32_add(struct sha32 *ctx, int len)
 	if (ctx->block_len < SHA32_BLK)
 		return (true);
 
-	// Set the initial hash value.
-	switch (ctx->type)
-	{
-	case SHA1:
-		hash1(ctx);
-		break;
-
-	case SHA224:
-	case SHA256:
-		hash2(ctx);
-		break;
-
-	default:
+	// Run the block through the selected kernel.
+	kernel = sha_kernel(ctx->type);
+	if (kernel == NULL)
 		return (false);
-	}
+	compress(kernel, ctx->H, ctx->block.bytes, 1);
 
 	// Record the processing of this block.
 	ctx->message_len += ctx->block_len;
@@ -493,56 +1119,264 @@ sha32_add(struct sha32 *ctx, int len)
 }
 
 bool
-sha32_calc(struct sha32 *ctx)
+sha32_update(struct sha32 *ctx, const void *data, size_t len)
 {
-	if (ctx == NULL)
+	const struct sha_kernel *kernel;
+	const byte *in;
+	size_t num;
+
+	if (ctx == NULL || (data == NULL && len > 0))
+		return (false);
+
+	// Top up the partial block, running it through once it is full.
+	in = data;
+	if (ctx->block_len > 0)
+	{
+		num = SHA32_BLK - ctx->block_len;
+		if (num > len)
+			num = len;
+		memcpy(&ctx->block.bytes[ctx->block_len], in, num);
+		in += num;
+		len -= num;
+
+		if (!sha32_add(ctx, ctx->block_len + num))
+			return (false);
+	}
+
+	// Run whole blocks straight from the caller's buffer.
+	num = len / SHA32_BLK;
+	if (num > 0)
+	{
+		kernel = sha_kernel(ctx->type);
+		if (kernel == NULL)
+			return (false);
+		compress(kernel, ctx->H, in, num);
+
+		ctx->message_len += num * SHA32_BLK;
+		in += num * SHA32_BLK;
+		len -= num * SHA32_BLK;
+	}
+
+	// Keep the remainder for later.
+	if (len > 0)
+	{
+		memcpy(ctx->block.bytes, in, len);
+		ctx->block_len = len;
+	}
+
+	return (true);
+}
+
+bool
+sha32_final(struct sha32 *ctx, byte *hash)
+{
+	if (ctx == NULL || hash == NULL)
 		return (false);
 
 	// Perform padding.
 	if (!pad(ctx))
 		return (false);
 
-	// Translate the words to hex digits.
-	switch (ctx->type)
-	{
-	case SHA1:
-		snprintf(ctx->hash, sizeof(ctx->hash),
-			 "%08x%08x%08x%08x%08x",
-			 ctx->H[0],
-			 ctx->H[1],
-			 ctx->H[2],
-			 ctx->H[3],
-			 ctx->H[4]);
-		break;
+	store(ctx->H, hash, sha_hash_len(ctx->type));
 
-	case SHA224:
-		snprintf(ctx->hash, sizeof(ctx->hash),
-			 "%08x%08x%08x%08x%08x%08x%08x",
-			 ctx->H[0],
-			 ctx->H[1],
-			 ctx->H[2],
-			 ctx->H[3],
-			 ctx->H[4],
-			 ctx->H[5],
-			 ctx->H[6]);
-		break;
+	return (true);
+}
 
-	case SHA256:
-		snprintf(ctx->hash, sizeof(ctx->hash),
-			 "%08x%08x%08x%08x%08x%08x%08x%08x",
-			 ctx->H[0],
-			 ctx->H[1],
-			 ctx->H[2],
-			 ctx->H[3],
-			 ctx->H[4],
-			 ctx->H[5],
-			 ctx->H[6],
-			 ctx->H[7]);
-		break;
+bool
+sha32_copy(struct sha32 *dst, const struct sha32 *src)
+{
+	if (dst == NULL || src == NULL)
+		return (false);
 
-	default:
+	// Only the buffered part of the block is live.
+	dst->type = src->type;
+	memcpy(dst->H, src->H, sizeof(dst->H));
+	memcpy(dst->block.bytes, src->block.bytes, src->block_len);
+	dst->block_len = src->block_len;
+	dst->message_len = src->message_len;
+
+	return (true);
+}
+
+bool
+sha32_prefixed(const struct sha32 *prefix, const void *data, size_t len,
+	       byte *hash)
+{
+	struct sha32 ctx;
+
+	// Resume from the prefix's midstate, leaving the prefix untouched.
+	if (!sha32_copy(&ctx, prefix))
+		return (false);
+
+	if (!sha32_update(&ctx, data, len))
+		return (false);
+
+	return (sha32_final(&ctx, hash));
+}
+
+bool
+sha32_buf(enum sha_type type, const void *data, size_t len, byte *hash)
+{
+	struct sha32 ctx;
+
+	if ((data == NULL && len > 0) || hash == NULL)
+		return (false);
+
+	// Messages that pad into one block skip the context entirely.
+	if (len <= SHORT_LEN)
+		return (single(type, data, len, hash));
+
+	ctx.type = type;
+	if (!sha32_init(&ctx))
+		return (false);
+
+	if (!sha32_update(&ctx, data, len))
+		return (false);
+
+	return (sha32_final(&ctx, hash));
+}
+
+bool
+sha32_many(enum sha_type type, const struct sha_msg *msgs, size_t num,
+	   byte *hashes)
+{
+	word *H[SHA_LANES], scratch[SHA32_HASH / sizeof(word)];
+	const struct sha_kernel *kernel;
+	const byte *blocks[SHA_LANES];
+	struct lane lanes[SHA_LANES];
+	size_t first, i, j, next, step;
+	const struct sha_msg *msg;
+	struct order *order;
+	struct sha32 ctx;
+	size_t hash_len;
+	int width;
+
+	if ((msgs == NULL || hashes == NULL) && num > 0)
+		return (false);
+
+	// Find the initial hash value and the kernel.
+	ctx.type = type;
+	if (!sha32_init(&ctx))
+		return (false);
+	kernel = sha_kernel_many(type);
+	if (kernel == NULL)
+		return (false);
+	width = kernel->lanes;
+	hash_len = sha_hash_len(type);
+
+	// A single lane gains nothing from scheduling, and a one-lane batch
+	// kernel is always the selected stream kernel too.
+	if (width == 1)
+	{
+		for (i = 0; i < num; i++)
+		{
+			if (!sha32_buf(type, msgs[i].data, msgs[i].len,
+				       &hashes[i * hash_len]))
+				return (false);
+		}
+
+		return (true);
+	}
+
+	// Longest first, so the lanes run dry together at the end.
+	order = malloc(num * sizeof(*order));
+	if (order == NULL && num > 0)
+	{
+		warn("malloc");
 		return (false);
 	}
+	for (i = 0; i < num; i++)
+	{
+		order[i].blocks = (msgs[i].len + LEN_BYTES) / SHA32_BLK + 1;
+		order[i].index = i;
+	}
+	qsort(order, num, sizeof(*order), compare);
+
+	for (j = 0; j < width; j++)
+		lanes[j].busy = false;
+	next = 0;
+	while (true)
+	{
+		// A drained lane writes out its digest in the caller's order
+		// and takes the next message, so lanes only idle once the
+		// queue is empty.
+		first = step = 0;
+		for (j = 0; j < width; j++)
+		{
+			if (lanes[j].busy && lanes[j].num == 0 &&
+			    lanes[j].tail_num == 0)
+			{
+				store(lanes[j].H,
+				      &hashes[lanes[j].index * hash_len],
+				      hash_len);
+				lanes[j].busy = false;
+			}
+
+			if (!lanes[j].busy && next < num)
+			{
+				msg = &msgs[order[next].index];
+				lanes[j].data = msg->data;
+				lanes[j].num = msg->len / SHA32_BLK;
+				lanes[j].tail_num = tail(lanes[j].tail,
+							 msg->data, msg->len);
+				memcpy(lanes[j].H, ctx.H, sizeof(ctx.H));
+				lanes[j].index = order[next].index;
+				lanes[j].busy = true;
+				next++;
+			}
+
+			if (!lanes[j].busy)
+				continue;
+
+			// Whole blocks come straight from the message, then
+			// the padded tail.
+			if (lanes[j].num == 0)
+			{
+				lanes[j].data = lanes[j].tail;
+				lanes[j].num = lanes[j].tail_num;
+				lanes[j].tail_num = 0;
+			}
+
+			// Find the shortest run of contiguous blocks.
+			if (step == 0 || lanes[j].num < step)
+			{
+				first = j;
+				step = lanes[j].num;
+			}
+		}
+
+		if (step == 0)
+			break;
+
+		// Idle lanes repeat a live lane's work into scratch.
+		for (j = 0; j < width; j++)
+		{
+			if (lanes[j].busy)
+			{
+				H[j] = lanes[j].H;
+				blocks[j] = lanes[j].data;
+			}
+			else
+			{
+				H[j] = scratch;
+				blocks[j] = lanes[first].data;
+			}
+		}
+
+		// Advance every lane by the run.
+		compress_many(kernel, H, blocks, step);
+
+		for (j = 0; j < width; j++)
+		{
+			if (!lanes[j].busy)
+				continue;
+
+			lanes[j].data += step * SHA32_BLK;
+			lanes[j].num -= step;
+		}
+	}
+
+	free(order);
 
 	return (true);
 }
@@ -25,79 +25,68 @@
  * SUCH DAMAGE.
  ******************************************************************************/
 
-#include <arpa/inet.h>
-
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "consts.h"
+#include "kernel.h"
 #include "sha.h"
+#include "stats.h"
 
+#define LEN_BYTES	(2 * sizeof(word64))
+#define SHORT_LEN	(SHA64_BLK - LEN_BYTES - 1)
 #define ROUNDS	80
 #define SCHED	16
 
 typedef word64 word;
 
+struct lane
+{
+	const byte	*data;
+	size_t		 num;
+	byte		 tail[2 * SHA64_BLK];
+	size_t		 tail_num;
+	word		 H[SHA64_HASH / sizeof(word)];
+	size_t		 index;
+	bool		 busy;
+};
+
+struct order
+{
+	size_t		blocks;
+	size_t		index;
+};
+
 /******************************************************************************
  * Constants and initial values.
  ******************************************************************************/
 static const word K[] = {
-	0x428a2f98d728ae22, 0x7137449123ef65cd,
-	0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc,
-	0x3956c25bf348b538, 0x59f111f1b605d019,
-	0x923f82a4af194f9b, 0xab1c5ed5da6d8118,
-	0xd807aa98a3030242, 0x12835b0145706fbe,
-	0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2,
-	0x72be5d74f27b896f, 0x80deb1fe3b1696b1,
-	0x9bdc06a725c71235, 0xc19bf174cf692694,
-	0xe49b69c19ef14ad2, 0xefbe4786384f25e3,
-	0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
-	0x2de92c6f592b0275, 0x4a7484aa6ea6e483,
-	0x5cb0a9dcbd41fbd4, 0x76f988da831153b5,
-	0x983e5152ee66dfab, 0xa831c66d2db43210,
-	0xb00327c898fb213f, 0xbf597fc7beef0ee4,
-	0xc6e00bf33da88fc2, 0xd5a79147930aa725,
-	0x06ca6351e003826f, 0x142929670a0e6e70,
-	0x27b70a8546d22ffc, 0x2e1b21385c26c926,
-	0x4d2c6dfc5ac42aed, 0x53380d139d95b3df,
-	0x650a73548baf63de, 0x766a0abb3c77b2a8,
-	0x81c2c92e47edaee6, 0x92722c851482353b,
-	0xa2bfe8a14cf10364, 0xa81a664bbc423001,
-	0xc24b8b70d0f89791, 0xc76c51a30654be30,
-	0xd192e819d6ef5218, 0xd69906245565a910,
-	0xf40e35855771202a, 0x106aa07032bbd1b8,
-	0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
-	0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8,
-	0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb,
-	0x5b9cca4f7763e373, 0x682e6ff3d6b2b8a3,
-	0x748f82ee5defb2fc, 0x78a5636f43172f60,
-	0x84c87814a1f0ab72, 0x8cc702081a6439ec,
-	0x90befffa23631e28, 0xa4506cebde82bde9,
-	0xbef9a3f7b2c67915, 0xc67178f2e372532b,
-	0xca273eceea26619c, 0xd186b8c721c0c207,
-	0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178,
-	0x06f067aa72176fba, 0x0a637dc5a2c898a6,
-	0x113f9804bef90dae, 0x1b710b35131c471b,
-	0x28db77f523047d84, 0x32caab7b40c72493,
-	0x3c9ebe0a15c9bebc, 0x431d67c49c100d4c,
-	0x4cc5d4becb3e42b6, 0x597f299cfc657e2a,
-	0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+	SHA_K_64
 };
 
 static const word H_384[] = {
-	0xcbbb9d5dc1059ed8, 0x629a292a367cd507,
-	0x9159015a3070dd17, 0x152fecd8f70e5939,
-	0x67332667ffc00b31, 0x8eb44a8768581511,
-	0xdb0c2e0d64f98fa7, 0x47b5481dbefa4fa4
+	SHA_H_384
 };
 
 static const word H_512[] = {
-	0x6a09e667f3bcc908, 0xbb67ae8584caa73b,
-	0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
-	0x510e527fade682d1, 0x9b05688c2b3e6c1f,
-	0x1f83d9abfb41bd6b, 0x5be0cd19137e2179
+	SHA_H_512
+};
+
+static const word H_512_224[] = {
+	SHA_H_512_224
+};
+
+static const word H_512_256[] = {
+	SHA_H_512_256
 };
 
 /******************************************************************************
@@ -180,33 +169,330 @@ shift128(word *a, word b)
 }
 
 static word
-be_to_le(word n)
+load(const byte *b)
+{
+	return (((word) b[0] << 56) | ((word) b[1] << 48) |
+		((word) b[2] << 40) | ((word) b[3] << 32) |
+		((word) b[4] << 24) | ((word) b[5] << 16) |
+		((word) b[6] <<  8) | ((word) b[7] <<  0));
+}
+
+static void
+store(const word *H, byte *hash, size_t len)
+{
+	size_t i;
+
+	// Write the words out in big-endian order, truncating the last.
+	for (i = 0; i < len; i++)
+		hash[i] = 0xFF & (H[i / 8] >> (56 - 8 * (i % 8)));
+}
+
+/******************************************************************************
+ * Generic kernels.
+ ******************************************************************************/
+void
+sha512_generic(word *H, const byte *blocks, size_t num)
+{
+	word a, b, c, d, e, f, g, h, T1, T2, W[ROUNDS];
+	byte t;
+
+	for (; num > 0; num--, blocks += SHA64_BLK)
+	{
+		// Prepare the message schedule.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			if (t < SCHED)
+			{
+				W[t] = load(&blocks[t * sizeof(word)]);
+			}
+			else
+			{
+				W[t] = 0;
+				W[t] += sigma1(W[t - 2]);
+				W[t] += W[t - 7];
+				W[t] += sigma0(W[t - 15]);
+				W[t] += W[t - 16];
+			}
+		}
+
+		// Initialize the working variables.
+		a = H[0];
+		b = H[1];
+		c = H[2];
+		d = H[3];
+		e = H[4];
+		f = H[5];
+		g = H[6];
+		h = H[7];
+
+		// Run through each round.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			T1 = h + Sigma1(e) + Ch(e, f, g) + K[t] + W[t];
+			T2 = Sigma0(a) + Maj(a, b, c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + T1;
+			d = c;
+			c = b;
+			b = a;
+			a = T1 + T2;
+		}
+
+		// Compute the intermediate hash value.
+		H[0] += a;
+		H[1] += b;
+		H[2] += c;
+		H[3] += d;
+		H[4] += e;
+		H[5] += f;
+		H[6] += g;
+		H[7] += h;
+	}
+}
+
+void
+sha512_generic2(word *H[], const byte *blocks[], size_t num)
 {
-	word result;
-	byte *b;
+	word a0, b0, c0, d0, e0, f0, g0, h0, T1, T2, W0[ROUNDS];
+	word a1, b1, c1, d1, e1, f1, g1, h1, U1, U2, W1[ROUNDS];
+	size_t i, off;
+	byte t;
 
-	result = 0;
+	// Two independent messages advance in the same loop, so each round
+	// of one can issue while the other waits on its dependency chain.
+	for (off = 0; num > 0; num--, off += SHA64_BLK)
+	{
+		// Prepare both message schedules.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			if (t < SCHED)
+			{
+				i = off + t * sizeof(word);
+				W0[t] = load(&blocks[0][i]);
+				W1[t] = load(&blocks[1][i]);
+			}
+			else
+			{
+				W0[t] = sigma1(W0[t - 2]) + W0[t - 7] +
+				    sigma0(W0[t - 15]) + W0[t - 16];
+				W1[t] = sigma1(W1[t - 2]) + W1[t - 7] +
+				    sigma0(W1[t - 15]) + W1[t - 16];
+			}
+		}
 
-	b = (byte *) &result;
-	b[0] = 0xFF & (n >> 56);
-	b[1] = 0xFF & (n >> 48);
-	b[2] = 0xFF & (n >> 40);
-	b[3] = 0xFF & (n >> 32);
-	b[4] = 0xFF & (n >> 24);
-	b[5] = 0xFF & (n >> 16);
-	b[6] = 0xFF & (n >>  8);
-	b[7] = 0xFF & (n >>  0);
+		// Initialize the working variables.
+		a0 = H[0][0];
+		b0 = H[0][1];
+		c0 = H[0][2];
+		d0 = H[0][3];
+		e0 = H[0][4];
+		f0 = H[0][5];
+		g0 = H[0][6];
+		h0 = H[0][7];
+		a1 = H[1][0];
+		b1 = H[1][1];
+		c1 = H[1][2];
+		d1 = H[1][3];
+		e1 = H[1][4];
+		f1 = H[1][5];
+		g1 = H[1][6];
+		h1 = H[1][7];
+
+		// Run through each round, interleaved.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			T1 = h0 + Sigma1(e0) + Ch(e0, f0, g0) + K[t] + W0[t];
+			U1 = h1 + Sigma1(e1) + Ch(e1, f1, g1) + K[t] + W1[t];
+			T2 = Sigma0(a0) + Maj(a0, b0, c0);
+			U2 = Sigma0(a1) + Maj(a1, b1, c1);
+			h0 = g0;
+			h1 = g1;
+			g0 = f0;
+			g1 = f1;
+			f0 = e0;
+			f1 = e1;
+			e0 = d0 + T1;
+			e1 = d1 + U1;
+			d0 = c0;
+			d1 = c1;
+			c0 = b0;
+			c1 = b1;
+			b0 = a0;
+			b1 = a1;
+			a0 = T1 + T2;
+			a1 = U1 + U2;
+		}
 
-	return (result);
+		// Compute the intermediate hash values.
+		H[0][0] += a0;
+		H[0][1] += b0;
+		H[0][2] += c0;
+		H[0][3] += d0;
+		H[0][4] += e0;
+		H[0][5] += f0;
+		H[0][6] += g0;
+		H[0][7] += h0;
+		H[1][0] += a1;
+		H[1][1] += b1;
+		H[1][2] += c1;
+		H[1][3] += d1;
+		H[1][4] += e1;
+		H[1][5] += f1;
+		H[1][6] += g1;
+		H[1][7] += h1;
+	}
 }
 
+/******************************************************************************
+ * x86 AVX2 multi-lane kernels.
+ ******************************************************************************/
+#if defined(__x86_64__) || defined(__i386__)
+#define AVX2_LANES	4
+#define ROTR_4(n, x)	_mm256_or_si256(_mm256_srli_epi64((x), (n)), \
+					_mm256_slli_epi64((x), 64 - (n)))
+
+__attribute__((target("avx2")))
+static inline __m256i
+load_4(const byte *blocks[], size_t off)
+{
+	return (_mm256_set_epi64x(
+	    load(&blocks[3][off]), load(&blocks[2][off]),
+	    load(&blocks[1][off]), load(&blocks[0][off])));
+}
+
+__attribute__((target("avx2")))
+void
+sha512_avx2(word *H[], const byte *blocks[], size_t num)
+{
+	__m256i a, b, c, d, e, f, g, h, S[8], T1, T2, W[ROUNDS];
+	word lanes[AVX2_LANES];
+	size_t off;
+	int i, t;
+
+	// Transpose the chaining values so each vector holds one word.
+	for (i = 0; i < 8; i++)
+		S[i] = _mm256_set_epi64x(H[3][i], H[2][i], H[1][i], H[0][i]);
+
+	for (off = 0; num > 0; num--, off += SHA64_BLK)
+	{
+		// Prepare the message schedule.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			if (t < SCHED)
+			{
+				W[t] = load_4(blocks,
+					      off + t * sizeof(word));
+				continue;
+			}
+
+			T1 = _mm256_xor_si256(ROTR_4(19, W[t - 2]),
+					      ROTR_4(61, W[t - 2]));
+			T1 = _mm256_xor_si256(T1, _mm256_srli_epi64(W[t - 2],
+								    6));
+			T2 = _mm256_xor_si256(ROTR_4(1, W[t - 15]),
+					      ROTR_4(8, W[t - 15]));
+			T2 = _mm256_xor_si256(T2, _mm256_srli_epi64(W[t - 15],
+								    7));
+			T1 = _mm256_add_epi64(T1, W[t - 7]);
+			T2 = _mm256_add_epi64(T2, W[t - 16]);
+			W[t] = _mm256_add_epi64(T1, T2);
+		}
+
+		// Initialize the working variables.
+		a = S[0];
+		b = S[1];
+		c = S[2];
+		d = S[3];
+		e = S[4];
+		f = S[5];
+		g = S[6];
+		h = S[7];
+
+		// Run through each round.
+		for (t = 0; t < ROUNDS; t++)
+		{
+			T1 = _mm256_xor_si256(ROTR_4(14, e), ROTR_4(18, e));
+			T1 = _mm256_xor_si256(T1, ROTR_4(41, e));
+			T1 = _mm256_add_epi64(T1, h);
+			T1 = _mm256_add_epi64(T1, _mm256_xor_si256(
+			    _mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+			T1 = _mm256_add_epi64(T1, _mm256_add_epi64(W[t],
+			    _mm256_set1_epi64x(K[t])));
+
+			T2 = _mm256_xor_si256(ROTR_4(28, a), ROTR_4(34, a));
+			T2 = _mm256_xor_si256(T2, ROTR_4(39, a));
+			T2 = _mm256_add_epi64(T2, _mm256_or_si256(
+			    _mm256_and_si256(a, b),
+			    _mm256_and_si256(c, _mm256_or_si256(a, b))));
+
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi64(d, T1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi64(T1, T2);
+		}
+
+		// Compute the intermediate hash value.
+		S[0] = _mm256_add_epi64(S[0], a);
+		S[1] = _mm256_add_epi64(S[1], b);
+		S[2] = _mm256_add_epi64(S[2], c);
+		S[3] = _mm256_add_epi64(S[3], d);
+		S[4] = _mm256_add_epi64(S[4], e);
+		S[5] = _mm256_add_epi64(S[5], f);
+		S[6] = _mm256_add_epi64(S[6], g);
+		S[7] = _mm256_add_epi64(S[7], h);
+	}
+
+	// Transpose the chaining values back.
+	for (i = 0; i < 8; i++)
+	{
+		_mm256_storeu_si256((__m256i *) lanes, S[i]);
+		for (t = 0; t < AVX2_LANES; t++)
+			H[t][i] = lanes[t];
+	}
+}
+#endif
+
 /******************************************************************************
  * Hashing functions.
  ******************************************************************************/
+static void
+compress(const struct sha_kernel *kernel, word *H, const byte *blocks,
+	 size_t num)
+{
+	word64 start;
+
+	start = (stats_enabled) ? (stats_start()) : (0);
+	(*kernel->fcn64)(H, blocks, num);
+	if (start != 0)
+		stats_hash(start, num);
+}
+
+static void
+compress_many(const struct sha_kernel *kernel, word *H[],
+	      const byte *blocks[], size_t num)
+{
+	word64 start;
+
+	// Idle lanes are counted, since the kernel runs them all the same.
+	start = (stats_enabled) ? (stats_start()) : (0);
+	if (kernel->many64 != NULL)
+		(*kernel->many64)(H, blocks, num);
+	else
+		(*kernel->fcn64)(H[0], blocks[0], num);
+	if (start != 0)
+		stats_hash(start, num * kernel->lanes);
+}
+
 static bool
 pad(struct sha64 *ctx)
 {
-	word index, len_b, len_m[2];
+	word len_b, len_m[2];
 	bool extra;
 
 	// Sanity check.
@@ -216,120 +502,163 @@ pad(struct sha64 *ctx)
 	len_b = ctx->block_len;
 	extra = (SHA64_BLK < len_b + sizeof(len_m) + 1);
 
-	// Zero all remaining space.
-	memset(&ctx->block.bytes[len_b], 0, 2 * SHA64_BLK - len_b);
-
-	// Add trailing '1'.
-	ctx->block.bytes[len_b] = 0x80;
-
-	// Add message length.
-	index = (!extra) ? (1) : (2);
+	// Count the message length before the extra block moves it.
 	len_m[0] = ctx->message_len[0];
 	len_m[1] = ctx->message_len[1];
 	add128(len_m, len_b);
 	shift128(len_m, 3);
-	ctx->block.bytes[index * SHA64_BLK - 16] = 0xFF & (len_m[0] >> 56);
-	ctx->block.bytes[index * SHA64_BLK - 15] = 0xFF & (len_m[0] >> 48);
-	ctx->block.bytes[index * SHA64_BLK - 14] = 0xFF & (len_m[0] >> 40);
-	ctx->block.bytes[index * SHA64_BLK - 13] = 0xFF & (len_m[0] >> 32);
-	ctx->block.bytes[index * SHA64_BLK - 12] = 0xFF & (len_m[0] >> 24);
-	ctx->block.bytes[index * SHA64_BLK - 11] = 0xFF & (len_m[0] >> 16);
-	ctx->block.bytes[index * SHA64_BLK - 10] = 0xFF & (len_m[0] >>  8);
-	ctx->block.bytes[index * SHA64_BLK -  9] = 0xFF & (len_m[0] >>  0);
-	ctx->block.bytes[index * SHA64_BLK -  8] = 0xFF & (len_m[1] >> 56);
-	ctx->block.bytes[index * SHA64_BLK -  7] = 0xFF & (len_m[1] >> 48);
-	ctx->block.bytes[index * SHA64_BLK -  6] = 0xFF & (len_m[1] >> 40);
-	ctx->block.bytes[index * SHA64_BLK -  5] = 0xFF & (len_m[1] >> 32);
-	ctx->block.bytes[index * SHA64_BLK -  4] = 0xFF & (len_m[1] >> 24);
-	ctx->block.bytes[index * SHA64_BLK -  3] = 0xFF & (len_m[1] >> 16);
-	ctx->block.bytes[index * SHA64_BLK -  2] = 0xFF & (len_m[1] >>  8);
-	ctx->block.bytes[index * SHA64_BLK -  1] = 0xFF & (len_m[1] >>  0);
 
-	// Add block.
-	if (!sha64_add(ctx, SHA64_BLK))
-		return (false);
+	// Add trailing '1' and zero the rest of the block.
+	ctx->block.bytes[len_b] = 0x80;
+	memset(&ctx->block.bytes[len_b + 1], 0, SHA64_BLK - len_b - 1);
 
-	// Add extra block.
+	// Run the block when the length doesn't fit, and pad a fresh one.
 	if (extra)
 	{
-		memcpy(&ctx->block.bytes[0], &ctx->block.bytes[SHA64_BLK],
-		       SHA64_BLK);
 		if (!sha64_add(ctx, SHA64_BLK))
 			return (false);
+		memset(ctx->block.bytes, 0, SHA64_BLK);
 	}
 
-	return (true);
+	// Add message length.
+	ctx->block.bytes[SHA64_BLK - 16] = 0xFF & (len_m[0] >> 56);
+	ctx->block.bytes[SHA64_BLK - 15] = 0xFF & (len_m[0] >> 48);
+	ctx->block.bytes[SHA64_BLK - 14] = 0xFF & (len_m[0] >> 40);
+	ctx->block.bytes[SHA64_BLK - 13] = 0xFF & (len_m[0] >> 32);
+	ctx->block.bytes[SHA64_BLK - 12] = 0xFF & (len_m[0] >> 24);
+	ctx->block.bytes[SHA64_BLK - 11] = 0xFF & (len_m[0] >> 16);
+	ctx->block.bytes[SHA64_BLK - 10] = 0xFF & (len_m[0] >>  8);
+	ctx->block.bytes[SHA64_BLK -  9] = 0xFF & (len_m[0] >>  0);
+	ctx->block.bytes[SHA64_BLK -  8] = 0xFF & (len_m[1] >> 56);
+	ctx->block.bytes[SHA64_BLK -  7] = 0xFF & (len_m[1] >> 48);
+	ctx->block.bytes[SHA64_BLK -  6] = 0xFF & (len_m[1] >> 40);
+	ctx->block.bytes[SHA64_BLK -  5] = 0xFF & (len_m[1] >> 32);
+	ctx->block.bytes[SHA64_BLK -  4] = 0xFF & (len_m[1] >> 24);
+	ctx->block.bytes[SHA64_BLK -  3] = 0xFF & (len_m[1] >> 16);
+	ctx->block.bytes[SHA64_BLK -  2] = 0xFF & (len_m[1] >>  8);
+	ctx->block.bytes[SHA64_BLK -  1] = 0xFF & (len_m[1] >>  0);
+
+	// Add block.
+	return (sha64_add(ctx, SHA64_BLK));
+}
+
+static const word *
+initial(enum sha_type type, int *num)
+{
+	switch (type)
+	{
+	case SHA384:
+		*num = sizeof(H_384) / sizeof(word);
+		return (H_384);
+
+	case SHA512:
+		*num = sizeof(H_512) / sizeof(word);
+		return (H_512);
+
+	case SHA512_224:
+		*num = sizeof(H_512_224) / sizeof(word);
+		return (H_512_224);
+
+	case SHA512_256:
+		*num = sizeof(H_512_256) / sizeof(word);
+		return (H_512_256);
+
+	default:
+		return (NULL);
+	}
 }
 
 static char *
 sha64(int fd, enum sha_type type)
 {
-	word bytes_left, bytes_read;
-	struct sha64 ctx;
+	byte bin[SHA64_HASH];
 	char *hash;
 
-	if (type != SHA384 && type != SHA512)
+	if (type != SHA384 && type != SHA512 && type != SHA512_224 &&
+	    type != SHA512_256)
 		return (NULL);
 
-	// Initialize context.
-	ctx.type = type;
-	if (!sha64_init(&ctx))
+	// The generic reader also waits on non-blocking descriptors.
+	if (!sha_fd(type, fd, bin))
 		return (NULL);
 
-	// Run each through each block.
-	while (true)
+	// Translate it to hex digits for the caller.
+	hash = malloc(2 * sha_hash_len(type) + 1);
+	if (hash == NULL)
 	{
-		// Initial read to fill block.
-		bytes_left = SHA64_BLK;
-		bytes_read = read(fd, ctx.block.bytes, bytes_left);
-
-		// End of file.
-		if (bytes_read == 0)
-			break;
+		warn("malloc");
+		return (NULL);
+	}
+	sha_hex(bin, sha_hash_len(type), hash);
 
-		// Read error.
-		if (bytes_read < 0)
-		{
-			warn("read");
-			return (NULL);
-		}
+	return (hash);
+}
 
-		// Keep trying to fill block if not yet full.
-		bytes_left -= bytes_read;
-		while (bytes_left > 0)
-		{
-			bytes_read = read(fd, ctx.block.bytes, bytes_left);
+static int
+compare(const void *a, const void *b)
+{
+	const struct order *x, *y;
 
-			// End of file.
-			if (bytes_read == 0)
-				break;
+	x = a;
+	y = b;
+	if (x->blocks == y->blocks)
+		return (0);
 
-			// Read error.
-			if (bytes_read < 0)
-			{
-				warn("read");
-				return (NULL);
-			}
+	return ((x->blocks > y->blocks) ? (-1) : (1));
+}
 
-			bytes_left -= bytes_read;
-		}
+static size_t
+tail(byte *blocks, const byte *data, size_t len)
+{
+	word len_m[2];
+	size_t num, rem;
+	int i;
 
-		// Run block through.
-		bytes_read = SHA64_BLK - bytes_left;
-		if (!sha64_add(&ctx, bytes_read))
-			return (NULL);
+	// Determine if an extra block will be needed.
+	rem = len % SHA64_BLK;
+	num = (rem + LEN_BYTES + 1 <= SHA64_BLK) ? (1) : (2);
+
+	// Copy the trailing partial block and zero the rest.
+	memset(blocks, 0, num * SHA64_BLK);
+	if (rem > 0)
+		memcpy(blocks, &data[len - rem], rem);
+
+	// Add trailing '1' and the message length.
+	blocks[rem] = 0x80;
+	len_m[0] = 0;
+	len_m[1] = len;
+	shift128(len_m, 3);
+	for (i = 1; i <= LEN_BYTES; i++)
+	{
+		blocks[num * SHA64_BLK - i] =
+		    0xFF & (len_m[(i <= 8) ? (1) : (0)] >> (8 * ((i - 1) % 8)));
 	}
 
-	// Calculate the hash.
-	if (!sha64_calc(&ctx))
-		return (NULL);
+	return (num);
+}
 
-	// Copy hash for caller.
-	hash = strdup(ctx.hash);
-	if (hash == NULL)
-		warn("strdup");
+static bool
+single(enum sha_type type, const void *data, size_t len, byte *hash)
+{
+	const struct sha_kernel *kernel;
+	word H[SHA64_HASH / sizeof(word)];
+	byte block[SHA64_BLK];
+	const word *init;
+	int i, num;
 
-	return (hash);
+	// Build the one padded block on the stack.
+	init = initial(type, &num);
+	kernel = sha_kernel(type);
+	if (init == NULL || kernel == NULL)
+		return (false);
+	for (i = 0; i < num; i++)
+		H[i] = init[i];
+	tail(block, data, len);
+
+	compress(kernel, H, block, 1);
+	store(H, hash, sha_hash_len(type));
+
+	return (true);
 }
 
 /******************************************************************************
@@ -347,6 +676,42 @@ sha512(int fd)
 	return (sha64(fd, SHA512));
 }
 
+char *
+sha512_224(int fd)
+{
+	return (sha64(fd, SHA512_224));
+}
+
+char *
+sha512_256(int fd)
+{
+	return (sha64(fd, SHA512_256));
+}
+
+bool
+sha384_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha64_many(SHA384, msgs, num, hashes));
+}
+
+bool
+sha512_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha64_many(SHA512, msgs, num, hashes));
+}
+
+bool
+sha512_224_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha64_many(SHA512_224, msgs, num, hashes));
+}
+
+bool
+sha512_256_many(const struct sha_msg *msgs, size_t num, byte *hashes)
+{
+	return (sha64_many(SHA512_256, msgs, num, hashes));
+}
+
 bool
 sha64_init(struct sha64 *ctx)
 {
@@ -357,21 +722,9 @@ sha64_init(struct sha64 *ctx)
 		return (false);
 
 	// Set the initial hash value.
-	switch (ctx->type)
-	{
-	case SHA384:
-		H = H_384;
-		num = sizeof(H_384) / sizeof(word);
-		break;
-
-	case SHA512:
-		H = H_512;
-		num = sizeof(H_512) / sizeof(word);
-		break;
-
-	default:
+	H = initial(ctx->type, &num);
+	if (H == NULL)
 		return (false);
-	}
 
 	for (i = 0; i < num; i++)
 		ctx->H[i] = H[i];
@@ -379,7 +732,6 @@ sha64_init(struct sha64 *ctx)
 	ctx->block_len = 0;
 	ctx->message_len[0] = 0;
 	ctx->message_len[1] = 0;
-	ctx->hash[0] = '\0';
 
 	return (true);
 }
@@ -387,117 +739,301 @@ sha64_init(struct sha64 *ctx)
 bool
 sha64_add(struct sha64 *ctx, int len)
 {
-	word a, b, c, d, e, f, g, h, T1, T2, W[ROUNDS];
-	byte t;
+	const struct sha_kernel *kernel;
 
-	if (ctx == NULL || (ctx->type != SHA384 && ctx->type != SHA512) ||
-	    len > SHA64_BLK)
+	if (ctx == NULL || len > SHA64_BLK)
 		return (false);
 
+	switch (ctx->type)
+	{
+	case SHA384:
+	case SHA512:
+	case SHA512_224:
+	case SHA512_256:
+		break;
+
+	default:
+		return (false);
+	}
+
 	// Last block of message needs to be specially padded.
 	ctx->block_len = len;
 	if (ctx->block_len < SHA64_BLK)
 		return (true);
 
-	// Prepare the message schedule.
-	for (t = 0; t < ROUNDS; t++)
+	// Run the block through the selected kernel.
+	kernel = sha_kernel(ctx->type);
+	if (kernel == NULL)
+		return (false);
+	compress(kernel, ctx->H, ctx->block.bytes, 1);
+
+	// Record the processing of this block.
+	add128(ctx->message_len, ctx->block_len);
+	ctx->block_len = 0;
+
+	return (true);
+}
+
+bool
+sha64_update(struct sha64 *ctx, const void *data, size_t len)
+{
+	const struct sha_kernel *kernel;
+	const byte *in;
+	size_t num;
+
+	if (ctx == NULL || (data == NULL && len > 0))
+		return (false);
+
+	// Top up the partial block, running it through once it is full.
+	in = data;
+	if (ctx->block_len > 0)
 	{
-		if (t < SCHED)
-		{
-			W[t] = be_to_le(ctx->block.words[t]);
-		}
-		else
-		{
-			W[t] = 0;
-			W[t] += sigma1(W[t - 2]);
-			W[t] += W[t - 7];
-			W[t] += sigma0(W[t - 15]);
-			W[t] += W[t - 16];
-		}
+		num = SHA64_BLK - ctx->block_len;
+		if (num > len)
+			num = len;
+		memcpy(&ctx->block.bytes[ctx->block_len], in, num);
+		in += num;
+		len -= num;
+
+		if (!sha64_add(ctx, ctx->block_len + num))
+			return (false);
 	}
 
-	// Initialize the working variables.
-	a = ctx->H[0];
-	b = ctx->H[1];
-	c = ctx->H[2];
-	d = ctx->H[3];
-	e = ctx->H[4];
-	f = ctx->H[5];
-	g = ctx->H[6];
-	h = ctx->H[7];
-
-	// Run through each round.
-	for (t = 0; t < ROUNDS; t++)
+	// Run whole blocks straight from the caller's buffer.
+	num = len / SHA64_BLK;
+	if (num > 0)
 	{
-		T1 = h + Sigma1(e) + Ch(e, f, g) + K[t] + W[t];
-		T2 = Sigma0(a) + Maj(a, b, c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + T1;
-		d = c;
-		c = b;
-		b = a;
-		a = T1 + T2;
-	}
+		kernel = sha_kernel(ctx->type);
+		if (kernel == NULL)
+			return (false);
+		compress(kernel, ctx->H, in, num);
 
-	// Compute the intermediate hash value.
-	ctx->H[0] += a;
-        ctx->H[1] += b;
-        ctx->H[2] += c;
-        ctx->H[3] += d;
-        ctx->H[4] += e;
-        ctx->H[5] += f;
-        ctx->H[6] += g;
-        ctx->H[7] += h;
+		add128(ctx->message_len, num * SHA64_BLK);
+		in += num * SHA64_BLK;
+		len -= num * SHA64_BLK;
+	}
 
-	// Record the processing of this block.
-	add128(ctx->message_len, ctx->block_len);
-	ctx->block_len = 0;
+	// Keep the remainder for later.
+	if (len > 0)
+	{
+		memcpy(ctx->block.bytes, in, len);
+		ctx->block_len = len;
+	}
 
 	return (true);
 }
 
 bool
-sha64_calc(struct sha64 *ctx)
+sha64_final(struct sha64 *ctx, byte *hash)
 {
-	if (ctx == NULL)
+	if (ctx == NULL || hash == NULL)
 		return (false);
 
 	// Perform padding.
 	if (!pad(ctx))
 		return (false);
 
-	// Translate the words to hex digits.
-	switch (ctx->type)
+	store(ctx->H, hash, sha_hash_len(ctx->type));
+
+	return (true);
+}
+
+bool
+sha64_copy(struct sha64 *dst, const struct sha64 *src)
+{
+	if (dst == NULL || src == NULL)
+		return (false);
+
+	// Only the buffered part of the block is live.
+	dst->type = src->type;
+	memcpy(dst->H, src->H, sizeof(dst->H));
+	memcpy(dst->block.bytes, src->block.bytes, src->block_len);
+	dst->block_len = src->block_len;
+	dst->message_len[0] = src->message_len[0];
+	dst->message_len[1] = src->message_len[1];
+
+	return (true);
+}
+
+bool
+sha64_prefixed(const struct sha64 *prefix, const void *data, size_t len,
+	       byte *hash)
+{
+	struct sha64 ctx;
+
+	// Resume from the prefix's midstate, leaving the prefix untouched.
+	if (!sha64_copy(&ctx, prefix))
+		return (false);
+
+	if (!sha64_update(&ctx, data, len))
+		return (false);
+
+	return (sha64_final(&ctx, hash));
+}
+
+bool
+sha64_buf(enum sha_type type, const void *data, size_t len, byte *hash)
+{
+	struct sha64 ctx;
+
+	if ((data == NULL && len > 0) || hash == NULL)
+		return (false);
+
+	// Messages that pad into one block skip the context entirely.
+	if (len <= SHORT_LEN)
+		return (single(type, data, len, hash));
+
+	ctx.type = type;
+	if (!sha64_init(&ctx))
+		return (false);
+
+	if (!sha64_update(&ctx, data, len))
+		return (false);
+
+	return (sha64_final(&ctx, hash));
+}
+
+bool
+sha64_many(enum sha_type type, const struct sha_msg *msgs, size_t num,
+	   byte *hashes)
+{
+	word *H[SHA_LANES], scratch[SHA64_HASH / sizeof(word)];
+	const struct sha_kernel *kernel;
+	const byte *blocks[SHA_LANES];
+	struct lane lanes[SHA_LANES];
+	size_t first, i, j, next, step;
+	const struct sha_msg *msg;
+	struct order *order;
+	struct sha64 ctx;
+	size_t hash_len;
+	int width;
+
+	if ((msgs == NULL || hashes == NULL) && num > 0)
+		return (false);
+
+	// Find the initial hash value and the kernel.
+	ctx.type = type;
+	if (!sha64_init(&ctx))
+		return (false);
+	kernel = sha_kernel_many(type);
+	if (kernel == NULL)
+		return (false);
+	width = kernel->lanes;
+	hash_len = sha_hash_len(type);
+
+	// A single lane gains nothing from scheduling, and a one-lane batch
+	// kernel is always the selected stream kernel too.
+	if (width == 1)
 	{
-	case SHA384:
-		snprintf(ctx->hash, sizeof(ctx->hash),
-			 "%016lx%016lx%016lx%016lx%016lx%016lx",
-			 ctx->H[0],
-			 ctx->H[1],
-			 ctx->H[2],
-			 ctx->H[3],
-			 ctx->H[4],
-			 ctx->H[5]);
-		break;
+		for (i = 0; i < num; i++)
+		{
+			if (!sha64_buf(type, msgs[i].data, msgs[i].len,
+				       &hashes[i * hash_len]))
+				return (false);
+		}
 
-	case SHA512:
-		snprintf(ctx->hash, sizeof(ctx->hash),
-			 "%016lx%016lx%016lx%016lx%016lx%016lx%016lx%016lx",
-			 ctx->H[0],
-			 ctx->H[1],
-			 ctx->H[2],
-			 ctx->H[3],
-			 ctx->H[4],
-			 ctx->H[5],
-			 ctx->H[6],
-			 ctx->H[7]);
-		break;
+		return (true);
+	}
 
-	default:
+	// Longest first, so the lanes run dry together at the end.
+	order = malloc(num * sizeof(*order));
+	if (order == NULL && num > 0)
+	{
+		warn("malloc");
 		return (false);
 	}
+	for (i = 0; i < num; i++)
+	{
+		order[i].blocks = (msgs[i].len + LEN_BYTES) / SHA64_BLK + 1;
+		order[i].index = i;
+	}
+	qsort(order, num, sizeof(*order), compare);
+
+	for (j = 0; j < width; j++)
+		lanes[j].busy = false;
+	next = 0;
+	while (true)
+	{
+		// A drained lane writes out its digest in the caller's order
+		// and takes the next message, so lanes only idle once the
+		// queue is empty.
+		first = step = 0;
+		for (j = 0; j < width; j++)
+		{
+			if (lanes[j].busy && lanes[j].num == 0 &&
+			    lanes[j].tail_num == 0)
+			{
+				store(lanes[j].H,
+				      &hashes[lanes[j].index * hash_len],
+				      hash_len);
+				lanes[j].busy = false;
+			}
+
+			if (!lanes[j].busy && next < num)
+			{
+				msg = &msgs[order[next].index];
+				lanes[j].data = msg->data;
+				lanes[j].num = msg->len / SHA64_BLK;
+				lanes[j].tail_num = tail(lanes[j].tail,
+							 msg->data, msg->len);
+				memcpy(lanes[j].H, ctx.H, sizeof(ctx.H));
+				lanes[j].index = order[next].index;
+				lanes[j].busy = true;
+				next++;
+			}
+
+			if (!lanes[j].busy)
+				continue;
+
+			// Whole blocks come straight from the message, then
+			// the padded tail.
+			if (lanes[j].num == 0)
+			{
+				lanes[j].data = lanes[j].tail;
+				lanes[j].num = lanes[j].tail_num;
+				lanes[j].tail_num = 0;
+			}
+
+			// Find the shortest run of contiguous blocks.
+			if (step == 0 || lanes[j].num < step)
+			{
+				first = j;
+				step = lanes[j].num;
+			}
+		}
+
+		if (step == 0)
+			break;
+
+		// Idle lanes repeat a live lane's work into scratch.
+		for (j = 0; j < width; j++)
+		{
+			if (lanes[j].busy)
+			{
+				H[j] = lanes[j].H;
+				blocks[j] = lanes[j].data;
+			}
+			else
+			{
+				H[j] = scratch;
+				blocks[j] = lanes[first].data;
+			}
+		}
+
+		// Advance every lane by the run.
+		compress_many(kernel, H, blocks, step);
+
+		for (j = 0; j < width; j++)
+		{
+			if (!lanes[j].busy)
+				continue;
+
+			lanes[j].data += step * SHA64_BLK;
+			lanes[j].num -= step;
+		}
+	}
+
+	free(order);
 
 	return (true);
 }
@@ -0,0 +1,848 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shad.h"
+
+#define IN_LIMIT	(4 * 1024 * 1024)
+#define MAX_EVENTS	64
+#define OUT_LIMIT	(4 * 1024 * 1024)
+#define READ_LEN	(64 * 1024)
+
+struct retired
+{
+	struct retired	*next;
+	void		*addr;
+	size_t		 len;
+};
+
+struct conn
+{
+	int		 fd;
+	byte		*in;
+	size_t		 in_len;
+	size_t		 in_used;
+	size_t		 in_max;
+	byte		*out;
+	size_t		 out_len;
+	size_t		 out_off;
+	size_t		 out_max;
+	int		 pass_fd;
+	byte		*map;
+	size_t		 map_len;
+	struct retired	*retired;
+	word32		 events;
+	bool		 eof;
+	bool		 dead;
+	bool		 dirty;
+	struct conn	*next;
+	struct conn	*prev_conn;
+	struct conn	*next_conn;
+};
+
+// Requests refer to buffers by offset, since buffers move as they grow.
+// Shared payloads keep the mapping they were checked against, which a
+// later request in the same round may replace.
+struct item
+{
+	struct conn	*c;
+	enum sha_type	 type;
+	byte		*map;
+	size_t		 data;
+	size_t		 len;
+	size_t		 resp;
+};
+
+struct server
+{
+	int		 epoll;
+	struct item	*items;
+	size_t		 num_items;
+	size_t		 max_items;
+	struct sha_msg	*msgs;
+	size_t		 max_msgs;
+	byte		*hashes;
+	size_t		 max_hashes;
+	struct conn	*dirty;
+	struct conn	*conns;
+};
+
+static const enum sha_type types[] = {
+	SHA1, SHA224, SHA256, SHA384, SHA512, SHA512_224, SHA512_256
+};
+
+static const int num_types = sizeof(types) / sizeof(enum sha_type);
+
+// Markers telling the event loop's own descriptors from connections.
+static int listen_tag, stop_tag;
+
+/******************************************************************************
+ * Buffers.
+ ******************************************************************************/
+static bool
+grow(void *bufp, size_t *max, size_t need, size_t size)
+{
+	void **buf, *grown;
+	size_t num;
+
+	if (need <= *max)
+		return (true);
+
+	num = (*max == 0) ? (16) : (*max);
+	while (num < need)
+		num *= 2;
+
+	buf = bufp;
+	grown = realloc(*buf, num * size);
+	if (grown == NULL)
+	{
+		warn("realloc");
+		return (false);
+	}
+
+	*buf = grown;
+	*max = num;
+
+	return (true);
+}
+
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+	const byte *p;
+	ssize_t n;
+
+	for (p = buf; len > 0; p += n, len -= n)
+	{
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n < 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+static bool
+read_all(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	byte *p;
+
+	for (p = buf; len > 0; p += n, len -= n)
+	{
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n <= 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+/******************************************************************************
+ * Connections.
+ ******************************************************************************/
+static void
+touch(struct server *srv, struct conn *c)
+{
+	if (c->dirty)
+		return;
+
+	c->dirty = true;
+	c->next = srv->dirty;
+	srv->dirty = c;
+}
+
+static void
+accept_all(struct server *srv, int sock)
+{
+	struct epoll_event ev;
+	struct conn *c;
+	int fd;
+
+	while ((fd = accept4(sock, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		c = calloc(1, sizeof(*c));
+		if (c == NULL)
+		{
+			warn("calloc");
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->pass_fd = -1;
+		c->events = EPOLLIN;
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (epoll_ctl(srv->epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			warn("epoll_ctl");
+			close(fd);
+			free(c);
+			continue;
+		}
+
+		c->next_conn = srv->conns;
+		if (srv->conns != NULL)
+			srv->conns->prev_conn = c;
+		srv->conns = c;
+	}
+}
+
+static void
+unmap(struct conn *c)
+{
+	struct retired *r;
+
+	while ((r = c->retired) != NULL)
+	{
+		c->retired = r->next;
+		munmap(r->addr, r->len);
+		free(r);
+	}
+}
+
+static void
+drop(struct server *srv, struct conn *c)
+{
+	if (c->prev_conn != NULL)
+		c->prev_conn->next_conn = c->next_conn;
+	else
+		srv->conns = c->next_conn;
+	if (c->next_conn != NULL)
+		c->next_conn->prev_conn = c->prev_conn;
+
+	unmap(c);
+	epoll_ctl(srv->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if (c->pass_fd >= 0)
+		close(c->pass_fd);
+	if (c->map != NULL)
+		munmap(c->map, c->map_len);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+static size_t
+respond(struct conn *c, word32 id, enum shad_status status, size_t len)
+{
+	struct shad_resp resp;
+	size_t off;
+
+	if (!grow(&c->out, &c->out_max, c->out_len + sizeof(resp), 1))
+	{
+		c->dead = true;
+		return (SIZE_MAX);
+	}
+
+	// The digest itself is filled in when the batch is hashed.
+	memset(&resp, 0, sizeof(resp));
+	resp.id = id;
+	resp.status = status;
+	resp.len = (status == SHAD_OK) ? (len) : (0);
+	off = c->out_len;
+	memcpy(&c->out[off], &resp, sizeof(resp));
+	c->out_len += sizeof(resp);
+
+	return (off);
+}
+
+static bool
+queue(struct server *srv, struct conn *c, const struct shad_req *req,
+      byte *map, size_t data)
+{
+	struct item *it;
+	size_t resp;
+
+	resp = respond(c, req->id, SHAD_OK, sha_hash_len(req->type));
+	if (resp == SIZE_MAX ||
+	    !grow(&srv->items, &srv->max_items, srv->num_items + 1,
+		  sizeof(*srv->items)))
+		return (false);
+
+	it = &srv->items[srv->num_items++];
+	it->c = c;
+	it->type = req->type;
+	it->map = map;
+	it->data = data;
+	it->len = req->len;
+	it->resp = resp;
+
+	return (true);
+}
+
+// The client must not be able to shrink the descriptor below the mapping,
+// or hashing a page past its end raises SIGBUS in the daemon.
+static bool
+mappable(int fd, word64 len)
+{
+	struct stat st;
+	int seals;
+
+	if (fstat(fd, &st) != 0 || len > (word64) st.st_size)
+		return (false);
+
+	seals = fcntl(fd, F_GET_SEALS);
+
+	return (seals >= 0 && (seals & F_SEAL_SHRINK) != 0);
+}
+
+static void
+map(struct conn *c, const struct shad_req *req)
+{
+	struct retired *r;
+	void *addr;
+
+	if (c->pass_fd < 0)
+	{
+		respond(c, req->id, SHAD_INVALID, 0);
+		return;
+	}
+
+	addr = MAP_FAILED;
+	if (req->offset != 0 && req->offset <= SIZE_MAX &&
+	    mappable(c->pass_fd, req->offset))
+		addr = mmap(NULL, req->offset, PROT_READ, MAP_SHARED,
+			    c->pass_fd, 0);
+	close(c->pass_fd);
+	c->pass_fd = -1;
+	if (addr == MAP_FAILED)
+	{
+		respond(c, req->id, SHAD_INVALID, 0);
+		return;
+	}
+
+	// Queued requests may still point into the old mapping, so it is
+	// only unmapped once the batch has been hashed.
+	if (c->map != NULL)
+	{
+		r = malloc(sizeof(*r));
+		if (r == NULL)
+		{
+			warn("malloc");
+			munmap(addr, req->offset);
+			c->dead = true;
+			return;
+		}
+
+		r->next = c->retired;
+		r->addr = c->map;
+		r->len = c->map_len;
+		c->retired = r;
+	}
+	c->map = addr;
+	c->map_len = req->offset;
+	respond(c, req->id, SHAD_OK, 0);
+}
+
+static void
+parse(struct server *srv, struct conn *c)
+{
+	struct shad_req req;
+	size_t need;
+	bool ok;
+
+	while (!c->dead && c->in_len - c->in_used >= sizeof(req))
+	{
+		memcpy(&req, &c->in[c->in_used], sizeof(req));
+
+		// A payload too big to buffer can't be skipped, so the
+		// connection ends after the reply.
+		if (req.op == SHAD_HASH && req.len > SHAD_MAX_LEN)
+		{
+			respond(c, req.id, SHAD_TOO_BIG, 0);
+			c->in_used = c->in_len;
+			c->eof = true;
+			return;
+		}
+
+		need = sizeof(req) + ((req.op == SHAD_HASH) ? (req.len) : (0));
+		if (c->in_len - c->in_used < need)
+			return;
+
+		ok = (sha_hash_len(req.type) > 0);
+		switch (req.op)
+		{
+		case SHAD_HASH:
+			if (ok)
+				queue(srv, c, &req, NULL,
+				      c->in_used + sizeof(req));
+			break;
+
+		case SHAD_SHM:
+			// Shared payloads must stay within the mapping.
+			ok = (ok && c->map != NULL &&
+			      req.offset <= c->map_len &&
+			      req.len <= c->map_len - req.offset);
+			if (ok)
+				queue(srv, c, &req, c->map, req.offset);
+			break;
+
+		case SHAD_MAP:
+			map(c, &req);
+			ok = true;
+			break;
+
+		default:
+			ok = false;
+		}
+
+		if (!ok)
+			respond(c, req.id, SHAD_INVALID, 0);
+		c->in_used += need;
+	}
+}
+
+static void
+receive(struct server *srv, struct conn *c)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int fd, i, num;
+	ssize_t n;
+
+	touch(srv, c);
+	while (!c->eof && !c->dead && c->in_len < IN_LIMIT)
+	{
+		if (!grow(&c->in, &c->in_max, c->in_len + READ_LEN, 1))
+		{
+			c->dead = true;
+			return;
+		}
+
+		// Descriptors for shared payloads ride along with the data.
+		iov.iov_base = &c->in[c->in_len];
+		iov.iov_len = c->in_max - c->in_len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				c->dead = true;
+			return;
+		}
+		if (n == 0)
+		{
+			c->eof = true;
+			return;
+		}
+
+		// Only one descriptor is kept; any others sent along are
+		// closed rather than left open in the daemon.
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (i = 0; i < num; i++)
+			{
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+				       sizeof(int));
+				if (i > 0)
+				{
+					close(fd);
+					continue;
+				}
+				if (c->pass_fd >= 0)
+					close(c->pass_fd);
+				c->pass_fd = fd;
+			}
+		}
+
+		// Descriptors that didn't fit were dropped by the kernel, so
+		// the stream can no longer be followed.
+		if (msg.msg_flags & MSG_CTRUNC)
+		{
+			c->dead = true;
+			return;
+		}
+
+		c->in_len += n;
+		parse(srv, c);
+	}
+}
+
+static void
+transmit(struct conn *c)
+{
+	ssize_t n;
+
+	while (!c->dead && c->out_off < c->out_len)
+	{
+		n = send(c->fd, &c->out[c->out_off], c->out_len - c->out_off,
+			 MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				c->dead = true;
+			return;
+		}
+
+		c->out_off += n;
+	}
+
+	c->out_len = c->out_off = 0;
+}
+
+static void
+settle(struct server *srv, struct conn *c)
+{
+	struct epoll_event ev;
+	size_t pending;
+
+	// Parsed input, old mappings, and written output are no longer
+	// needed.
+	unmap(c);
+	memmove(c->in, &c->in[c->in_used], c->in_len - c->in_used);
+	c->in_len -= c->in_used;
+	c->in_used = 0;
+	if (c->out_off > 0)
+	{
+		memmove(c->out, &c->out[c->out_off], c->out_len - c->out_off);
+		c->out_len -= c->out_off;
+		c->out_off = 0;
+	}
+
+	transmit(c);
+	pending = c->out_len - c->out_off;
+	if (c->dead || (c->eof && pending == 0))
+	{
+		drop(srv, c);
+		return;
+	}
+
+	// Stop reading from clients that aren't collecting their replies.
+	ev.events = 0;
+	if (!c->eof && pending < OUT_LIMIT && c->in_len < IN_LIMIT)
+		ev.events |= EPOLLIN;
+	if (pending > 0)
+		ev.events |= EPOLLOUT;
+	if (ev.events != c->events)
+	{
+		ev.data.ptr = c;
+		epoll_ctl(srv->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = ev.events;
+	}
+}
+
+/******************************************************************************
+ * Batching.
+ ******************************************************************************/
+static void
+flush(struct server *srv)
+{
+	size_t hash_len, i, n;
+	struct conn *c, *next;
+	struct item *it;
+	int t;
+
+	// Everything read this round is hashed together, one batch per
+	// algorithm, so requests from many clients share the lanes.
+	if (!grow(&srv->msgs, &srv->max_msgs, srv->num_items,
+		  sizeof(*srv->msgs)) ||
+	    !grow(&srv->hashes, &srv->max_hashes, srv->num_items, SHA_HASH))
+	{
+		warnx("Dropping a batch of %zu requests.", srv->num_items);
+		for (i = 0; i < srv->num_items; i++)
+			srv->items[i].c->dead = true;
+		srv->num_items = 0;
+	}
+
+	for (t = 0; t < num_types; t++)
+	{
+		n = 0;
+		for (i = 0; i < srv->num_items; i++)
+		{
+			it = &srv->items[i];
+			if (it->type != types[t])
+				continue;
+
+			srv->msgs[n].data = (it->map != NULL) ?
+			    (&it->map[it->data]) : (&it->c->in[it->data]);
+			srv->msgs[n].len = it->len;
+			n++;
+		}
+		if (n == 0 || !sha_many(types[t], srv->msgs, n, srv->hashes))
+			continue;
+
+		hash_len = sha_hash_len(types[t]);
+		n = 0;
+		for (i = 0; i < srv->num_items; i++)
+		{
+			it = &srv->items[i];
+			if (it->type != types[t])
+				continue;
+
+			memcpy(&it->c->out[it->resp +
+					   offsetof(struct shad_resp, hash)],
+			       &srv->hashes[n * hash_len], hash_len);
+			n++;
+		}
+	}
+	srv->num_items = 0;
+
+	for (c = srv->dirty; c != NULL; c = next)
+	{
+		next = c->next;
+		c->dirty = false;
+		settle(srv, c);
+	}
+	srv->dirty = NULL;
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+int
+shad_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		warnx("Socket path %s is too long.", path);
+		return (-1);
+	}
+	strcpy(addr.sun_path, path);
+
+	// Only replace a socket that nobody is serving.
+	fd = shad_connect(path);
+	if (fd >= 0)
+	{
+		close(fd);
+		warnx("%s is already being served.", path);
+		return (-1);
+	}
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		warn("socket");
+		return (-1);
+	}
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0)
+	{
+		warn("%s", path);
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+bool
+shad_serve(int sock, int stop_fd)
+{
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct server srv;
+	bool running;
+	int i, n;
+
+	memset(&srv, 0, sizeof(srv));
+	srv.epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (srv.epoll < 0)
+	{
+		warn("epoll_create1");
+		return (false);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	if (epoll_ctl(srv.epoll, EPOLL_CTL_ADD, sock, &ev) != 0)
+	{
+		warn("epoll_ctl");
+		close(srv.epoll);
+		return (false);
+	}
+	ev.data.ptr = &stop_tag;
+	if (stop_fd >= 0 &&
+	    epoll_ctl(srv.epoll, EPOLL_CTL_ADD, stop_fd, &ev) != 0)
+	{
+		warn("epoll_ctl");
+		close(srv.epoll);
+		return (false);
+	}
+
+	running = true;
+	while (running)
+	{
+		n = epoll_wait(srv.epoll, events, MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			warn("epoll_wait");
+			break;
+		}
+
+		// Read everything that's ready before hashing any of it.
+		for (i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr == &stop_tag)
+				running = false;
+			else if (events[i].data.ptr == &listen_tag)
+				accept_all(&srv, sock);
+			else if (events[i].events & (EPOLLIN | EPOLLHUP |
+						     EPOLLERR))
+				receive(&srv, events[i].data.ptr);
+			else
+				touch(&srv, events[i].data.ptr);
+		}
+
+		flush(&srv);
+	}
+
+	while (srv.conns != NULL)
+		drop(&srv, srv.conns);
+	close(srv.epoll);
+	free(srv.items);
+	free(srv.msgs);
+	free(srv.hashes);
+
+	return (!running);
+}
+
+int
+shad_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return (-1);
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return (-1);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+bool
+shad_map(int fd, int shm_fd, size_t len)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct shad_req req;
+	struct msghdr msg;
+	struct iovec iov;
+	int seals;
+
+	// The daemon only maps descriptors that can no longer shrink.
+	seals = fcntl(shm_fd, F_GET_SEALS);
+	if (seals < 0 || ((seals & F_SEAL_SHRINK) == 0 &&
+	    fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0))
+		return (false);
+
+	memset(&req, 0, sizeof(req));
+	req.op = SHAD_MAP;
+	req.offset = len;
+
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+
+	return (sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(req));
+}
+
+bool
+shad_send(int fd, const struct shad_req *req, const void *payload)
+{
+	if (!write_all(fd, req, sizeof(*req)))
+		return (false);
+
+	if (req->op != SHAD_HASH)
+		return (true);
+
+	return (write_all(fd, payload, req->len));
+}
+
+bool
+shad_recv(int fd, struct shad_resp *resp)
+{
+	return (read_all(fd, resp, sizeof(*resp)));
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#ifndef __SHAD_H
+#define __SHAD_H
+
+#include "sha.h"
+
+#define SHAD_MAX_LEN	(1024 * 1024)
+#define SHAD_SOCKET	"/tmp/shad.sock"
+
+// Requests are sent in host byte order; the daemon only serves its host.
+enum shad_op
+{
+	SHAD_HASH,		// Hash the len bytes that follow.
+	SHAD_MAP,		// Map the passed descriptor as shared payloads;
+			// it must be sealed against shrinking.
+	SHAD_SHM		// Hash len bytes at offset in the mapping.
+};
+
+enum shad_status
+{
+	SHAD_OK,
+	SHAD_INVALID,
+	SHAD_TOO_BIG
+};
+
+struct shad_req
+{
+	word64	offset;
+	word32	id;
+	word32	len;
+	byte	op;
+	byte	type;
+	byte	reserved[6];
+};
+
+struct shad_resp
+{
+	word32	id;
+	byte	status;
+	byte	len;
+	byte	reserved[2];
+	byte	hash[SHA_HASH];
+};
+
+int	shad_listen(const char *path);
+bool	shad_serve(int sock, int stop_fd);
+
+int	shad_connect(const char *path);
+bool	shad_map(int fd, int shm_fd, size_t len);
+bool	shad_send(int fd, const struct shad_req *req, const void *payload);
+bool	shad_recv(int fd, struct shad_resp *resp);
+
+#endif
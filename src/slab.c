@@ -0,0 +1,142 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdlib.h>
+
+#include "sha.h"
+
+#define SLAB_ALIGN	4096
+#define SLAB_LEN	(64 * 1024)
+
+// Each slab's header takes its first slot; the rest hold contexts.
+#define SLAB_CTXS	(SLAB_LEN / sizeof(struct sha) - 1)
+
+struct slab
+{
+	struct slab	*next;
+};
+
+// Free contexts are threaded through their own storage.
+struct link
+{
+	struct link	*next;
+};
+
+// Slabs aren't locked, so each thread should keep its own.
+struct sha_slab
+{
+	struct slab	*slabs;
+	struct link	*free;
+};
+
+static bool
+grow(struct sha_slab *slab)
+{
+	struct slab *s;
+	struct sha *ctx;
+	size_t i;
+	void *mem;
+
+	if (posix_memalign(&mem, SLAB_ALIGN, SLAB_LEN) != 0)
+	{
+		warnx("Couldn't allocate a slab of contexts.");
+		return (false);
+	}
+	s = mem;
+	s->next = slab->slabs;
+	slab->slabs = s;
+
+	// Push in reverse, so contexts are handed out in address order.
+	ctx = (struct sha *) s + 1;
+	for (i = SLAB_CTXS; i > 0; i--)
+	{
+		((struct link *) &ctx[i - 1])->next = slab->free;
+		slab->free = (struct link *) &ctx[i - 1];
+	}
+
+	return (true);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+struct sha_slab *
+sha_slab_create(void)
+{
+	struct sha_slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (slab == NULL)
+		warn("calloc");
+
+	return (slab);
+}
+
+void
+sha_slab_destroy(struct sha_slab *slab)
+{
+	struct slab *s;
+
+	if (slab == NULL)
+		return;
+
+	while ((s = slab->slabs) != NULL)
+	{
+		slab->slabs = s->next;
+		free(s);
+	}
+	free(slab);
+}
+
+struct sha *
+sha_slab_alloc(struct sha_slab *slab)
+{
+	struct link *l;
+
+	if (slab == NULL || (slab->free == NULL && !grow(slab)))
+		return (NULL);
+
+	// The most recently freed context is the likeliest to be cached.
+	l = slab->free;
+	slab->free = l->next;
+
+	return ((struct sha *) l);
+}
+
+void
+sha_slab_free(struct sha_slab *slab, struct sha *ctx)
+{
+	struct link *l;
+
+	if (slab == NULL || ctx == NULL)
+		return;
+
+	l = (struct link *) ctx;
+	l->next = slab->free;
+	slab->free = l;
+}
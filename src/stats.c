@@ -0,0 +1,251 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+// Each thread counts into its own node, found through thread-local
+// storage.  Live nodes are listed for readers, and a node is folded into
+// the retired totals when its thread exits.
+struct node
+{
+	struct sha_stats	 stats;
+	struct node		*next;
+	struct node		*prev;
+	bool			 listed;
+};
+
+bool stats_enabled = false;
+
+static struct node *nodes = NULL;
+static struct sha_stats retired;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread struct node local;
+
+static void
+bump(word64 *counter, word64 n)
+{
+	// Only the owning thread writes, so no locked add is needed.
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+			 n, __ATOMIC_RELAXED);
+}
+
+static void
+add(struct sha_stats *dst, struct sha_stats *src)
+{
+	dst->bytes_read += __atomic_load_n(&src->bytes_read, __ATOMIC_RELAXED);
+	dst->reads += __atomic_load_n(&src->reads, __ATOMIC_RELAXED);
+	dst->short_reads += __atomic_load_n(&src->short_reads,
+					    __ATOMIC_RELAXED);
+	dst->blocks += __atomic_load_n(&src->blocks, __ATOMIC_RELAXED);
+	dst->io_ns += __atomic_load_n(&src->io_ns, __ATOMIC_RELAXED);
+	dst->hash_ns += __atomic_load_n(&src->hash_ns, __ATOMIC_RELAXED);
+}
+
+static void
+retire(void *arg)
+{
+	struct node *n = arg;
+
+	pthread_mutex_lock(&lock);
+	add(&retired, &n->stats);
+	if (n->prev != NULL)
+		n->prev->next = n->next;
+	else
+		nodes = n->next;
+	if (n->next != NULL)
+		n->next->prev = n->prev;
+	n->listed = false;
+	pthread_mutex_unlock(&lock);
+}
+
+static void
+make_key(void)
+{
+	pthread_key_create(&key, retire);
+}
+
+static struct sha_stats *
+counters(void)
+{
+	// A thread's first count lists its node.
+	if (!local.listed)
+	{
+		pthread_once(&once, make_key);
+		pthread_mutex_lock(&lock);
+		local.prev = NULL;
+		local.next = nodes;
+		if (nodes != NULL)
+			nodes->prev = &local;
+		nodes = &local;
+		local.listed = true;
+		pthread_mutex_unlock(&lock);
+		pthread_setspecific(key, &local);
+	}
+
+	return (&local.stats);
+}
+
+static word64
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((word64) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+count_read(ssize_t got, size_t len, word64 start)
+{
+	struct sha_stats *s;
+
+	s = counters();
+	if (start != 0)
+		bump(&s->io_ns, now() - start);
+	bump(&s->reads, 1);
+	if (got > 0)
+		bump(&s->bytes_read, got);
+	if (got > 0 && got < len)
+		bump(&s->short_reads, 1);
+}
+
+/******************************************************************************
+ * Hooks.
+ ******************************************************************************/
+ssize_t
+stats_read(int fd, void *buf, size_t len)
+{
+	word64 start;
+	ssize_t got;
+
+	if (!stats_enabled)
+		return (read(fd, buf, len));
+
+	start = now();
+	got = read(fd, buf, len);
+	count_read(got, len, start);
+
+	return (got);
+}
+
+ssize_t
+stats_pread(int fd, void *buf, size_t len, off_t off)
+{
+	word64 start;
+	ssize_t got;
+
+	if (!stats_enabled)
+		return (pread(fd, buf, len, off));
+
+	start = now();
+	got = pread(fd, buf, len, off);
+	count_read(got, len, start);
+
+	return (got);
+}
+
+void
+stats_io(word64 start, ssize_t got, size_t len)
+{
+	// Reads finished elsewhere, as by io_uring.  A zero start counts the
+	// read without charging any time for it.
+	if (stats_enabled)
+		count_read(got, len, start);
+}
+
+word64
+stats_start(void)
+{
+	return ((stats_enabled) ? (now()) : (0));
+}
+
+void
+stats_hash(word64 start, size_t blocks)
+{
+	struct sha_stats *s;
+
+	// Stats turned on mid-call are picked up from the next call.
+	if (start == 0)
+		return;
+
+	s = counters();
+	bump(&s->hash_ns, now() - start);
+	bump(&s->blocks, blocks);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+void
+sha_stats_enable(bool on)
+{
+	stats_enabled = on;
+}
+
+void
+sha_stats_get(struct sha_stats *stats)
+{
+	struct node *n;
+
+	if (stats == NULL)
+		return;
+
+	pthread_mutex_lock(&lock);
+	memcpy(stats, &retired, sizeof(*stats));
+	for (n = nodes; n != NULL; n = n->next)
+		add(stats, &n->stats);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+sha_stats_reset(void)
+{
+	struct node *n;
+
+	// Counters of running threads are cleared from under them, so a
+	// count in progress may survive the reset.
+	pthread_mutex_lock(&lock);
+	memset(&retired, 0, sizeof(retired));
+	for (n = nodes; n != NULL; n = n->next)
+	{
+		__atomic_store_n(&n->stats.bytes_read, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->stats.reads, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->stats.short_reads, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->stats.blocks, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->stats.io_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->stats.hash_ns, 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,504 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "stats.h"
+#include "storm.h"
+
+#define QUEUE		128
+#define SETS		2
+#define SLOTS		(SETS * QUEUE)
+#define SMALL_LEN	(16 * 1024)
+#define RING_LEN	1024
+
+#define OP_OPEN		0
+#define OP_READ		1
+#define OP_CLOSE	2
+#define OPS		3
+
+struct storm;
+
+// A batch of small files, each read whole into its own slot.
+struct set
+{
+	struct storm	*storm;
+	size_t		 num;
+	size_t		 index[QUEUE];
+	ssize_t		 lens[QUEUE];
+	byte		*bufs;
+	int		 pending;
+};
+
+struct ring
+{
+	int			 fd;
+	void			*sq_map;
+	void			*cq_map;
+	size_t			 sq_len;
+	size_t			 cq_len;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_array;
+	unsigned		 tail;
+	unsigned		 queued;
+	struct io_uring_sqe	*sqes;
+	size_t			 sqes_len;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+struct storm
+{
+	const struct storm_opts	*opts;
+	struct tree_entry	*entries;
+	byte			*hashes;
+	struct set		 sets[SETS];
+	size_t			*slow;
+	size_t			 num_slow;
+};
+
+/******************************************************************************
+ * io_uring, through the raw system calls.
+ ******************************************************************************/
+static void
+ring_unmap(struct ring *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_len > 0 && r->cq_map != MAP_FAILED)
+		munmap(r->cq_map, r->cq_len);
+	if (r->sq_map != MAP_FAILED)
+		munmap(r->sq_map, r->sq_len);
+	close(r->fd);
+}
+
+static bool
+ring_init(struct ring *r)
+{
+	struct io_uring_params p;
+	int fds[SLOTS], i;
+	char *sq, *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, RING_LEN, &p);
+	if (r->fd < 0)
+		return (false);
+
+	// Older kernels map the two rings separately.
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = 0;
+	}
+
+	r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_map = r->sq_map;
+	if (r->sq_map != MAP_FAILED && r->cq_len > 0)
+		r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, r->fd,
+				 IORING_OFF_CQ_RING);
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (r->cq_map != MAP_FAILED)
+		r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, r->fd,
+			       IORING_OFF_SQES);
+	if (r->sqes == NULL || r->sqes == MAP_FAILED)
+	{
+		ring_unmap(r);
+		return (false);
+	}
+
+	sq = r->sq_map;
+	cq = r->cq_map;
+	r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) (sq + p.sq_off.array);
+	r->cq_head = (unsigned *) (cq + p.cq_off.head);
+	r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	r->tail = *r->sq_tail;
+
+	// Every slot gets a direct descriptor, so a read can be linked to
+	// the open that creates it.
+	for (i = 0; i < SLOTS; i++)
+		fds[i] = -1;
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES,
+		    fds, SLOTS) != 0)
+	{
+		ring_unmap(r);
+		return (false);
+	}
+
+	return (true);
+}
+
+static struct io_uring_sqe *
+ring_sqe(struct ring *r, int slot, int op, byte flags)
+{
+	struct io_uring_sqe *sqe;
+	unsigned i;
+
+	i = r->tail & *r->sq_mask;
+	sqe = &r->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->flags = flags;
+	sqe->user_data = slot * OPS + op;
+	r->sq_array[i] = i;
+	r->tail++;
+	r->queued++;
+
+	return (sqe);
+}
+
+static bool
+ring_enter(struct ring *r, unsigned wait)
+{
+	int n;
+
+	// Publish the new entries before the kernel looks for them.
+	__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+	for (;;)
+	{
+		n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait,
+			    (wait > 0) ? (IORING_ENTER_GETEVENTS) : (0),
+			    NULL, 0);
+		if (n >= 0)
+			break;
+		if (errno != EINTR)
+		{
+			warn("io_uring_enter");
+			return (false);
+		}
+	}
+	r->queued -= n;
+
+	return (true);
+}
+
+/******************************************************************************
+ * Batches.
+ ******************************************************************************/
+static size_t
+fill(struct storm *s, struct set *set, size_t next, size_t num)
+{
+	struct tree_entry *e;
+
+	// Files already known to be large go straight to the slow path.
+	set->num = 0;
+	for (; next < num && set->num < QUEUE; next++)
+	{
+		e = &s->entries[next];
+		if (e->failed)
+			continue;
+		if (e->size >= SMALL_LEN)
+		{
+			s->slow[s->num_slow++] = next;
+			continue;
+		}
+
+		set->index[set->num] = next;
+		set->lens[set->num] = -1;
+		set->num++;
+	}
+
+	return (next);
+}
+
+static void
+submit(struct ring *r, struct set *set, int base)
+{
+	struct io_uring_sqe *sqe;
+	struct tree_entry *e;
+	int i, slot;
+
+	// Each file is an open, a read and a close, hard-linked so the close
+	// still runs when the read comes up short.
+	for (i = 0; i < set->num; i++)
+	{
+		e = &set->storm->entries[set->index[i]];
+		slot = base + i;
+
+		sqe = ring_sqe(r, slot, OP_OPEN, IOSQE_IO_HARDLINK);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t) e->path;
+		// Direct descriptors are never inherited, and the kernel
+		// refuses O_CLOEXEC on them.
+		sqe->open_flags = O_RDONLY | O_NOCTTY;
+		sqe->file_index = slot + 1;
+
+		sqe = ring_sqe(r, slot, OP_READ,
+			       IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = slot;
+		sqe->addr = (uintptr_t) &set->bufs[i * SMALL_LEN];
+		sqe->len = SMALL_LEN;
+
+		sqe = ring_sqe(r, slot, OP_CLOSE, 0);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = slot + 1;
+	}
+	set->pending = OPS * set->num;
+}
+
+static bool
+reap(struct storm *s, struct ring *r, struct set *set)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	struct set *owner;
+	word64 start;
+	int op, slot;
+
+	while (set->pending > 0)
+	{
+		// The wait is charged to the first read it brings in.
+		start = stats_start();
+		if (!ring_enter(r, 1))
+			return (false);
+
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+		{
+			cqe = &r->cqes[head & *r->cq_mask];
+			slot = cqe->user_data / OPS;
+			op = cqe->user_data % OPS;
+			owner = &s->sets[slot / QUEUE];
+			owner->pending--;
+
+			// A failed open also cancels the read.
+			if (op != OP_READ)
+				continue;
+			owner->lens[slot % QUEUE] = cqe->res;
+			stats_io(start, cqe->res, SMALL_LEN);
+			start = 0;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return (true);
+}
+
+static void
+read_one(void *arg, size_t index)
+{
+	struct set *set;
+	int fd;
+
+	set = arg;
+	fd = open(set->storm->entries[set->index[index]].path,
+		  O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0)
+		return;
+
+	set->lens[index] = stats_read(fd, &set->bufs[index * SMALL_LEN],
+				      SMALL_LEN);
+	close(fd);
+}
+
+static void
+slow_one(void *arg, size_t index)
+{
+	struct tree_entry *e;
+	struct storm *s;
+	size_t hash_len;
+	int fd;
+
+	s = arg;
+	e = &s->entries[s->slow[index]];
+	hash_len = sha_hash_len(s->opts->type);
+
+	fd = open(e->path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0)
+	{
+		warn("%s", e->path);
+		e->failed = true;
+		return;
+	}
+
+	if (!sha_fd(s->opts->type, fd, &s->hashes[s->slow[index] * hash_len]))
+	{
+		warnx("%s: Couldn't calculate hash.", e->path);
+		e->failed = true;
+	}
+	close(fd);
+}
+
+static bool
+digest(struct storm *s, struct set *set)
+{
+	byte hashes[QUEUE * SHA_HASH];
+	struct sha_msg msgs[QUEUE];
+	size_t hash_len, i, n;
+	int which[QUEUE];
+
+	// Anything that filled its slot may have more behind it, and anything
+	// that failed is retried on the slow path to get a proper error.
+	for (i = 0, n = 0; i < set->num; i++)
+	{
+		if (set->lens[i] < 0 || set->lens[i] >= SMALL_LEN)
+		{
+			s->slow[s->num_slow++] = set->index[i];
+			continue;
+		}
+
+		msgs[n].data = &set->bufs[i * SMALL_LEN];
+		msgs[n].len = set->lens[i];
+		which[n++] = i;
+	}
+	if (n == 0)
+		return (true);
+
+	if (!sha_many(s->opts->type, msgs, n, hashes))
+		return (false);
+
+	hash_len = sha_hash_len(s->opts->type);
+	for (i = 0; i < n; i++)
+		memcpy(&s->hashes[set->index[which[i]] * hash_len],
+		       &hashes[i * hash_len], hash_len);
+
+	return (true);
+}
+
+static bool
+run_uring(struct storm *s, struct ring *r, size_t num)
+{
+	struct set *cur, *next;
+	size_t pos;
+	int i;
+
+	// While one set is hashed, the kernel is already reading the other.
+	pos = fill(s, &s->sets[0], 0, num);
+	submit(r, &s->sets[0], 0);
+	if (!ring_enter(r, 0))
+		return (false);
+
+	for (i = 0; s->sets[i].num > 0; i ^= 1)
+	{
+		cur = &s->sets[i];
+		next = &s->sets[i ^ 1];
+
+		pos = fill(s, next, pos, num);
+		submit(r, next, (i ^ 1) * QUEUE);
+		if (!ring_enter(r, 0) || !reap(s, r, cur) ||
+		    !digest(s, cur))
+			return (false);
+		cur->num = 0;
+	}
+
+	return (true);
+}
+
+static bool
+run_pool(struct storm *s, size_t num)
+{
+	struct set *set;
+	size_t pos;
+
+	set = &s->sets[0];
+	for (pos = 0; pos < num;)
+	{
+		pos = fill(s, set, pos, num);
+		pool_run(read_one, set, set->num, s->opts->threads);
+		if (!digest(s, set))
+			return (false);
+	}
+
+	return (true);
+}
+
+bool
+storm_hash(const struct storm_opts *opts, struct tree_entry *entries,
+	   size_t num, byte *hashes)
+{
+	struct storm s;
+	struct ring r;
+	bool uring, ret;
+	byte *bufs;
+	int i;
+
+	if (sha_hash_len(opts->type) == 0)
+		return (false);
+
+	memset(&s, 0, sizeof(s));
+	s.opts = opts;
+	s.entries = entries;
+	s.hashes = hashes;
+	s.slow = malloc((num + 1) * sizeof(*s.slow));
+	bufs = malloc(SLOTS * SMALL_LEN);
+	if (s.slow == NULL || bufs == NULL)
+	{
+		warn("malloc");
+		free(s.slow);
+		free(bufs);
+		return (false);
+	}
+	for (i = 0; i < SETS; i++)
+	{
+		s.sets[i].storm = &s;
+		s.sets[i].bufs = &bufs[i * QUEUE * SMALL_LEN];
+	}
+
+	uring = !opts->no_uring && ring_init(&r);
+	if (uring)
+	{
+		ret = run_uring(&s, &r, num);
+		ring_unmap(&r);
+	}
+	else
+		ret = run_pool(&s, num);
+
+	if (ret)
+		pool_run(slow_one, &s, s.num_slow, opts->threads);
+
+	free(s.slow);
+	free(bufs);
+
+	return (ret);
+}
@@ -0,0 +1,176 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "stats.h"
+
+#define COPY_LEN	(1024 * 1024)
+
+/******************************************************************************
+ * Copying.
+ ******************************************************************************/
+static bool
+write_all(int fd, const byte *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			warn("write");
+			return (false);
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return (true);
+}
+
+static bool
+read_all(int fd, byte *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = stats_read(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			warn("read");
+			return (false);
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return (true);
+}
+
+static bool
+duplicate(struct sha *ctx, int in, int out, byte *buf)
+{
+	ssize_t n;
+
+	// tee() copies pipe pages to the output without consuming them, so
+	// the one read left is the one the hash needs.
+	for (;;)
+	{
+		n = tee(in, out, COPY_LEN, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			warn("tee");
+			return (false);
+		}
+		if (n == 0)
+			return (true);
+
+		if (!read_all(in, buf, n) || !sha_update(ctx, buf, n))
+			return (false);
+	}
+}
+
+static bool
+copy(struct sha *ctx, int in, int out, byte *buf)
+{
+	ssize_t n;
+
+	// Anything but two pipes takes the usual read and write.
+	for (;;)
+	{
+		n = stats_read(in, buf, COPY_LEN);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			warn("read");
+			return (false);
+		}
+		if (n == 0)
+			return (true);
+
+		if (!sha_update(ctx, buf, n) || !write_all(out, buf, n))
+			return (false);
+	}
+}
+
+static bool
+is_pipe(int fd)
+{
+	struct stat st;
+
+	return (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+sha_tee(enum sha_type type, int in, int out, byte *hash)
+{
+	struct sha ctx;
+	bool result;
+	byte *buf;
+
+	if (!sha_init(&ctx, type))
+		return (false);
+
+	buf = malloc(COPY_LEN);
+	if (buf == NULL)
+	{
+		warn("malloc");
+		return (false);
+	}
+
+	if (is_pipe(in) && is_pipe(out))
+		result = duplicate(&ctx, in, out, buf);
+	else
+		result = copy(&ctx, in, out, buf);
+	free(buf);
+
+	return (result && sha_final(&ctx, hash));
+}
@@ -0,0 +1,235 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "testify.h"
+
+#define DATA_LEN	(9 * 1024 * 1024)
+#define SHIFT		100
+
+struct list
+{
+	struct chunk	*chunks;
+	size_t		 num;
+	size_t		 max;
+};
+
+static bool
+append(void *arg, const struct chunk *chunk)
+{
+	struct list *l;
+
+	l = arg;
+	if (l->num == l->max)
+		return (false);
+	l->chunks[l->num++] = *chunk;
+
+	return (true);
+}
+
+static bool
+collect(const struct chunk_opts *opts, const byte *data, size_t len, int fd,
+	struct list *l)
+{
+	l->max = len / opts->min + 1;
+	l->num = 0;
+	l->chunks = malloc(l->max * sizeof(*l->chunks));
+	if (l->chunks == NULL)
+		return (false);
+
+	if (fd < 0)
+		return (chunk_buf(opts, data, len, append, l));
+
+	return (chunk_fd(opts, fd, append, l));
+}
+
+static bool
+check_chunks(const struct chunk_opts *opts, const byte *data, size_t len,
+	     const struct list *l)
+{
+	byte hash[SHA_HASH];
+	word64 off;
+	size_t i;
+
+	// Chunks must tile the data, within the size limits, and each digest
+	// must match.
+	off = 0;
+	for (i = 0; i < l->num; i++)
+	{
+		if (l->chunks[i].offset != off ||
+		    l->chunks[i].len > opts->max ||
+		    (l->chunks[i].len < opts->min && i + 1 < l->num))
+		{
+			fprintf(stderr, "Chunk %zu at %ju has bad bounds.\n", i,
+				(uintmax_t) l->chunks[i].offset);
+			return (false);
+		}
+
+		sha_buf(opts->type, &data[off], l->chunks[i].len, hash);
+		if (memcmp(hash, l->chunks[i].hash,
+			   sha_hash_len(opts->type)) != 0)
+		{
+			fprintf(stderr, "Chunk %zu at %ju doesn't match.\n", i,
+				(uintmax_t) off);
+			return (false);
+		}
+
+		off += l->chunks[i].len;
+	}
+
+	if (off != len)
+	{
+		fprintf(stderr, "Chunks cover %ju of %zu bytes.\n",
+			(uintmax_t) off, len);
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+check_shift(const struct list *a, const struct list *b)
+{
+	size_t i, j, shared;
+
+	// Dropping bytes from the front only disturbs the first boundaries.
+	shared = 0;
+	for (i = j = 0; i < a->num && j < b->num;)
+	{
+		if (a->chunks[i].offset == b->chunks[j].offset + SHIFT)
+		{
+			if (memcmp(a->chunks[i].hash, b->chunks[j].hash,
+				   sha_hash_len(SHA256)) == 0)
+				shared++;
+			i++;
+			j++;
+		}
+		else if (a->chunks[i].offset < b->chunks[j].offset + SHIFT)
+			i++;
+		else
+			j++;
+	}
+
+	if (shared + 2 < a->num)
+	{
+		fprintf(stderr, "Only %zu of %zu chunks survived a shift.\n",
+			shared, a->num);
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+check_fd(const struct chunk_opts *opts, const byte *data,
+	 const struct list *expected)
+{
+	char path[] = "/tmp/testify.XXXXXX";
+	struct list l;
+	bool result;
+	size_t i;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		warn("mkstemp");
+		return (false);
+	}
+	unlink(path);
+
+	// Large enough that chunks straddle several reads.
+	result = false;
+	l.chunks = NULL;
+	if (write(fd, data, DATA_LEN) == DATA_LEN &&
+	    lseek(fd, 0, SEEK_SET) == 0 &&
+	    collect(opts, NULL, DATA_LEN, fd, &l))
+	{
+		result = (l.num == expected->num);
+		for (i = 0; result && i < l.num; i++)
+		{
+			result = (l.chunks[i].offset ==
+				  expected->chunks[i].offset &&
+				  l.chunks[i].len == expected->chunks[i].len &&
+				  memcmp(l.chunks[i].hash,
+					 expected->chunks[i].hash,
+					 sha_hash_len(opts->type)) == 0);
+		}
+		if (!result)
+			fprintf(stderr, "Chunks from a file don't match.\n");
+	}
+
+	free(l.chunks);
+	close(fd);
+
+	return (result);
+}
+
+bool
+test_chunk(void)
+{
+	struct chunk_opts opts;
+	struct list a, b;
+	word64 x;
+	bool result;
+	byte *data;
+	size_t i;
+
+	data = malloc(DATA_LEN);
+	if (data == NULL)
+		return (false);
+
+	x = 0x9e3779b97f4a7c15;
+	for (i = 0; i < DATA_LEN; i++)
+	{
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		data[i] = (x * 0x2545f4914f6cdd1d) >> 56;
+	}
+
+	a.chunks = b.chunks = NULL;
+	result = chunk_init(&opts, SHA256, CHUNK_AVG) &&
+	    collect(&opts, data, DATA_LEN, -1, &a) &&
+	    check_chunks(&opts, data, DATA_LEN, &a) &&
+	    collect(&opts, &data[SHIFT], DATA_LEN - SHIFT, -1, &b) &&
+	    check_chunks(&opts, &data[SHIFT], DATA_LEN - SHIFT, &b) &&
+	    check_shift(&a, &b) &&
+	    check_fd(&opts, data, &a);
+
+	free(a.chunks);
+	free(b.chunks);
+	free(data);
+
+	return (result);
+}
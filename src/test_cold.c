@@ -0,0 +1,135 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define MAX_LEN		(5 * 1024 * 1024 + 1)
+#define NUM_ENDS	2
+#define NUM_STARTS	2
+
+// Sizes around the alignment and the read size of the cold path.
+static const size_t sizes[] = {
+	0, 1, 4095, 4096, 4097, 1024 * 1024 - 1, 1024 * 1024,
+	1024 * 1024 + 1, 4 * 1024 * 1024, MAX_LEN
+};
+
+static const int num_sizes = sizeof(sizes) / sizeof(size_t);
+
+// One start on a block and one inside it, which can't be read directly.
+static const off_t starts[NUM_STARTS] = { 8192, 1000 };
+
+// A file for the readers, then one short enough to be read at once.
+static const off_t ends[NUM_ENDS] = { MAX_LEN, 64 * 1024 };
+
+bool
+test_cold(void)
+{
+	byte expected[SHA_HASH], hash[SHA_HASH], *data;
+	char path[] = "/var/tmp/testify.XXXXXX";
+	off_t end, start;
+	bool result;
+	size_t j;
+	int fd, i;
+
+	data = malloc(MAX_LEN);
+	if (data == NULL)
+		return (false);
+	for (j = 0; j < MAX_LEN; j++)
+		data[j] = j * 7 + (j >> 12);
+
+	// /tmp is often tmpfs, which may refuse O_DIRECT and only exercise
+	// the fallback.
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		warn("mkstemp");
+		free(data);
+		return (false);
+	}
+	unlink(path);
+
+	result = true;
+	for (i = 0; result && i < num_sizes; i++)
+	{
+		if (ftruncate(fd, 0) != 0 ||
+		    pwrite(fd, data, sizes[i], 0) != sizes[i] ||
+		    fsync(fd) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+		{
+			warn("%s", path);
+			result = false;
+			break;
+		}
+
+		sha_buf(SHA256, data, sizes[i], expected);
+		if (!sha_cold(SHA256, fd, hash) ||
+		    memcmp(hash, expected, sha_hash_len(SHA256)) != 0)
+		{
+			fprintf(stderr, "Cold sum of %zu bytes doesn't "
+				"match.\n", sizes[i]);
+			result = false;
+		}
+	}
+
+	// Hashing starts at the current offset and ends at the end of the
+	// file, like reading it would.
+	for (i = 0; result && i < NUM_ENDS * NUM_STARTS; i++)
+	{
+		end = ends[i / NUM_STARTS];
+		start = starts[i % NUM_STARTS];
+		if (ftruncate(fd, end) != 0 ||
+		    lseek(fd, start, SEEK_SET) != start)
+		{
+			warn("%s", path);
+			result = false;
+			break;
+		}
+
+		sha_buf(SHA256, &data[start], end - start, expected);
+		if (!sha_cold(SHA256, fd, hash) ||
+		    memcmp(hash, expected, sha_hash_len(SHA256)) != 0 ||
+		    lseek(fd, 0, SEEK_CUR) != end)
+		{
+			fprintf(stderr, "Cold sum of %jd bytes from offset %jd "
+				"doesn't match.\n", (intmax_t) end,
+				(intmax_t) start);
+			result = false;
+		}
+	}
+
+	close(fd);
+	free(data);
+
+	return (result);
+}
@@ -0,0 +1,181 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dupes.h"
+#include "testify.h"
+
+#define BIG_LEN		(64 * 1024)
+#define THREADS		3
+
+struct file
+{
+	const char	*name;
+	size_t		 len;
+	size_t		 flip;
+	size_t		 group;
+};
+
+// Duplicates are listed in the order they should be reported.
+static const struct file files[] = {
+	{ "empty1", 0,       SIZE_MAX,    SIZE_MAX },
+	{ "empty2", 0,       SIZE_MAX,    SIZE_MAX },
+	{ "small1", 100,     SIZE_MAX,    0 },
+	{ "small2", 100,     SIZE_MAX,    0 },
+	{ "small3", 100,     99,          SIZE_MAX },
+	{ "big1",   BIG_LEN, SIZE_MAX,    1 },
+	{ "big2",   BIG_LEN, SIZE_MAX,    1 },
+	{ "head",   BIG_LEN, 0,           SIZE_MAX },
+	{ "middle", BIG_LEN, BIG_LEN / 2, SIZE_MAX }
+};
+
+static const int num_files = sizeof(files) / sizeof(struct file);
+
+static bool
+build(const char *root)
+{
+	static byte buf[BIG_LEN];
+	char path[PATH_MAX];
+	int fd, i;
+	size_t j;
+
+	for (i = 0; i < num_files; i++)
+	{
+		// Files differ from the common pattern in at most one byte.
+		for (j = 0; j < files[i].len; j++)
+			buf[j] = j * 7;
+		if (files[i].flip != SIZE_MAX)
+			buf[files[i].flip] ^= 1;
+
+		snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0)
+			return (false);
+		if (write(fd, buf, files[i].len) != files[i].len)
+		{
+			close(fd);
+			return (false);
+		}
+		close(fd);
+	}
+
+	return (true);
+}
+
+static void
+destroy(const char *root)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < num_files; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+		unlink(path);
+	}
+	rmdir(root);
+}
+
+static bool
+check(const char *root)
+{
+	struct tree_entry *entries;
+	size_t i, num, num_dupes;
+	char path[PATH_MAX];
+	struct tree_opts opts;
+	struct dupe *dupes;
+	bool result;
+	int j;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.threads = THREADS;
+	if (!tree_hash(root, &opts, &entries, &num))
+		return (false);
+	if (!dupes_find(SHA256, entries, num, THREADS, &dupes, &num_dupes))
+	{
+		tree_free(entries, num);
+		return (false);
+	}
+
+	// Walk the expected duplicates in report order.
+	result = true;
+	i = 0;
+	for (j = 0; j < num_files; j++)
+	{
+		if (files[j].group == SIZE_MAX)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", root, files[j].name);
+		if (i >= num_dupes ||
+		    strcmp(dupes[i].entry->path, path) != 0 ||
+		    dupes[i].group != files[j].group)
+		{
+			fprintf(stderr, "Expected %s in group %zu.\n", path,
+				files[j].group);
+			result = false;
+			break;
+		}
+		i++;
+	}
+	if (result && i != num_dupes)
+	{
+		fprintf(stderr, "Expected %zu duplicates, got %zu.\n", i,
+			num_dupes);
+		result = false;
+	}
+
+	free(dupes);
+	tree_free(entries, num);
+
+	return (result);
+}
+
+bool
+test_dupes(void)
+{
+	char root[] = "/tmp/testify.XXXXXX";
+	bool result;
+
+	if (mkdtemp(root) == NULL)
+	{
+		warn("mkdtemp");
+		return (false);
+	}
+
+	result = build(root) && check(root);
+	destroy(root);
+
+	return (result);
+}
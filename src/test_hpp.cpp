@@ -0,0 +1,160 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+
+#include "sha.hpp"
+
+extern "C"
+{
+#include "testify.h"
+}
+
+static constexpr std::string_view text =
+	"The quick brown fox jumps over the lazy dog, then doubles back "
+	"to jump over the dog again, and once more for good measure, so "
+	"that this sentence fills nearly three SHA-256 blocks of input.";
+
+// Lengths on either side of each padding boundary.
+static constexpr std::size_t lens[] = {
+	0, 1, 3, 55, 56, 63, 64, 65, 111, 112, 119, 127, 128, 129, 160,
+	text.size()
+};
+
+static constexpr std::size_t num_lens = sizeof(lens) / sizeof(lens[0]);
+
+static_assert(text.size() > 160);
+
+// The FIPS 180-2 one- and two-block examples.
+static constexpr std::string_view two_block_32 =
+	"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static constexpr std::string_view two_block_64 =
+	"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+	"hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+
+static_assert(two_block_32.size() == 56 && two_block_64.size() == 112);
+
+template <std::size_t L>
+static constexpr shapp::digest<(L - 1) / 2>
+hex(const char (&s)[L])
+{
+	shapp::digest<(L - 1) / 2> out = {};
+
+	auto nibble = [](char c)
+	{
+		return ((c <= '9') ? (c - '0') : (c - 'a' + 10));
+	};
+
+	for (std::size_t i = 0; i < out.size(); i++)
+		out[i] = nibble(s[2 * i]) << 4 | nibble(s[2 * i + 1]);
+
+	return (out);
+}
+
+// Every digest is checked in full by the compiler.
+static_assert(shapp::sha1("abc") ==
+	      hex("a9993e364706816aba3e25717850c26c9cd0d89d"));
+static_assert(shapp::sha1(two_block_32) ==
+	      hex("84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+static_assert(shapp::sha224("abc") ==
+	      hex("23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7"));
+static_assert(shapp::sha224(two_block_32) ==
+	      hex("75388b16512776cc5dba5da1fd890150b0c6455cb4f58b1952522525"));
+static_assert(shapp::sha256("abc") ==
+	      hex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61"
+		  "f20015ad"));
+static_assert(shapp::sha256(two_block_32) ==
+	      hex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd4"
+		  "19db06c1"));
+static_assert(shapp::sha384("abc") ==
+	      hex("cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a"
+		  "43ff5bed8086072ba1e7cc2358baeca134c825a7"));
+static_assert(shapp::sha384(two_block_64) ==
+	      hex("09330c33f71147e83d192fc782cd1b4753111b173b3b05d22fa08086"
+		  "e3b0f712fcc7c71a557e2db966c3e9fa91746039"));
+static_assert(shapp::sha512("abc") ==
+	      hex("ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee6"
+		  "4b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e"
+		  "2a9ac94fa54ca49f"));
+static_assert(shapp::sha512(two_block_64) ==
+	      hex("8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aead"
+		  "b6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd2654"
+		  "5e96e55b874be909"));
+static_assert(shapp::sha512_224("abc") ==
+	      hex("4634270f707b6a54daae7530460842e20e37ed265ceee9a43e8924aa"));
+static_assert(shapp::sha512_224(two_block_64) ==
+	      hex("23fec5bb94d60b23308192640b0c453335d664734fe40e7268674af9"));
+static_assert(shapp::sha512_256("abc") ==
+	      hex("53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f131"
+		  "07e7af23"));
+static_assert(shapp::sha512_256(two_block_64) ==
+	      hex("3928e184fb8690f840da3988121d31be65cb9d3ef83ee6146feac861"
+		  "e19b563a"));
+
+template <auto F>
+static bool
+check(const char *name)
+{
+	// Every digest here is computed at compile time.
+	constexpr auto expected = []
+	{
+		std::array<decltype(F(text)), num_lens> a = {};
+
+		for (std::size_t i = 0; i < num_lens; i++)
+			a[i] = F(text.substr(0, lens[i]));
+
+		return (a);
+	}();
+	bool result = true;
+
+	for (std::size_t i = 0; i < num_lens; i++)
+	{
+		auto got = F(text.substr(0, lens[i]));
+
+		if (got != expected[i])
+		{
+			fprintf(stderr, "%s: Runtime hash of %zu bytes differs "
+				"from constexpr.\n", name, lens[i]);
+			result = false;
+		}
+	}
+
+	return (result);
+}
+
+bool
+test_hpp(void)
+{
+	return (check<shapp::sha1>("SHA-1") &&
+		check<shapp::sha224>("SHA-224") &&
+		check<shapp::sha256>("SHA-256") &&
+		check<shapp::sha384>("SHA-384") &&
+		check<shapp::sha512>("SHA-512") &&
+		check<shapp::sha512_224>("SHA-512/224") &&
+		check<shapp::sha512_256>("SHA-512/256"));
+}
@@ -0,0 +1,425 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define BATCH_LEN	(16 * SHA64_BLK)
+#define LONG_BLOCKS	8
+#define MAX_BATCH	40
+#define MAX_LEN		(3 * SHA64_BLK)
+#define MAX_SPLITS	4
+#define NUM_BATCHES	32
+#define NUM_RANDOM	64
+#define RANDOM_LEN	(16 * 1024)
+#define SEED		0x9e3779b97f4a7c15
+
+static const enum sha_type types[] = {
+	SHA1, SHA224, SHA256, SHA384, SHA512, SHA512_224, SHA512_256
+};
+
+static const int num_types = sizeof(types) / sizeof(enum sha_type);
+
+static uint64_t state;
+
+/******************************************************************************
+ * Random messages.
+ ******************************************************************************/
+static uint64_t
+next(void)
+{
+	// Xorshift64*, so runs are reproducible from the seed.
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1d);
+}
+
+static void
+fill(byte *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = next();
+}
+
+/******************************************************************************
+ * Digest paths.
+ ******************************************************************************/
+static bool
+reference(enum sha_type type, const byte *msg, size_t len, byte *hash)
+{
+	struct sha ctx;
+	size_t num;
+
+	if (!sha_init(&ctx, type))
+		return (false);
+
+	// Feed whole blocks through the original block interface.
+	do
+	{
+		switch (type)
+		{
+		case SHA1:
+		case SHA224:
+		case SHA256:
+			num = (len < SHA32_BLK) ? (len) : (SHA32_BLK);
+			memcpy(ctx.ctx.s32.block.bytes, msg, num);
+			if (!sha32_add(&ctx.ctx.s32, num))
+				return (false);
+			break;
+
+		default:
+			num = (len < SHA64_BLK) ? (len) : (SHA64_BLK);
+			memcpy(ctx.ctx.s64.block.bytes, msg, num);
+			if (!sha64_add(&ctx.ctx.s64, num))
+				return (false);
+			break;
+		}
+
+		msg += num;
+		len -= num;
+	} while (len > 0);
+
+	return (sha_final(&ctx, hash));
+}
+
+static bool
+split(enum sha_type type, const byte *msg, size_t len, byte *hash)
+{
+	int i, num_splits;
+	struct sha ctx;
+	size_t num;
+
+	if (!sha_init(&ctx, type))
+		return (false);
+
+	// Stream the message in at random split points.
+	num_splits = next() % (MAX_SPLITS + 1);
+	for (i = 0; i < num_splits && len > 0; i++)
+	{
+		num = next() % (len + 1);
+		if (!sha_update(&ctx, msg, num))
+			return (false);
+
+		msg += num;
+		len -= num;
+	}
+
+	if (!sha_update(&ctx, msg, len))
+		return (false);
+
+	return (sha_final(&ctx, hash));
+}
+
+static bool
+check_kernel(enum sha_type type, const byte *msg, size_t len,
+	     const byte *expected)
+{
+	char hex[2 * SHA_HASH + 1];
+	size_t hash_len, num;
+	byte hash[SHA_HASH];
+	struct sha prefix;
+	const char *path;
+	int i;
+
+	// Compare each path against the reference.
+	hash_len = sha_hash_len(type);
+	path = "one-shot";
+	if (!sha_buf(type, msg, len, hash) ||
+	    memcmp(hash, expected, hash_len) != 0)
+		goto mismatch;
+
+	path = "split";
+	if (!split(type, msg, len, hash) ||
+	    memcmp(hash, expected, hash_len) != 0)
+		goto mismatch;
+
+	// The prefix context must survive being resumed twice.
+	path = "prefixed";
+	num = next() % (len + 1);
+	if (!sha_init(&prefix, type) || !sha_update(&prefix, msg, num))
+		goto mismatch;
+	for (i = 0; i < 2; i++)
+	{
+		if (!sha_prefixed(&prefix, msg + num, len - num, hash) ||
+		    memcmp(hash, expected, hash_len) != 0)
+			goto mismatch;
+	}
+
+	return (true);
+
+mismatch:
+	sha_hex(hash, hash_len, hex);
+	fprintf(stderr, "%s: Sum (%s) of %zu bytes via %s %s doesn't match.\n",
+		sha_name(type), hex, len, sha_kernel(type)->name, path);
+
+	return (false);
+}
+
+static bool
+check(enum sha_type type, const byte *msg, size_t len)
+{
+	const struct sha_kernel *kernels;
+	byte expected[SHA_HASH];
+	int i, num_kernels;
+	bool ref, result;
+
+	// The reference is the generic kernel through the block interface.
+	ref = sha_kernel_select(type, "generic") &&
+	      reference(type, msg, len, expected);
+	if (!ref)
+		fprintf(stderr, "%s: No reference sum for %zu bytes.\n",
+			sha_name(type), len);
+
+	// Try every supported kernel for this algorithm.
+	result = ref;
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; ref && i < num_kernels; i++)
+	{
+		if (!sha_kernel_select(type, kernels[i].name) ||
+		    sha_kernel(type) != &kernels[i])
+			continue;
+
+		if (!check_kernel(type, msg, len, expected))
+			result = false;
+	}
+
+	sha_kernel_reset(type);
+
+	return (result);
+}
+
+static bool
+check_batch(enum sha_type type, byte *buf)
+{
+	byte expected[MAX_BATCH * SHA_HASH], hashes[MAX_BATCH * SHA_HASH];
+	const struct sha_kernel *kernels;
+	struct sha_msg msgs[MAX_BATCH];
+	int i, num, num_kernels;
+	size_t hash_len, len;
+	bool ref, result;
+
+	// Build a batch mixing short messages around the padding boundaries
+	// with longer ones, sometimes all of one length.
+	hash_len = sha_hash_len(type);
+	num = 1 + next() % MAX_BATCH;
+	len = (next() % 4 == 0) ? (next() % (BATCH_LEN + 1)) : (SIZE_MAX);
+	for (i = 0; i < num; i++)
+	{
+		msgs[i].data = &buf[i * BATCH_LEN];
+		if (len != SIZE_MAX)
+			msgs[i].len = len;
+		else if (next() % 2 == 0)
+			msgs[i].len = next() % (MAX_LEN + 1);
+		else
+			msgs[i].len = next() % (BATCH_LEN + 1);
+		fill(&buf[i * BATCH_LEN], msgs[i].len);
+	}
+
+	// The reference is the generic kernel through the block interface.
+	ref = sha_kernel_select(type, "generic");
+	for (i = 0; ref && i < num; i++)
+	{
+		if (!reference(type, msgs[i].data, msgs[i].len,
+			       &expected[i * hash_len]))
+			ref = false;
+	}
+
+	// Try every supported kernel for this algorithm.
+	result = ref;
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; ref && i < num_kernels; i++)
+	{
+		if (!sha_kernel_select(type, kernels[i].name) ||
+		    sha_kernel_many(type) != &kernels[i])
+			continue;
+
+		if (!sha_many(type, msgs, num, hashes) ||
+		    memcmp(hashes, expected, num * hash_len) != 0)
+		{
+			fprintf(stderr, "%s: Batch of %d via %s doesn't "
+				"match.\n", sha_name(type), num,
+				kernels[i].name);
+			result = false;
+		}
+	}
+
+	sha_kernel_reset(type);
+
+	return (result);
+}
+
+static bool
+check_lanes(enum sha_type type, byte *buf)
+{
+	struct sha_msg msgs[1 + (SHA_LANES - 1) * LONG_BLOCKS];
+	byte hash[SHA_HASH], hashes[sizeof(msgs) / sizeof(*msgs) * SHA_HASH];
+	const struct sha_kernel *kernels;
+	int i, j, num, num_kernels;
+	struct sha_stats st;
+	size_t blk, hash_len;
+	bool result;
+
+	// One long message, and enough one-block messages to keep every
+	// other lane busy beside it.
+	blk = (type <= SHA256) ? (SHA32_BLK) : (SHA64_BLK);
+	hash_len = sha_hash_len(type);
+	fill(buf, LONG_BLOCKS * blk);
+
+	result = true;
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; i < num_kernels; i++)
+	{
+		if (kernels[i].lanes == 1 ||
+		    !sha_kernel_select(type, kernels[i].name) ||
+		    sha_kernel_many(type) != &kernels[i])
+			continue;
+
+		num = 1 + (kernels[i].lanes - 1) * LONG_BLOCKS;
+		msgs[0].data = buf;
+		msgs[0].len = (LONG_BLOCKS - 1) * blk;
+		for (j = 1; j < num; j++)
+		{
+			msgs[j].data = &buf[j];
+			msgs[j].len = j % (blk / 2);
+		}
+
+		// Lanes that drain are refilled, so no lane ever idles.
+		sha_stats_reset();
+		sha_stats_enable(true);
+		if (!sha_many(type, msgs, num, hashes))
+			result = false;
+		sha_stats_enable(false);
+		sha_stats_get(&st);
+		if (st.blocks != kernels[i].lanes * LONG_BLOCKS)
+		{
+			fprintf(stderr, "%s: %s compressed %llu blocks for "
+				"%d.\n", sha_name(type), kernels[i].name,
+				(unsigned long long) st.blocks,
+				kernels[i].lanes * LONG_BLOCKS);
+			result = false;
+		}
+
+		for (j = 0; result && j < num; j++)
+		{
+			if (!sha_buf(type, msgs[j].data, msgs[j].len, hash) ||
+			    memcmp(hash, &hashes[j * hash_len],
+				   hash_len) != 0)
+			{
+				fprintf(stderr, "%s: %s hashed message %d "
+					"wrong.\n", sha_name(type),
+					kernels[i].name, j);
+				result = false;
+			}
+		}
+	}
+
+	sha_stats_reset();
+	sha_kernel_reset(type);
+
+	return (result);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+test_kernels(void)
+{
+	const struct sha_kernel *kernel, *kernel_many;
+	int failed, i, j;
+	const char *env;
+	size_t len;
+	byte *msg;
+
+	// Allow a failing run to be reproduced.
+	env = getenv("TESTIFY_SEED");
+	state = (env != NULL) ? (strtoull(env, NULL, 0)) : (SEED);
+	if (state == 0)
+		state = SEED;
+	fprintf(stderr, "Seed is 0x%016llx.\n", (unsigned long long) state);
+
+	msg = malloc(MAX_BATCH * BATCH_LEN);
+	if (msg == NULL)
+		return (false);
+
+	failed = 0;
+	for (i = 0; i < num_types; i++)
+	{
+		kernel = sha_kernel(types[i]);
+		kernel_many = sha_kernel_many(types[i]);
+
+		// Every length across the block and padding boundaries.
+		for (len = 0; len <= MAX_LEN; len++)
+		{
+			fill(msg, len);
+			if (!check(types[i], msg, len))
+				failed++;
+		}
+
+		// Longer messages of random length.
+		for (j = 0; j < NUM_RANDOM; j++)
+		{
+			len = next() % (RANDOM_LEN + 1);
+			fill(msg, len);
+			if (!check(types[i], msg, len))
+				failed++;
+		}
+
+		// Random mixes of messages through the batch interface.
+		for (j = 0; j < NUM_BATCHES; j++)
+		{
+			if (!check_batch(types[i], msg))
+				failed++;
+		}
+
+		if (!check_lanes(types[i], msg))
+			failed++;
+
+		// Each check leaves the startup kernels selected.
+		if (sha_kernel(types[i]) != kernel ||
+		    sha_kernel_many(types[i]) != kernel_many)
+		{
+			fprintf(stderr, "%s: Startup kernels weren't "
+				"restored.\n", sha_name(types[i]));
+			failed++;
+		}
+	}
+
+	free(msg);
+
+	fprintf(stderr, "%d mismatches.\n", failed);
+
+	return (failed == 0);
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "merkle.h"
+#include "testify.h"
+
+#define BIG_NUM		10001
+#define MAX_NUM		70
+
+// Build a level the slow way, one pair at a time.
+static size_t
+reference(const byte *in, size_t width, bool duplicate, byte *out)
+{
+	byte pair[2 * SHA32_HASH];
+	size_t i;
+
+	for (i = 0; i + 1 < width; i += 2)
+		sha_buf(SHA256, &in[i * SHA32_HASH], sizeof(pair),
+			&out[i / 2 * SHA32_HASH]);
+
+	if (width % 2 == 1)
+	{
+		memcpy(pair, &in[(width - 1) * SHA32_HASH], SHA32_HASH);
+		memcpy(&pair[SHA32_HASH], pair, SHA32_HASH);
+		if (duplicate)
+			sha_buf(SHA256, pair, sizeof(pair),
+				&out[width / 2 * SHA32_HASH]);
+		else
+			memcpy(&out[width / 2 * SHA32_HASH], pair,
+			       SHA32_HASH);
+	}
+
+	return ((width + 1) / 2);
+}
+
+static bool
+check(const byte *leaves, size_t num, const struct merkle_opts *opts)
+{
+	byte *levels[2];
+	struct merkle tree;
+	size_t width;
+	bool result;
+	int level;
+
+	levels[0] = malloc(num * SHA32_HASH);
+	levels[1] = malloc(num * SHA32_HASH);
+	if (levels[0] == NULL || levels[1] == NULL)
+	{
+		free(levels[0]);
+		free(levels[1]);
+		return (false);
+	}
+
+	if (!merkle_build(leaves, num, opts, &tree))
+	{
+		free(levels[0]);
+		free(levels[1]);
+		return (false);
+	}
+
+	// Compare every kept level, or just the root.
+	result = true;
+	memcpy(levels[0], leaves, num * SHA32_HASH);
+	for (level = 0, width = num; width > 1; level++)
+	{
+		width = reference(levels[level % 2], width, opts->duplicate,
+				  levels[(level + 1) % 2]);
+		if (tree.widths[level + 1] != width ||
+		    (opts->keep &&
+		     memcmp(tree.levels[level + 1], levels[(level + 1) % 2],
+			    width * SHA32_HASH) != 0))
+			result = false;
+	}
+	if (tree.num_levels != level + 1 ||
+	    memcmp(tree.root, levels[level % 2], SHA32_HASH) != 0)
+		result = false;
+
+	if (!result)
+		fprintf(stderr, "Tree of %zu leaves doesn't match.\n", num);
+
+	merkle_free(&tree);
+	free(levels[0]);
+	free(levels[1]);
+
+	return (result);
+}
+
+bool
+test_merkle(void)
+{
+	const struct sha_kernel *kernels;
+	struct merkle_opts opts;
+	int i, num_kernels;
+	struct merkle tree;
+	bool result;
+	size_t num;
+	byte *leaves;
+
+	leaves = malloc(BIG_NUM * SHA32_HASH);
+	if (leaves == NULL)
+		return (false);
+	for (num = 0; num < BIG_NUM * SHA32_HASH; num++)
+		leaves[num] = num * 11 + (num >> 9);
+
+	// An empty tree has no root.
+	memset(&opts, 0, sizeof(opts));
+	result = !merkle_build(leaves, 0, &opts, &tree);
+
+	// Small trees on every kernel cover odd nodes at each level, and a
+	// larger one covers runs split across threads.
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; i < num_kernels; i++)
+	{
+		if (kernels[i].type != SHA256 ||
+		    !sha_kernel_select(SHA256, kernels[i].name))
+			continue;
+
+		for (num = 1; num <= MAX_NUM; num++)
+		{
+			opts.threads = 1;
+			opts.duplicate = (num % 2 == 0);
+			opts.keep = (num % 3 == 0);
+			if (!check(leaves, num, &opts))
+				result = false;
+		}
+
+		opts.threads = 3;
+		opts.duplicate = true;
+		opts.keep = true;
+		if (!check(leaves, BIG_NUM, &opts))
+			result = false;
+	}
+
+	sha_kernel_reset(SHA256);
+	free(leaves);
+
+	return (result);
+}
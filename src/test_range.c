@@ -0,0 +1,144 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	(1024 * 1024 + 17)
+#define NUM_RANGES	64
+#define THREADS		4
+
+struct ranges
+{
+	int		 fd;
+	const byte	*data;
+	off_t		 off[NUM_RANGES];
+	off_t		 len[NUM_RANGES];
+	bool		 ok[NUM_RANGES];
+};
+
+static void
+check_range(void *arg, size_t index)
+{
+	byte expected[SHA_HASH], hash[SHA_HASH];
+	struct ranges *r;
+
+	r = arg;
+	sha_buf(SHA256, &r->data[r->off[index]], r->len[index], expected);
+	r->ok[index] = (sha_range(SHA256, r->fd, r->off[index], r->len[index],
+				  hash) &&
+			memcmp(hash, expected, sha_hash_len(SHA256)) == 0);
+}
+
+bool
+test_range(void)
+{
+	char path[] = "/tmp/testify.XXXXXX";
+	byte hash[SHA_HASH], *data;
+	struct ranges r;
+	bool result;
+	word64 x;
+	size_t i;
+
+	data = malloc(DATA_LEN);
+	if (data == NULL)
+		return (false);
+
+	x = 0x9e3779b97f4a7c15;
+	for (i = 0; i < DATA_LEN; i++)
+	{
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		data[i] = (x * 0x2545f4914f6cdd1d) >> 56;
+	}
+
+	r.fd = mkstemp(path);
+	if (r.fd < 0)
+	{
+		warn("mkstemp");
+		free(data);
+		return (false);
+	}
+	unlink(path);
+
+	// Ranges of every size, including empty ones and the final byte.
+	r.data = data;
+	for (i = 0; i < NUM_RANGES; i++)
+	{
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		r.off[i] = (x >> 16) % DATA_LEN;
+		r.len[i] = (x >> 40) % (DATA_LEN - r.off[i] + 1);
+	}
+	r.off[0] = DATA_LEN - 1;
+	r.len[0] = 1;
+	r.off[1] = DATA_LEN;
+	r.len[1] = 0;
+
+	result = (write(r.fd, data, DATA_LEN) == DATA_LEN &&
+		  lseek(r.fd, 0, SEEK_SET) == 0);
+
+	// Hash every range at once from several threads sharing the fd.
+	if (result)
+		pool_run(check_range, &r, NUM_RANGES, THREADS);
+	for (i = 0; result && i < NUM_RANGES; i++)
+	{
+		if (!r.ok[i])
+		{
+			fprintf(stderr, "Range of %ju bytes at %ju doesn't "
+				"match.\n", (uintmax_t) r.len[i],
+				(uintmax_t) r.off[i]);
+			result = false;
+		}
+	}
+
+	// The shared offset is untouched, and ranges past the end fail.
+	if (result && lseek(r.fd, 0, SEEK_CUR) != 0)
+	{
+		fprintf(stderr, "File offset moved.\n");
+		result = false;
+	}
+	if (result && sha_range(SHA256, r.fd, DATA_LEN - 1, 2, hash))
+	{
+		fprintf(stderr, "Range past the end of file succeeded.\n");
+		result = false;
+	}
+
+	close(r.fd);
+	free(data);
+
+	return (result);
+}
@@ -0,0 +1,114 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	(4 * SHA32_BLK)
+#define NUM_MSGS	37
+
+static void
+reference(const byte *data, size_t len, byte *hash)
+{
+	byte first[SHA32_HASH];
+
+	sha_buf(SHA256, data, len, first);
+	sha_buf(SHA256, first, sizeof(first), hash);
+}
+
+static bool
+check(const char *name, const byte *data)
+{
+	byte expected[NUM_MSGS * SHA32_HASH], hashes[NUM_MSGS * SHA32_HASH];
+	struct sha_msg msgs[NUM_MSGS];
+	bool result;
+	size_t len;
+	int i;
+
+	result = true;
+	for (len = 0; len <= DATA_LEN; len++)
+	{
+		reference(data, len, expected);
+		if (!sha256d(data, len, hashes) ||
+		    memcmp(hashes, expected, SHA32_HASH) != 0)
+		{
+			fprintf(stderr, "SHA-256d of %zu bytes via %s doesn't "
+				"match.\n", len, name);
+			result = false;
+		}
+	}
+
+	// An odd count leaves idle lanes in the last group.
+	for (i = 0; i < NUM_MSGS; i++)
+	{
+		msgs[i].data = &data[i];
+		msgs[i].len = (i * 29) % (DATA_LEN - NUM_MSGS);
+		reference(msgs[i].data, msgs[i].len, &expected[i * SHA32_HASH]);
+	}
+	if (!sha256d_many(msgs, NUM_MSGS, hashes) ||
+	    memcmp(hashes, expected, sizeof(expected)) != 0)
+	{
+		fprintf(stderr, "SHA-256d batch via %s doesn't match.\n",
+			name);
+		result = false;
+	}
+
+	return (result);
+}
+
+bool
+test_sha256d(void)
+{
+	const struct sha_kernel *kernels;
+	byte data[DATA_LEN];
+	int i, num_kernels;
+	bool result;
+
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = i * 7 + (i >> 5);
+
+	// Both the specialized generic pass and the padding block path are
+	// exercised, in streams and batches.
+	result = true;
+	kernels = sha_kernels(&num_kernels);
+	for (i = 0; i < num_kernels; i++)
+	{
+		if (kernels[i].type != SHA256 ||
+		    !sha_kernel_select(SHA256, kernels[i].name))
+			continue;
+
+		if (!check(kernels[i].name, data))
+			result = false;
+	}
+
+	sha_kernel_reset(SHA256);
+
+	return (result);
+}
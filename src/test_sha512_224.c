@@ -0,0 +1,67 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "test_sums.h"
+#include "testify.h"
+
+static struct test_pair tests[] = {
+	// FIPS-180-4.
+	{
+		"tests/fips-180-2/24-bit_message",
+		"4634270f707b6a54daae7530460842e20e37ed265ceee9a43e8924aa"
+	},
+	{
+		"tests/fips-180-2/896-bit_message",
+		"23fec5bb94d60b23308192640b0c453335d664734fe40e7268674af9"
+	},
+	{
+		"tests/fips-180-2/8000000-bit_message",
+		"37ab331d76f0d36de422bd0edeb22a28accd487b7a8453ae965dd287"
+	},
+
+	// Wikipedia.
+	{
+		"tests/wikipedia/empty",
+		"6ed0dd02806fa89e25de060c19d3ac86cabb87d6a0ddd05c333b84f4"
+	},
+	{
+		"tests/wikipedia/lazy_cog",
+		"2b9d6565a7e40f780ba8ab7c8dcf41e3ed3b77997f4c55aa987eede5"
+	},
+	{
+		"tests/wikipedia/lazy_dog",
+		"944cd2847fb54558d4775db0485a50003111c8e5daa63fe722c6aa37"
+	}
+};
+
+static const int num_tests = sizeof(tests) / sizeof(struct test_pair);
+
+bool
+test_sha512_224(void)
+{
+	return test_sums(sha512_224, tests, num_tests);
+}
@@ -0,0 +1,344 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shad.h"
+#include "testify.h"
+
+#define DATA_LEN	(64 * 1024)
+#define NUM_CLIENTS	2
+#define NUM_REQS	300
+#define NUM_TYPES	(SHA512_256 + 1)
+#define SMALL_LEN	4096
+
+struct server
+{
+	int	sock;
+	int	stop;
+	bool	result;
+};
+
+static void *
+serve(void *arg)
+{
+	struct server *srv = arg;
+
+	srv->result = shad_serve(srv->sock, srv->stop);
+
+	return (NULL);
+}
+
+static bool
+check(const struct shad_resp *resp, word32 id, enum sha_type type,
+      const byte *data, size_t len)
+{
+	byte hash[SHA_HASH];
+
+	if (resp->id != id || resp->status != SHAD_OK ||
+	    resp->len != sha_hash_len(type))
+		return (false);
+
+	sha_buf(type, data, len, hash);
+
+	return (memcmp(resp->hash, hash, resp->len) == 0);
+}
+
+// The daemon runs in this process, so descriptors it leaks show up here.
+static int
+count_fds(void)
+{
+	struct dirent *ent;
+	DIR *dir;
+	int num;
+
+	dir = opendir("/proc/self/fd");
+	if (dir == NULL)
+		return (-1);
+
+	for (num = 0; (ent = readdir(dir)) != NULL; num++)
+		;
+	closedir(dir);
+
+	return (num);
+}
+
+// Requests and descriptors go out in one message, so the daemon reads
+// them in the same round.
+static bool
+send_fds(int fd, const struct shad_req *reqs, int num_reqs, const int *fds,
+	 int num_fds)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+
+	iov.iov_base = (void *) reqs;
+	iov.iov_len = num_reqs * sizeof(*reqs);
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+	return (sendmsg(fd, &msg, 0) == iov.iov_len);
+}
+
+static bool
+exercise(int fds[NUM_CLIENTS], const byte *data)
+{
+	struct shad_req req, reqs[2];
+	struct shad_resp resp;
+	int fds2[2], i, j, num, small;
+	bool ok;
+
+	// Both clients queue everything before reading, so requests of
+	// several types and clients land in the same batches.
+	memset(&req, 0, sizeof(req));
+	for (i = 0; i < NUM_REQS; i++)
+	{
+		for (j = 0; j < NUM_CLIENTS; j++)
+		{
+			req.id = i;
+			req.op = (i % 2 == j) ? (SHAD_HASH) : (SHAD_SHM);
+			req.type = (i + j) % NUM_TYPES;
+			req.len = (i * 37 + j) % 300;
+			req.offset = (i * 101) % (DATA_LEN - req.len);
+			if (!shad_send(fds[j], &req, &data[req.offset]))
+				return (false);
+		}
+	}
+
+	for (i = 0; i < NUM_REQS; i++)
+	{
+		for (j = 0; j < NUM_CLIENTS; j++)
+		{
+			req.len = (i * 37 + j) % 300;
+			req.offset = (i * 101) % (DATA_LEN - req.len);
+			if (!shad_recv(fds[j], &resp) ||
+			    !check(&resp, i, (i + j) % NUM_TYPES,
+				   &data[req.offset], req.len))
+			{
+				fprintf(stderr, "Request %d from client %d "
+					"failed.\n", i, j);
+				return (false);
+			}
+		}
+	}
+
+	// Unknown algorithms and payloads outside the mapping are refused.
+	req.id = 1000;
+	req.op = SHAD_HASH;
+	req.type = NUM_TYPES;
+	req.len = 1;
+	req.offset = 0;
+	if (!shad_send(fds[0], &req, data) || !shad_recv(fds[0], &resp) ||
+	    resp.id != 1000 || resp.status != SHAD_INVALID)
+		return (false);
+
+	req.id = 1001;
+	req.op = SHAD_SHM;
+	req.type = SHA256;
+	req.offset = DATA_LEN;
+	if (!shad_send(fds[1], &req, NULL) || !shad_recv(fds[1], &resp) ||
+	    resp.id != 1001 || resp.status != SHAD_INVALID)
+		return (false);
+
+	// A descriptor shorter than the claimed length is not mapped, and
+	// the previous mapping stays in place.
+	small = memfd_create("testify", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (small < 0)
+	{
+		warn("memfd_create");
+		return (false);
+	}
+	ok = shad_map(fds[0], small, DATA_LEN) && shad_recv(fds[0], &resp) &&
+	     resp.status == SHAD_INVALID;
+	close(small);
+	req.id = 1002;
+	req.op = SHAD_SHM;
+	req.len = 64;
+	req.offset = DATA_LEN - req.len;
+	if (!ok || !shad_send(fds[0], &req, NULL) ||
+	    !shad_recv(fds[0], &resp) ||
+	    !check(&resp, 1002, SHA256, &data[req.offset], req.len))
+		return (false);
+
+	// A mapping replaced behind queued requests is only let go once
+	// they have been hashed.
+	small = memfd_create("testify", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (small < 0 || ftruncate(small, SMALL_LEN) != 0 ||
+	    fcntl(small, F_ADD_SEALS, F_SEAL_SHRINK) != 0)
+	{
+		warn("memfd_create");
+		return (false);
+	}
+	memset(reqs, 0, sizeof(reqs));
+	reqs[0].id = 1003;
+	reqs[0].op = SHAD_SHM;
+	reqs[0].type = SHA256;
+	reqs[0].len = 8 * SMALL_LEN;
+	reqs[0].offset = DATA_LEN - reqs[0].len;
+	reqs[1].id = 1004;
+	reqs[1].op = SHAD_MAP;
+	reqs[1].offset = SMALL_LEN;
+	ok = send_fds(fds[0], reqs, 2, &small, 1) &&
+	     shad_recv(fds[0], &resp) &&
+	     check(&resp, 1003, SHA256, &data[reqs[0].offset], reqs[0].len) &&
+	     shad_recv(fds[0], &resp) && resp.id == 1004 &&
+	     resp.status == SHAD_OK;
+
+	// Extra descriptors sent with a mapping are closed.
+	num = count_fds();
+	fds2[0] = fds2[1] = small;
+	reqs[1].id = 1005;
+	ok = ok && send_fds(fds[0], &reqs[1], 1, fds2, 2) &&
+	     shad_recv(fds[0], &resp) && resp.id == 1005 &&
+	     resp.status == SHAD_OK && count_fds() == num;
+	close(small);
+	if (!ok)
+		return (false);
+
+	// An oversized payload is refused from its header alone, and ends
+	// the connection.
+	req.id = 1006;
+	req.op = SHAD_HASH;
+	req.len = SHAD_MAX_LEN + 1;
+	if (write(fds[1], &req, sizeof(req)) != sizeof(req) ||
+	    !shad_recv(fds[1], &resp) ||
+	    resp.id != 1006 || resp.status != SHAD_TOO_BIG ||
+	    shad_recv(fds[1], &resp))
+		return (false);
+
+	return (true);
+}
+
+bool
+test_shad(void)
+{
+	char dir[] = "/tmp/testify.XXXXXX", path[PATH_MAX];
+	int fds[NUM_CLIENTS], i, shm, stop[2];
+	struct shad_resp resp;
+	struct server srv;
+	pthread_t thread;
+	bool result;
+	byte *data;
+
+	if (mkdtemp(dir) == NULL)
+	{
+		warn("mkdtemp");
+		return (false);
+	}
+	snprintf(path, sizeof(path), "%s/shad.sock", dir);
+
+	// Payloads come from one memfd, which the clients also share.
+	shm = memfd_create("testify", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm < 0 || ftruncate(shm, DATA_LEN) != 0)
+	{
+		warn("memfd_create");
+		rmdir(dir);
+		return (false);
+	}
+	data = mmap(NULL, DATA_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, shm,
+		    0);
+	if (data == MAP_FAILED)
+	{
+		warn("mmap");
+		close(shm);
+		rmdir(dir);
+		return (false);
+	}
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = i * 13 + (i >> 8);
+
+	srv.sock = shad_listen(path);
+	if (srv.sock < 0 || pipe(stop) != 0)
+	{
+		munmap(data, DATA_LEN);
+		close(shm);
+		rmdir(dir);
+		return (false);
+	}
+	srv.stop = stop[0];
+	srv.result = false;
+	pthread_create(&thread, NULL, serve, &srv);
+
+	result = true;
+	for (i = 0; i < NUM_CLIENTS; i++)
+	{
+		fds[i] = shad_connect(path);
+		if (fds[i] < 0 || !shad_map(fds[i], shm, DATA_LEN) ||
+		    !shad_recv(fds[i], &resp) || resp.status != SHAD_OK)
+			result = false;
+	}
+
+	if (result)
+		result = exercise(fds, data);
+
+	for (i = 0; i < NUM_CLIENTS; i++)
+	{
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
+	// Any write to the pipe stops the server.
+	if (write(stop[1], "", 1) != 1)
+		warn("write");
+	pthread_join(thread, NULL);
+	if (!srv.result)
+		result = false;
+
+	close(stop[0]);
+	close(stop[1]);
+	close(srv.sock);
+	unlink(path);
+	rmdir(dir);
+	munmap(data, DATA_LEN);
+	close(shm);
+
+	return (result);
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	1024
+#define NUM_CTXS	1000
+#define NUM_TYPES	(SHA512_256 + 1)
+
+bool
+test_slab(void)
+{
+	byte data[DATA_LEN], expected[SHA_HASH], hash[SHA_HASH];
+	struct sha *ctxs[NUM_CTXS], *again;
+	struct sha_slab *slab;
+	size_t fed, len, step;
+	bool result;
+	int i;
+
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = i * 31 + (i >> 7);
+
+	slab = sha_slab_create();
+	if (slab == NULL)
+		return (false);
+
+	result = true;
+	for (i = 0; result && i < NUM_CTXS; i++)
+	{
+		ctxs[i] = sha_slab_alloc(slab);
+		if (ctxs[i] == NULL ||
+		    (uintptr_t) ctxs[i] % SHA_LINE != 0 ||
+		    !sha_init(ctxs[i], i % NUM_TYPES))
+			result = false;
+	}
+
+	// Feed every stream a few bytes at a time, round-robin, so each
+	// length crosses the padding boundaries of both block sizes.
+	for (fed = 0; result && fed < DATA_LEN; fed += step)
+	{
+		step = 1 + fed % 13;
+		for (i = 0; result && i < NUM_CTXS; i++)
+		{
+			len = i % DATA_LEN;
+			if (fed >= len)
+				continue;
+			if (!sha_update(ctxs[i], &data[fed],
+					(len - fed < step) ? (len - fed) : (step)))
+				result = false;
+		}
+	}
+
+	for (i = 0; result && i < NUM_CTXS; i++)
+	{
+		len = i % DATA_LEN;
+		if (!sha_final(ctxs[i], hash) ||
+		    !sha_buf(i % NUM_TYPES, data, len, expected) ||
+		    memcmp(hash, expected, sha_hash_len(i % NUM_TYPES)) != 0)
+		{
+			fprintf(stderr, "Stream %d of %zu bytes doesn't "
+				"match.\n", i, len);
+			result = false;
+		}
+	}
+
+	// Freed contexts are reused before the slab grows.
+	if (result)
+	{
+		sha_slab_free(slab, ctxs[NUM_CTXS / 2]);
+		again = sha_slab_alloc(slab);
+		if (again != ctxs[NUM_CTXS / 2])
+			result = false;
+	}
+
+	sha_slab_destroy(slab);
+
+	return (result);
+}
@@ -0,0 +1,133 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define FILE_LEN	(8 * 1024 * 1024 + 100)
+#define SKIP		5000
+
+struct extent
+{
+	off_t	off;
+	size_t	len;
+};
+
+// Data at the start, in the middle, and at the very end, holes between.
+static const struct extent extents[] = {
+	{ 0,                    100   },
+	{ 1024 * 1024 + 17,     70000 },
+	{ 5 * 1024 * 1024,      4096  },
+	{ FILE_LEN - 100,       100   }
+};
+
+static const int num_extents = sizeof(extents) / sizeof(struct extent);
+
+static bool
+check(int fd, const byte *image, off_t start, int extents_used)
+{
+	byte expected[SHA_HASH], hash[SHA_HASH];
+	struct sha_stats st;
+	struct stat sb;
+	bool result;
+
+	if (!sha_buf(SHA256, &image[start], FILE_LEN - start, expected))
+		return (false);
+
+	sha_stats_reset();
+	sha_stats_enable(true);
+	lseek(fd, start, SEEK_SET);
+	result = sha_fd(SHA256, fd, hash) &&
+		 memcmp(hash, expected, sha_hash_len(SHA256)) == 0;
+	sha_stats_enable(false);
+	sha_stats_get(&st);
+	sha_stats_reset();
+	if (!result)
+	{
+		fprintf(stderr, "Hash of a file with %d extents, from %ju, "
+			"differs.\n", extents_used, (uintmax_t) start);
+		return (false);
+	}
+
+	// Filesystems without holes store, and so read, every byte.
+	if (fstat(fd, &sb) == 0 && sb.st_blocks * 512 < FILE_LEN / 2 &&
+	    st.bytes_read > FILE_LEN / 2)
+	{
+		fprintf(stderr, "Read %llu bytes of a sparse file.\n",
+			(unsigned long long) st.bytes_read);
+		return (false);
+	}
+
+	return (lseek(fd, 0, SEEK_CUR) == FILE_LEN);
+}
+
+bool
+test_sparse(void)
+{
+	char path[] = "/tmp/testify.XXXXXX";
+	byte *image;
+	bool result;
+	size_t j;
+	int fd, i;
+
+	image = calloc(1, FILE_LEN);
+	fd = mkstemp(path);
+	if (image == NULL || fd < 0)
+	{
+		warn("mkstemp");
+		free(image);
+		return (false);
+	}
+	unlink(path);
+
+	// Start from all hole, then add one extent at a time.
+	result = ftruncate(fd, FILE_LEN) == 0 && check(fd, image, 0, 0);
+	for (i = 0; result && i < num_extents; i++)
+	{
+		for (j = 0; j < extents[i].len; j++)
+			image[extents[i].off + j] = j * 11 + i;
+		if (pwrite(fd, &image[extents[i].off], extents[i].len,
+			   extents[i].off) != extents[i].len)
+			result = false;
+
+		result = result && check(fd, image, 0, i + 1) &&
+			 check(fd, image, SKIP, i + 1);
+	}
+
+	close(fd);
+	free(image);
+
+	return (result);
+}
@@ -0,0 +1,139 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	(100 * SHA32_BLK + 7)
+
+struct job
+{
+	int	fd;
+	bool	result;
+};
+
+static void *
+hash_fd(void *arg)
+{
+	byte hash[SHA_HASH];
+	struct job *j = arg;
+
+	j->result = sha_fd(SHA256, j->fd, hash);
+
+	return (NULL);
+}
+
+static bool
+expect(const struct sha_stats *st, word64 bytes, word64 blocks)
+{
+	if (st->bytes_read == bytes && st->blocks == blocks && st->reads > 0)
+		return (true);
+
+	fprintf(stderr, "Counted %llu bytes and %llu blocks, expected %llu "
+		"and %llu.\n", (unsigned long long) st->bytes_read,
+		(unsigned long long) st->blocks, (unsigned long long) bytes,
+		(unsigned long long) blocks);
+
+	return (false);
+}
+
+bool
+test_stats(void)
+{
+	char path[] = "/tmp/testify.XXXXXX";
+	byte data[DATA_LEN], hash[SHA_HASH];
+	struct sha_stats st;
+	pthread_t thread;
+	struct job job;
+	bool result;
+	int fd, i;
+
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = i * 3;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		warn("mkstemp");
+		return (false);
+	}
+	unlink(path);
+	if (write(fd, data, DATA_LEN) != DATA_LEN)
+	{
+		warn("write");
+		close(fd);
+		return (false);
+	}
+
+	// Nothing is counted while stats are off.
+	sha_stats_reset();
+	lseek(fd, 0, SEEK_SET);
+	result = sha_fd(SHA256, fd, hash);
+	sha_stats_get(&st);
+	if (st.reads != 0 || st.blocks != 0)
+		result = false;
+
+	// The data and its padding block, read on this thread.
+	sha_stats_enable(true);
+	lseek(fd, 0, SEEK_SET);
+	if (!sha_fd(SHA256, fd, hash))
+		result = false;
+	sha_stats_get(&st);
+	if (!expect(&st, DATA_LEN, DATA_LEN / SHA32_BLK + 1))
+		result = false;
+
+	// Counts from a thread that has exited are kept.
+	sha_stats_reset();
+	lseek(fd, 0, SEEK_SET);
+	job.fd = fd;
+	job.result = false;
+	if (pthread_create(&thread, NULL, hash_fd, &job) != 0)
+	{
+		result = false;
+	}
+	else
+	{
+		pthread_join(thread, NULL);
+		sha_stats_get(&st);
+		if (!job.result || !expect(&st, DATA_LEN,
+					   DATA_LEN / SHA32_BLK + 1))
+			result = false;
+	}
+
+	sha_stats_enable(false);
+	sha_stats_reset();
+	close(fd);
+
+	return (result);
+}
@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define MSG_LEN		(200 * 1024)
+#define PIECE_LEN	1000
+#define MAX_PIECE	7919
+
+static bool
+check(enum sha_type type)
+{
+	static byte msg[MSG_LEN];
+	byte expected[SHA_HASH], hash[SHA_HASH];
+	enum sha_step step;
+	struct sha ctx;
+	size_t i, len, off;
+	int fds[2];
+	bool result;
+
+	for (i = 0; i < MSG_LEN; i++)
+		msg[i] = i * 29 + (i >> 8);
+	if (!sha_buf(type, msg, MSG_LEN, expected) || pipe(fds) != 0)
+		return (false);
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	// Feed the pipe in uneven pieces, stepping whenever it runs dry.
+	result = sha_init(&ctx, type) &&
+		 sha_fd_step(&ctx, fds[0], hash) == SHA_STEP_MORE;
+	for (off = 0, i = 0; result && off < MSG_LEN; off += len, i++)
+	{
+		len = (i * PIECE_LEN) % MAX_PIECE + 1;
+		if (len > MSG_LEN - off)
+			len = MSG_LEN - off;
+		if (write(fds[1], &msg[off], len) != len)
+			result = false;
+
+		step = sha_fd_step(&ctx, fds[0], hash);
+		if (step != SHA_STEP_MORE)
+		{
+			fprintf(stderr, "%s: Step %zu gave %d.\n",
+				sha_name(type), i, step);
+			result = false;
+		}
+	}
+
+	close(fds[1]);
+	if (result && (sha_fd_step(&ctx, fds[0], hash) != SHA_STEP_DONE ||
+		       memcmp(hash, expected, sha_hash_len(type)) != 0))
+	{
+		fprintf(stderr, "%s: Resumed hash differs.\n", sha_name(type));
+		result = false;
+	}
+	close(fds[0]);
+
+	return (result);
+}
+
+bool
+test_step(void)
+{
+	struct sha ctx;
+	byte hash[SHA_HASH];
+
+	// A closed descriptor is an error, not a reason to wait.
+	if (!sha_init(&ctx, SHA256) ||
+	    sha_fd_step(&ctx, -1, hash) != SHA_STEP_ERROR || errno != EBADF)
+		return (false);
+
+	return (check(SHA1) && check(SHA256) && check(SHA512));
+}
@@ -0,0 +1,188 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "storm.h"
+#include "testify.h"
+
+#define SMALL_LEN	(16 * 1024)
+#define MAX_LEN		(100 * 1024)
+#define NUM_MANY	300
+#define THREADS		3
+
+// Sizes around the one-read limit, then enough small files to fill
+// several batches.
+static const size_t sizes[] = {
+	0, 1, 55, 64, 100, SMALL_LEN - 1, SMALL_LEN, SMALL_LEN + 1, MAX_LEN
+};
+
+static const int num_sizes = sizeof(sizes) / sizeof(size_t);
+
+#define NUM_FILES	(num_sizes + NUM_MANY)
+
+static size_t
+file_len(int i)
+{
+	return ((i < num_sizes) ? (sizes[i]) : ((i * 37) % 700));
+}
+
+static void
+fill_file(int i, byte *buf)
+{
+	size_t j;
+
+	for (j = 0; j < file_len(i); j++)
+		buf[j] = i + j * 13;
+}
+
+static bool
+build(const char *root)
+{
+	static byte buf[MAX_LEN];
+	char path[PATH_MAX];
+	int fd, i;
+
+	for (i = 0; i < NUM_FILES; i++)
+	{
+		fill_file(i, buf);
+		snprintf(path, sizeof(path), "%s/%04d", root, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0)
+			return (false);
+		if (write(fd, buf, file_len(i)) != file_len(i))
+		{
+			close(fd);
+			return (false);
+		}
+		close(fd);
+	}
+
+	return (true);
+}
+
+static void
+destroy(const char *root)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < NUM_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%04d", root, i);
+		unlink(path);
+	}
+	rmdir(root);
+}
+
+static bool
+check(const char *root, enum sha_type type, bool no_uring)
+{
+	static byte buf[MAX_LEN];
+	struct tree_entry entries[NUM_FILES + 1];
+	byte *hashes, hash[SHA_HASH];
+	struct storm_opts opts;
+	char path[PATH_MAX];
+	size_t len;
+	bool result;
+	int i;
+
+	// Half the sizes are known up front, and the last file is missing.
+	memset(entries, 0, sizeof(entries));
+	result = true;
+	for (i = 0; i <= NUM_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%04d", root, i);
+		entries[i].path = strdup(path);
+		entries[i].size = (i % 2 == 0) ? (-1) : (file_len(i));
+		if (entries[i].path == NULL)
+			result = false;
+	}
+
+	len = sha_hash_len(type);
+	hashes = malloc((NUM_FILES + 1) * len);
+	if (hashes == NULL)
+		result = false;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.type = type;
+	opts.threads = THREADS;
+	opts.no_uring = no_uring;
+	if (result)
+		result = storm_hash(&opts, entries, NUM_FILES + 1, hashes);
+
+	for (i = 0; result && i < NUM_FILES; i++)
+	{
+		fill_file(i, buf);
+		if (entries[i].failed ||
+		    !sha_buf(type, buf, file_len(i), hash) ||
+		    memcmp(&hashes[i * len], hash, len) != 0)
+		{
+			fprintf(stderr, "%s: Wrong %s of %zu bytes%s.\n",
+				entries[i].path, sha_name(type), file_len(i),
+				(no_uring) ? (" without io_uring") : (""));
+			result = false;
+		}
+	}
+	if (result && !entries[NUM_FILES].failed)
+	{
+		fprintf(stderr, "Missing file wasn't reported.\n");
+		result = false;
+	}
+
+	for (i = 0; i <= NUM_FILES; i++)
+		free(entries[i].path);
+	free(hashes);
+
+	return (result);
+}
+
+bool
+test_storm(void)
+{
+	char root[] = "/tmp/testify.XXXXXX";
+	bool result;
+
+	if (mkdtemp(root) == NULL)
+	{
+		warn("mkdtemp");
+		return (false);
+	}
+
+	result = build(root) && check(root, SHA256, false) &&
+		 check(root, SHA256, true) && check(root, SHA512, false) &&
+		 check(root, SHA1, true);
+	destroy(root);
+
+	return (result);
+}
@@ -32,51 +32,96 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "test_sums.h"
 #include "testify.h"
 
+struct test_perf test_perf = {
+	.repeat = 1
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static bool
+test_sum(sum_fcn_t *fcn, struct test_pair *test, int i, int fd, bool verbose)
+{
+	bool result;
+	double start;
+	char *sum;
+
+	// Calculate message digest.
+	start = now();
+	sum = (*fcn)(fd);
+	test_perf.secs += now() - start;
+
+	result = true;
+	if (sum == NULL)
+	{
+		fprintf(stderr, "[%d] No sum was produced.\n", i);
+		result = false;
+	}
+	else if (strcmp(sum, test->out) == 0)
+	{
+		if (verbose)
+			fprintf(stderr, "[%d] Sum matches.\n", i);
+	}
+	else
+	{
+		fprintf(stderr, "[%d] Sum (%s) doesn't match.\n", i, sum);
+		result = false;
+	}
+
+	free(sum);
+
+	return (result);
+}
+
 bool
 test_sums(sum_fcn_t *fcn, struct test_pair *tests, int num_tests)
 {
+	struct stat st;
 	bool result;
-	int fd, i;
-	char *sum;
+	int fd, i, j;
 
 	result = true;
 	for (i = 0; i < num_tests; i++)
 	{
 		// Open test file.
 		fd = open(tests[i].in, O_RDONLY);
-		if (fd == -1)
+		if (fd == -1 || fstat(fd, &st) == -1)
 		{
 			fprintf(stderr, "[%d] Couldn't open test file %s\n", i,
 				tests[i].in);
+			if (fd != -1)
+				close(fd);
 			result = false;
 			continue;
 		}
 
-		// Calculate message digest.
-		sum = (*fcn)(fd);
-		if (sum == NULL)
+		// Hash the file, repeatedly when measuring performance.
+		for (j = 0; j < test_perf.repeat; j++)
 		{
-			fprintf(stderr, "[%d] No sum was produced.\n", i);
-			result = false;
-		}
-		else if (strcmp(sum, tests[i].out) == 0)
-		{
-			fprintf(stderr, "[%d] Sum matches.\n", i);
-		}
-		else
-		{
-			fprintf(stderr, "[%d] Sum (%s) doesn't match.\n", i,
-				sum);
-			result = false;
+			if (lseek(fd, 0, SEEK_SET) == -1 ||
+			    !test_sum(fcn, &tests[i], i, fd, j == 0))
+			{
+				result = false;
+				break;
+			}
+
+			test_perf.bytes += st.st_size;
 		}
 
 		close(fd);
-		free(sum);
 	}
 
 	return (result);
@@ -39,6 +39,15 @@ struct test_pair
 	const char	*out;
 };
 
+struct test_perf
+{
+	int		repeat;
+	double		secs;
+	uint64_t	bytes;
+};
+
+extern struct test_perf test_perf;
+
 bool	test_sums(sum_fcn_t *fcn, struct test_pair *tests, int num_tests);
 
 #endif
@@ -0,0 +1,178 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	(3 * 1024 * 1024 + 77)
+#define PIECE_LEN	10007
+
+struct end
+{
+	int	 fd;
+	byte	*buf;
+	size_t	 len;
+};
+
+static void *
+produce(void *arg)
+{
+	struct end *e = arg;
+	size_t n, off;
+
+	// Uneven pieces, so tee() sees partly filled pipes.
+	for (off = 0; off < e->len; off += n)
+	{
+		n = (e->len - off < PIECE_LEN) ? (e->len - off) : (PIECE_LEN);
+		if (write(e->fd, &e->buf[off], n) != n)
+			break;
+	}
+	close(e->fd);
+
+	return (NULL);
+}
+
+static void *
+consume(void *arg)
+{
+	struct end *e = arg;
+	ssize_t n;
+
+	e->len = 0;
+	while ((n = read(e->fd, &e->buf[e->len], DATA_LEN + 1 - e->len)) > 0)
+		e->len += n;
+
+	return (NULL);
+}
+
+static bool
+check(const byte *data, const byte *out, size_t out_len, const byte *hash,
+      const char *how)
+{
+	byte expected[SHA_HASH];
+
+	if (!sha_buf(SHA256, data, DATA_LEN, expected))
+		return (false);
+
+	if (out_len != DATA_LEN || memcmp(out, data, DATA_LEN) != 0 ||
+	    memcmp(hash, expected, sha_hash_len(SHA256)) != 0)
+	{
+		fprintf(stderr, "Copy %s changed the data or its hash.\n", how);
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+check_pipes(byte *data, byte *out)
+{
+	struct end prod, cons;
+	pthread_t p, c;
+	int in[2], to[2];
+	byte hash[SHA_HASH];
+	bool result;
+
+	if (pipe(in) != 0 || pipe(to) != 0)
+		return (false);
+
+	prod.fd = in[1];
+	prod.buf = data;
+	prod.len = DATA_LEN;
+	cons.fd = to[0];
+	cons.buf = out;
+	if (pthread_create(&p, NULL, produce, &prod) != 0 ||
+	    pthread_create(&c, NULL, consume, &cons) != 0)
+		return (false);
+
+	result = sha_tee(SHA256, in[0], to[1], hash);
+	close(to[1]);
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+	close(in[0]);
+	close(to[0]);
+
+	return (result && check(data, out, cons.len, hash, "between pipes"));
+}
+
+static bool
+check_files(byte *data, byte *out)
+{
+	char src[] = "/tmp/testify.XXXXXX", dst[] = "/tmp/testify.XXXXXX";
+	byte hash[SHA_HASH];
+	int in, to;
+	bool result;
+	ssize_t n;
+
+	in = mkstemp(src);
+	to = mkstemp(dst);
+	if (in < 0 || to < 0)
+	{
+		warn("mkstemp");
+		return (false);
+	}
+	unlink(src);
+	unlink(dst);
+
+	// Regular files can't use tee(), so they're read and written.
+	result = write(in, data, DATA_LEN) == DATA_LEN &&
+		 lseek(in, 0, SEEK_SET) == 0 &&
+		 sha_tee(SHA256, in, to, hash);
+	n = pread(to, out, DATA_LEN + 1, 0);
+	close(in);
+	close(to);
+
+	return (result && check(data, out, (n < 0) ? (0) : (n), hash,
+				"between files"));
+}
+
+bool
+test_tee(void)
+{
+	byte *data, *out;
+	bool result;
+	int i;
+
+	data = malloc(DATA_LEN);
+	out = malloc(DATA_LEN + 1);
+	result = (data != NULL && out != NULL);
+	for (i = 0; result && i < DATA_LEN; i++)
+		data[i] = i * 13 + (i >> 10);
+
+	result = result && check_pipes(data, out) && check_files(data, out);
+	free(data);
+	free(out);
+
+	return (result);
+}
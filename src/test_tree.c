@@ -0,0 +1,194 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+#include "tree.h"
+
+#define THREADS		3
+
+// Listed in the order the tree should report them.
+static const char *files[] = {
+	"a", "b/c/y", "b/x", "b/z", "d/e/f/g"
+};
+
+static const char *dirs[] = {
+	"b/c", "b", "d/e/f", "d/e", "d"
+};
+
+static const int num_files = sizeof(files) / sizeof(char *);
+static const int num_dirs = sizeof(dirs) / sizeof(char *);
+
+static bool
+build(const char *root)
+{
+	char path[PATH_MAX];
+	int fd, i;
+
+	for (i = num_dirs - 1; i >= 0; i--)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+		if (mkdir(path, 0700) != 0)
+			return (false);
+	}
+
+	// Each file holds its own name.
+	for (i = 0; i < num_files; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0)
+			return (false);
+		if (write(fd, files[i], strlen(files[i])) != strlen(files[i]))
+		{
+			close(fd);
+			return (false);
+		}
+		close(fd);
+	}
+
+	// One link to a file, one to a directory that mustn't be followed.
+	snprintf(path, sizeof(path), "%s/l", root);
+	if (symlink("a", path) != 0)
+		return (false);
+	snprintf(path, sizeof(path), "%s/m", root);
+	if (symlink("b", path) != 0)
+		return (false);
+
+	return (true);
+}
+
+static void
+destroy(const char *root)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < num_files; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/l", root);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/m", root);
+	unlink(path);
+
+	for (i = 0; i < num_dirs; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+		rmdir(path);
+	}
+	rmdir(root);
+}
+
+static bool
+check_entry(const char *root, const struct tree_entry *entry,
+	    const char *name, const char *data)
+{
+	char hex[2 * SHA_HASH + 1], path[PATH_MAX];
+	byte hash[SHA_HASH];
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	if (strcmp(entry->path, path) != 0)
+	{
+		fprintf(stderr, "Expected %s, got %s.\n", path, entry->path);
+		return (false);
+	}
+
+	sha_buf(SHA256, data, strlen(data), hash);
+	sha_hex(hash, sha_hash_len(SHA256), hex);
+	if (entry->hash == NULL || strcmp(entry->hash, hex) != 0)
+	{
+		fprintf(stderr, "Sum of %s doesn't match.\n", path);
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+check(const char *root, bool no_symlinks)
+{
+	struct tree_entry *entries;
+	struct tree_opts opts;
+	int expected, i;
+	bool result;
+	size_t num;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.type = SHA256;
+	opts.fcn = sha_fd;
+	opts.threads = THREADS;
+	opts.no_symlinks = no_symlinks;
+	if (!tree_hash(root, &opts, &entries, &num))
+		return (false);
+
+	// The link to "a" sorts last; the link to "b" is never entered.
+	expected = num_files + ((no_symlinks) ? (0) : (1));
+	result = (num == expected);
+	if (!result)
+		fprintf(stderr, "Expected %d entries, got %zu.\n", expected,
+			num);
+
+	for (i = 0; result && i < num_files; i++)
+		result = check_entry(root, &entries[i], files[i], files[i]);
+	if (result && !no_symlinks)
+		result = check_entry(root, &entries[num_files], "l", "a");
+
+	tree_free(entries, num);
+
+	return (result);
+}
+
+bool
+test_tree(void)
+{
+	char root[] = "/tmp/testify.XXXXXX";
+	bool result;
+
+	if (mkdtemp(root) == NULL)
+	{
+		warn("mkdtemp");
+		return (false);
+	}
+
+	result = build(root) && check(root, false) && check(root, true);
+	destroy(root);
+
+	return (result);
+}
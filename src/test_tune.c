@@ -0,0 +1,156 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sha.h"
+#include "testify.h"
+
+#define DATA_LEN	(3 * 1024 * 1024 + 5)
+
+static bool
+check_io(const byte *data, int fd)
+{
+	static const size_t lens[] = { 0, 4096, 16 * 1024, 1024 * 1024 };
+	byte expected[SHA_HASH], hash[SHA_HASH];
+	struct sha_tune tune;
+	bool result;
+	int i;
+
+	if (!sha_buf(SHA256, data, DATA_LEN, expected))
+		return (false);
+
+	// Every read length, and the mapping, hash the same bytes.
+	result = true;
+	memset(&tune, 0, sizeof(tune));
+	for (i = 0; result && i < sizeof(lens) / sizeof(size_t); i++)
+	{
+		tune.read_len = lens[i];
+		lseek(fd, 0, SEEK_SET);
+		if (!sha_tune_apply(&tune) || !sha_fd(SHA256, fd, hash) ||
+		    memcmp(hash, expected, sha_hash_len(SHA256)) != 0)
+		{
+			fprintf(stderr, "Reading %zu bytes at a time failed.\n",
+				lens[i]);
+			result = false;
+		}
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	if (result && (!sha_map(SHA256, fd, hash) ||
+		       memcmp(hash, expected, sha_hash_len(SHA256)) != 0 ||
+		       lseek(fd, 0, SEEK_CUR) != DATA_LEN))
+	{
+		fprintf(stderr, "Mapped hash differs.\n");
+		result = false;
+	}
+
+	return (result);
+}
+
+static bool
+check_file(const char *path)
+{
+	struct sha_tune in, out;
+	FILE *fp;
+
+	// What's saved loads back unchanged.
+	memset(&in, 0, sizeof(in));
+	in.io = SHA_IO_MMAP;
+	in.read_len = 256 * 1024;
+	in.threads = 3;
+	strcpy(in.kernel[1], "generic");
+	strcpy(in.batch[1], "generic2");
+	if (!sha_tune_save(path, &in) || !sha_tune_load(path, &out) ||
+	    memcmp(&in, &out, sizeof(in)) != 0)
+	{
+		fprintf(stderr, "Saved settings didn't load back.\n");
+		return (false);
+	}
+
+	if (!sha_tune_apply(&out) ||
+	    strcmp(sha_kernel(SHA256)->name, "generic") != 0 ||
+	    strcmp(sha_kernel_many(SHA256)->name, "generic2") != 0)
+	{
+		fprintf(stderr, "Tuned kernels weren't selected.\n");
+		return (false);
+	}
+
+	// A read length out of range is refused.
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return (false);
+	fprintf(fp, "# Too small.\nread_len 10\n");
+	fclose(fp);
+
+	return (!sha_tune_load(path, &out));
+}
+
+bool
+test_tune(void)
+{
+	char dir[] = "/tmp/testify.XXXXXX", path[sizeof(dir) + 16];
+	struct sha_tune tune;
+	byte *data;
+	bool result;
+	int fd, i;
+
+	data = malloc(DATA_LEN);
+	if (data == NULL || mkdtemp(dir) == NULL)
+	{
+		warn("mkdtemp");
+		free(data);
+		return (false);
+	}
+	for (i = 0; i < DATA_LEN; i++)
+		data[i] = i * 5 + (i >> 12);
+
+	snprintf(path, sizeof(path), "%s/data", dir);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	result = (fd >= 0 && write(fd, data, DATA_LEN) == DATA_LEN &&
+		  check_io(data, fd));
+	if (fd >= 0)
+		close(fd);
+	unlink(path);
+
+	snprintf(path, sizeof(path), "%s/sha.conf", dir);
+	result = result && check_file(path);
+	unlink(path);
+	rmdir(dir);
+	free(data);
+
+	// Leave the defaults for the tests that follow.
+	memset(&tune, 0, sizeof(tune));
+	sha_tune_apply(&tune);
+
+	return (result);
+}
@@ -30,11 +30,30 @@
 
 #include <stdbool.h>
 
+bool	test_chunk(void);
+bool	test_cold(void);
+bool	test_dupes(void);
+bool	test_hpp(void);
+bool	test_kernels(void);
+bool	test_merkle(void);
 bool	test_null(void);
+bool	test_range(void);
 bool	test_sha1(void);
 bool	test_sha224(void);
 bool	test_sha256(void);
+bool	test_sha256d(void);
 bool	test_sha384(void);
 bool	test_sha512(void);
+bool	test_sha512_224(void);
+bool	test_sha512_256(void);
+bool	test_shad(void);
+bool	test_slab(void);
+bool	test_sparse(void);
+bool	test_stats(void);
+bool	test_step(void);
+bool	test_storm(void);
+bool	test_tee(void);
+bool	test_tree(void);
+bool	test_tune(void);
 
 #endif
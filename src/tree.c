@@ -0,0 +1,547 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tree.h"
+
+#define DENTS_LEN	(32 * 1024)
+
+// Record layout returned by the getdents64 system call.
+struct dent
+{
+	uint64_t	d_ino;
+	int64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
+
+// An open directory, shared by the jobs for its entries so they can be
+// opened relative to it instead of by path.
+struct dir
+{
+	int	fd;
+	int	refs;
+};
+
+struct job
+{
+	struct job	*next;
+	struct dir	*parent;
+	char		*path;
+	const char	*name;
+	bool		 dir;
+};
+
+struct walk
+{
+	const struct tree_opts	*opts;
+	dev_t			 dev;
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 ready;
+	struct job		*jobs;
+	int			 busy;
+	struct tree_entry	*entries;
+	size_t			 num;
+	size_t			 max;
+	bool			 failed;
+};
+
+/******************************************************************************
+ * Bookkeeping.
+ ******************************************************************************/
+static char *
+join(const char *dir, const char *name)
+{
+	size_t dir_len, name_len;
+	char *path;
+
+	// Avoid doubling the separator after the root directory.
+	dir_len = strlen(dir);
+	if (dir_len > 0 && dir[dir_len - 1] == '/')
+		dir_len--;
+	name_len = strlen(name);
+
+	path = malloc(dir_len + name_len + 2);
+	if (path == NULL)
+	{
+		warn("malloc");
+		return (NULL);
+	}
+
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(&path[dir_len + 1], name, name_len + 1);
+
+	return (path);
+}
+
+static struct job *
+job(struct job *next, struct dir *parent, char *path, bool dir)
+{
+	struct job *j;
+
+	if (path == NULL)
+		return (NULL);
+
+	j = malloc(sizeof(*j));
+	if (j == NULL)
+	{
+		warn("malloc");
+		free(path);
+		return (NULL);
+	}
+
+	// Entries are named relative to their directory; the root is
+	// opened by its full path.
+	j->next = next;
+	j->parent = parent;
+	j->path = path;
+	j->name = (parent == NULL) ? (path) : (strrchr(path, '/') + 1);
+	j->dir = dir;
+	if (parent != NULL)
+		parent->refs++;
+
+	return (j);
+}
+
+static void
+push(struct walk *w, struct job *head, struct job *tail)
+{
+	if (head == NULL)
+		return;
+
+	// Jobs are taken depth-first, which bounds the queue.
+	pthread_mutex_lock(&w->lock);
+	tail->next = w->jobs;
+	w->jobs = head;
+	pthread_cond_broadcast(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void
+release(struct walk *w, struct dir *d)
+{
+	int refs;
+
+	if (d == NULL)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	refs = --d->refs;
+	pthread_mutex_unlock(&w->lock);
+
+	if (refs == 0)
+	{
+		close(d->fd);
+		free(d);
+	}
+}
+
+static int
+at(const struct job *j)
+{
+	return ((j->parent == NULL) ? (AT_FDCWD) : (j->parent->fd));
+}
+
+static void
+fail(struct walk *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->failed = true;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void
+record(struct walk *w, char *path, char *hash, off_t size, bool failed)
+{
+	struct tree_entry *entries;
+	size_t max;
+
+	if (path == NULL)
+	{
+		fail(w);
+		free(hash);
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+
+	if (w->num == w->max)
+	{
+		max = (w->max == 0) ? (1024) : (2 * w->max);
+		entries = realloc(w->entries, max * sizeof(*entries));
+		if (entries == NULL)
+		{
+			warn("realloc");
+			w->failed = true;
+			pthread_mutex_unlock(&w->lock);
+			free(path);
+			free(hash);
+			return;
+		}
+
+		w->entries = entries;
+		w->max = max;
+	}
+
+	w->entries[w->num].path = path;
+	w->entries[w->num].hash = hash;
+	w->entries[w->num].size = size;
+	w->entries[w->num].failed = failed;
+	w->num++;
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+/******************************************************************************
+ * Jobs.
+ ******************************************************************************/
+static int
+classify(int dir, const char *name, int type, bool no_symlinks)
+{
+	struct stat st;
+
+	// Only look at the inode when the entry doesn't say.
+	if (type == DT_UNKNOWN)
+	{
+		if (fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			return (-1);
+		type = IFTODT(st.st_mode);
+	}
+
+	if (type != DT_LNK || no_symlinks)
+		return (type);
+
+	// Links to files are hashed as their targets, but links to
+	// directories aren't followed.
+	if (fstatat(dir, name, &st, 0) != 0)
+		return (-1);
+
+	return ((S_ISREG(st.st_mode)) ? (DT_REG) : (DT_LNK));
+}
+
+static void
+scan(struct walk *w, const struct job *j)
+{
+	struct job *head, *tail, *next;
+	char buf[DENTS_LEN], *path;
+	struct dir *self;
+	struct dent *d;
+	struct stat st;
+	int fd, type;
+	long len, off;
+
+	// Below the root, a directory replaced by a symbolic link after its
+	// parent was read is refused rather than followed.
+	path = j->path;
+	fd = openat(at(j), j->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+		    ((j->parent == NULL) ? (0) : (O_NOFOLLOW)));
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		warn("%s", path);
+		if (fd >= 0)
+			close(fd);
+		record(w, path, NULL, 0, true);
+		return;
+	}
+
+	// Mount points are left out entirely when staying on one filesystem.
+	if (w->opts->one_fs && st.st_dev != w->dev)
+	{
+		close(fd);
+		free(path);
+		return;
+	}
+
+	self = malloc(sizeof(*self));
+	if (self == NULL)
+	{
+		warn("malloc");
+		close(fd);
+		record(w, path, NULL, 0, true);
+		return;
+	}
+	self->fd = fd;
+	self->refs = 1;
+
+	head = tail = NULL;
+	while ((len = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0)
+	{
+		for (off = 0; off < len; off += d->d_reclen)
+		{
+			d = (struct dent *) &buf[off];
+			if (strcmp(d->d_name, ".") == 0 ||
+			    strcmp(d->d_name, "..") == 0)
+				continue;
+
+			type = classify(fd, d->d_name, d->d_type,
+					w->opts->no_symlinks);
+			if (type < 0)
+			{
+				warn("%s/%s", path, d->d_name);
+				record(w, join(path, d->d_name), NULL, 0, true);
+				continue;
+			}
+
+			// Devices, pipes, sockets, and links that aren't
+			// followed are skipped.
+			if (type != DT_REG && type != DT_DIR)
+				continue;
+
+			next = job(head, self, join(path, d->d_name),
+				   type == DT_DIR);
+			if (next == NULL)
+			{
+				fail(w);
+				continue;
+			}
+			if (tail == NULL)
+				tail = next;
+			head = next;
+		}
+	}
+
+	if (len < 0)
+	{
+		warn("%s", path);
+		record(w, path, NULL, 0, true);
+	}
+	else
+		free(path);
+
+	push(w, head, tail);
+	release(w, self);
+}
+
+static void
+digest(struct walk *w, const struct job *j)
+{
+	byte bin[SHA_HASH];
+	struct stat st;
+	char *hash, *path;
+	int fd;
+
+	path = j->path;
+
+	// Without a hash function the walk only lists files.
+	if (w->opts->fcn == NULL)
+	{
+		if (w->opts->no_size)
+		{
+			record(w, path, NULL, -1, false);
+			return;
+		}
+		if (fstatat(at(j), j->name, &st, 0) != 0)
+		{
+			warn("%s", path);
+			record(w, path, NULL, 0, true);
+			return;
+		}
+
+		record(w, path, NULL, st.st_size, false);
+		return;
+	}
+
+	// Links were skipped while scanning, so one found now was swapped in.
+	fd = openat(at(j), j->name, O_RDONLY | O_CLOEXEC | O_NOCTTY |
+		    ((w->opts->no_symlinks && j->parent != NULL) ?
+		     (O_NOFOLLOW) : (0)));
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		warn("%s", path);
+		if (fd >= 0)
+			close(fd);
+		record(w, path, NULL, 0, true);
+		return;
+	}
+
+	hash = NULL;
+	if ((*w->opts->fcn)(w->opts->type, fd, bin))
+	{
+		hash = malloc(2 * sha_hash_len(w->opts->type) + 1);
+		if (hash == NULL)
+			warn("malloc");
+		else
+			sha_hex(bin, sha_hash_len(w->opts->type), hash);
+	}
+	else
+		warnx("%s: Couldn't calculate hash.", path);
+	close(fd);
+
+	record(w, path, hash, st.st_size, hash == NULL);
+}
+
+static void *
+worker(void *arg)
+{
+	struct walk *w;
+	struct job *j;
+
+	w = arg;
+	pthread_mutex_lock(&w->lock);
+	while (true)
+	{
+		// Wait for work until nobody is left to produce any.
+		while (w->jobs == NULL && w->busy > 0)
+			pthread_cond_wait(&w->ready, &w->lock);
+		if (w->jobs == NULL)
+			break;
+
+		j = w->jobs;
+		w->jobs = j->next;
+		w->busy++;
+		pthread_mutex_unlock(&w->lock);
+
+		if (j->dir)
+			scan(w, j);
+		else
+			digest(w, j);
+		release(w, j->parent);
+		free(j);
+
+		pthread_mutex_lock(&w->lock);
+		w->busy--;
+		if (w->busy == 0 && w->jobs == NULL)
+			pthread_cond_broadcast(&w->ready);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return (NULL);
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	const struct tree_entry *x, *y;
+
+	x = a;
+	y = b;
+
+	return (strcmp(x->path, y->path));
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+bool
+tree_hash(const char *root, const struct tree_opts *opts,
+	  struct tree_entry **entries, size_t *num)
+{
+	pthread_t *threads;
+	struct walk w;
+	struct stat st;
+	int i, started;
+	size_t len;
+	char *path;
+
+	if (root == NULL || opts == NULL || entries == NULL || num == NULL)
+		return (false);
+
+	if (stat(root, &st) != 0)
+	{
+		warn("%s", root);
+		return (false);
+	}
+
+	// Drop trailing separators so paths join cleanly.
+	path = strdup(root);
+	if (path == NULL)
+	{
+		warn("strdup");
+		return (false);
+	}
+	for (len = strlen(path); len > 1 && path[len - 1] == '/'; len--)
+		path[len - 1] = '\0';
+
+	memset(&w, 0, sizeof(w));
+	w.opts = opts;
+	w.dev = st.st_dev;
+	w.jobs = job(NULL, NULL, path, S_ISDIR(st.st_mode));
+	if (w.jobs == NULL)
+		return (false);
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.ready, NULL);
+
+	// Directories and files share one pool of workers.
+	threads = calloc((opts->threads > 0) ? (opts->threads) : (1),
+			 sizeof(*threads));
+	started = 0;
+	for (i = 0; threads != NULL && i < opts->threads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, worker, &w) != 0)
+			break;
+		started++;
+	}
+	if (started == 0)
+		worker(&w);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	pthread_cond_destroy(&w.ready);
+	pthread_mutex_destroy(&w.lock);
+
+	if (w.failed)
+	{
+		tree_free(w.entries, w.num);
+		return (false);
+	}
+
+	// Completion order depends on scheduling, so sort by path.
+	qsort(w.entries, w.num, sizeof(*w.entries), compare);
+	*entries = w.entries;
+	*num = w.num;
+
+	return (true);
+}
+
+void
+tree_free(struct tree_entry *entries, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++)
+	{
+		free(entries[i].path);
+		free(entries[i].hash);
+	}
+
+	free(entries);
+}
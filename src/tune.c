@@ -0,0 +1,628 @@
+/******************************************************************************
+ * Copyright (c) 2009 Matthew Anthony Kolybabi (Mak)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sha.h"
+#include "tree.h"
+#include "tune.h"
+
+#define ENV_TUNE	"SHA_TUNE"
+#define TUNE_PATH	"/etc/sha.conf"
+#define MIN_READ	(4 * 1024)
+#define MAX_READ	(64 * 1024 * 1024)
+#define MAX_THREADS	4096
+#define LINE_LEN	256
+
+#define SAMPLE_LEN	(128 * 1024 * 1024)
+#define CPU_LEN		(4 * 1024 * 1024)
+#define CPU_MSGS	256
+#define CPU_MSG_LEN	(4 * 1024)
+#define CPU_RUNS	3
+
+struct family
+{
+	const char	*name;
+	enum sha_type	 type;
+};
+
+// A sample of the target's files, hashed by each candidate setting.
+struct sample
+{
+	enum sha_type	 type;
+	bool		(*fcn)(enum sha_type type, int fd, byte *hash);
+	char		**paths;
+	size_t		 num;
+	bool		 failed;
+};
+
+size_t tune_read_len = 0;
+
+static struct sha_tune current;
+
+static const struct family families[SHA_TUNE_FAMILIES] = {
+	{ "sha1",   SHA1   },
+	{ "sha256", SHA256 },
+	{ "sha512", SHA512 }
+};
+
+static const char *io_names[] = {
+	[SHA_IO_READ]   = "read",
+	[SHA_IO_MMAP]   = "mmap",
+	[SHA_IO_DIRECT] = "direct"
+};
+
+static const int num_io = sizeof(io_names) / sizeof(char *);
+
+static const size_t read_lens[] = {
+	16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024
+};
+
+static const int num_read_lens = sizeof(read_lens) / sizeof(size_t);
+
+/******************************************************************************
+ * Parsing.
+ ******************************************************************************/
+static bool
+parse_kernel(const char *key, const char *value, struct sha_tune *tune)
+{
+	char (*names)[SHA_TUNE_NAME];
+	const char *dot;
+	int f;
+
+	// Kernels are named per family, as in sha256.kernel or sha256.batch.
+	dot = strchr(key, '.');
+	if (dot == NULL || strlen(value) >= SHA_TUNE_NAME)
+		return (false);
+	if (strcmp(dot, ".kernel") == 0)
+		names = tune->kernel;
+	else if (strcmp(dot, ".batch") == 0)
+		names = tune->batch;
+	else
+		return (false);
+
+	for (f = 0; f < SHA_TUNE_FAMILIES; f++)
+	{
+		if (strncmp(key, families[f].name, dot - key) == 0 &&
+		    families[f].name[dot - key] == '\0')
+		{
+			strcpy(names[f], value);
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+static bool
+parse(const char *path, int line, const char *key, const char *value,
+      struct sha_tune *tune)
+{
+	unsigned long num;
+	char *end;
+	int i;
+
+	if (strcmp(key, "io") == 0)
+	{
+		for (i = 0; i < num_io; i++)
+		{
+			if (strcmp(value, io_names[i]) == 0)
+			{
+				tune->io = i;
+				return (true);
+			}
+		}
+	}
+	else if (strcmp(key, "read_len") == 0)
+	{
+		num = strtoul(value, &end, 10);
+		if (*end == '\0' &&
+		    (num == 0 || (num >= MIN_READ && num <= MAX_READ)))
+		{
+			tune->read_len = num;
+			return (true);
+		}
+	}
+	else if (strcmp(key, "threads") == 0)
+	{
+		num = strtoul(value, &end, 10);
+		if (*end == '\0' && num <= MAX_THREADS)
+		{
+			tune->threads = num;
+			return (true);
+		}
+	}
+	else if (strchr(key, '.') != NULL)
+	{
+		if (parse_kernel(key, value, tune))
+			return (true);
+	}
+	else
+	{
+		warnx("%s:%d: Unknown setting %s.", path, line, key);
+		return (false);
+	}
+
+	warnx("%s:%d: Bad value %s for %s.", path, line, value, key);
+
+	return (false);
+}
+
+/******************************************************************************
+ * Calibration.
+ ******************************************************************************/
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+hash_one(void *arg, size_t index)
+{
+	byte hash[SHA_HASH];
+	struct sample *s;
+	int fd;
+
+	s = arg;
+	fd = open(s->paths[index], O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0 || !(*s->fcn)(s->type, fd, hash))
+		s->failed = true;
+	if (fd >= 0)
+		close(fd);
+}
+
+static double
+trial(struct sample *s, bool (*fcn)(enum sha_type, int, byte *),
+      int threads)
+{
+	double start;
+	size_t i;
+	int fd;
+
+	// Every trial starts from storage, not the page cache.
+	for (i = 0; i < s->num; i++)
+	{
+		fd = open(s->paths[i], O_RDONLY | O_CLOEXEC | O_NOCTTY);
+		if (fd < 0)
+			continue;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+
+	s->fcn = fcn;
+	s->failed = false;
+	start = now();
+	pool_run(hash_one, s, s->num, threads);
+
+	return ((s->failed) ? (-1) : (now() - start));
+}
+
+static double
+time_kernel(enum sha_type type, bool batch, const byte *buf)
+{
+	struct sha_msg msgs[CPU_MSGS];
+	byte hashes[CPU_MSGS * SHA_HASH];
+	double best, start, t;
+	int i, run;
+
+	for (i = 0; i < CPU_MSGS; i++)
+	{
+		msgs[i].data = &buf[i * CPU_MSG_LEN];
+		msgs[i].len = CPU_MSG_LEN;
+	}
+
+	// The best of a few runs, as the host may be busy.
+	best = -1;
+	for (run = 0; run < CPU_RUNS; run++)
+	{
+		start = now();
+		if (batch)
+			sha_many(type, msgs, CPU_MSGS, hashes);
+		else
+			sha_buf(type, buf, CPU_LEN, hashes);
+		t = now() - start;
+		if (best < 0 || t < best)
+			best = t;
+	}
+
+	return (best);
+}
+
+static void
+tune_kernels(struct sha_tune *tune)
+{
+	const struct sha_kernel *kernels, *k, *single, *many;
+	double best_single, best_many, t;
+	int f, i, num;
+	byte *buf;
+
+	buf = calloc(1, CPU_LEN);
+	if (buf == NULL)
+		return;
+
+	// Kernels only cost CPU, so they're timed on memory.
+	kernels = sha_kernels(&num);
+	for (f = 0; f < SHA_TUNE_FAMILIES; f++)
+	{
+		single = many = NULL;
+		best_single = best_many = -1;
+		for (i = 0; i < num; i++)
+		{
+			k = &kernels[i];
+			if (!(*k->supported)() ||
+			    !sha_kernel_select(families[f].type, k->name) ||
+			    sha_kernel_many(families[f].type) != k)
+				continue;
+
+			t = time_kernel(families[f].type, true, buf);
+			if (best_many < 0 || t < best_many)
+			{
+				best_many = t;
+				many = k;
+			}
+			if (k->lanes > 1)
+				continue;
+
+			t = time_kernel(families[f].type, false, buf);
+			if (best_single < 0 || t < best_single)
+			{
+				best_single = t;
+				single = k;
+			}
+		}
+
+		// A single-lane batch winner can't differ from the streams.
+		sha_kernel_reset(families[f].type);
+		if (single != NULL)
+			strcpy(tune->kernel[f], single->name);
+		if (many != NULL && many->lanes > 1)
+			strcpy(tune->batch[f], many->name);
+	}
+
+	free(buf);
+}
+
+static bool
+gather(const char *path, struct sample *s, struct tree_entry **entries,
+       size_t *num)
+{
+	struct tree_opts opts;
+	struct stat st;
+	off_t total;
+	size_t i;
+
+	if (stat(path, &st) != 0)
+	{
+		warn("%s", path);
+		return (false);
+	}
+
+	// A directory is sampled up to a fixed number of bytes.
+	*entries = NULL;
+	*num = 0;
+	if (S_ISDIR(st.st_mode))
+	{
+		memset(&opts, 0, sizeof(opts));
+		opts.threads = 1;
+		if (!tree_hash(path, &opts, entries, num))
+			return (false);
+	}
+
+	s->paths = malloc((*num + 1) * sizeof(char *));
+	if (s->paths == NULL)
+	{
+		warn("malloc");
+		tree_free(*entries, *num);
+		return (false);
+	}
+
+	s->num = 0;
+	if (!S_ISDIR(st.st_mode))
+		s->paths[s->num++] = (char *) path;
+	for (i = 0, total = 0; i < *num && total < SAMPLE_LEN; i++)
+	{
+		if ((*entries)[i].failed || (*entries)[i].size == 0)
+			continue;
+		s->paths[s->num++] = (*entries)[i].path;
+		total += (*entries)[i].size;
+	}
+
+	if (s->num == 0)
+	{
+		warnx("%s: Nothing to calibrate against.", path);
+		free(s->paths);
+		tree_free(*entries, *num);
+		return (false);
+	}
+
+	return (true);
+}
+
+/******************************************************************************
+ * Startup.
+ ******************************************************************************/
+void
+tune_init(void)
+{
+	struct sha_tune tune;
+	const char *path;
+
+	// A missing file leaves everything at its default.
+	path = sha_tune_path();
+	if (path == NULL || access(path, F_OK) != 0)
+		return;
+
+	if (sha_tune_load(path, &tune))
+		sha_tune_apply(&tune);
+}
+
+/******************************************************************************
+ * Public functions.
+ ******************************************************************************/
+const char *
+sha_tune_path(void)
+{
+	const char *env;
+
+	// An empty variable turns tuning off.
+	env = getenv(ENV_TUNE);
+	if (env == NULL)
+		return (TUNE_PATH);
+
+	return ((env[0] == '\0') ? (NULL) : (env));
+}
+
+void
+sha_tune_get(struct sha_tune *tune)
+{
+	*tune = current;
+}
+
+bool
+sha_tune_load(const char *path, struct sha_tune *tune)
+{
+	char buf[LINE_LEN], key[LINE_LEN], value[LINE_LEN];
+	bool result;
+	int line, n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		warn("%s", path);
+		return (false);
+	}
+
+	// Each line is a setting and its value; # starts a comment.
+	memset(tune, 0, sizeof(*tune));
+	result = true;
+	for (line = 1; fgets(buf, sizeof(buf), fp) != NULL; line++)
+	{
+		buf[strcspn(buf, "#\n")] = '\0';
+		n = sscanf(buf, "%s %s", key, value);
+		if (n == EOF || n == 0)
+			continue;
+		if (n != 2)
+		{
+			warnx("%s:%d: Expected a setting and a value.", path,
+			      line);
+			result = false;
+			continue;
+		}
+
+		if (!parse(path, line, key, value, tune))
+			result = false;
+	}
+
+	fclose(fp);
+
+	return (result);
+}
+
+bool
+sha_tune_apply(const struct sha_tune *tune)
+{
+	enum sha_type type;
+	bool result;
+	int f;
+
+	if (tune->io >= num_io || tune->threads < 0 ||
+	    tune->threads > MAX_THREADS || (tune->read_len != 0 &&
+	    (tune->read_len < MIN_READ || tune->read_len > MAX_READ)))
+		return (false);
+
+	// Start from the best kernels.  A multi-lane batch kernel goes
+	// second, since it leaves the stream kernel alone.
+	result = true;
+	for (f = 0; f < SHA_TUNE_FAMILIES; f++)
+	{
+		type = families[f].type;
+		sha_kernel_select(type, NULL);
+		if ((tune->kernel[f][0] != '\0' &&
+		     !sha_kernel_select(type, tune->kernel[f])) ||
+		    (tune->batch[f][0] != '\0' &&
+		     !sha_kernel_select(type, tune->batch[f])))
+		{
+			warnx("%s: Tuned kernel is unknown or unsupported.",
+			      sha_name(type));
+			result = false;
+		}
+	}
+
+	tune_read_len = tune->read_len;
+	current = *tune;
+
+	return (result);
+}
+
+bool
+sha_tune_save(const char *path, const struct sha_tune *tune)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int f, fd;
+
+	if (tune->io >= num_io)
+		return (false);
+
+	// Write beside the file and rename, so readers never see half of it.
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+	{
+		errno = ENAMETOOLONG;
+		warn("%s", path);
+		return (false);
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		warn("%s", tmp);
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(tmp);
+		}
+		return (false);
+	}
+
+	fprintf(fp, "# Written by sha --autotune.\n");
+	fprintf(fp, "io %s\n", io_names[tune->io]);
+	fprintf(fp, "read_len %zu\n", tune->read_len);
+	fprintf(fp, "threads %d\n", tune->threads);
+	for (f = 0; f < SHA_TUNE_FAMILIES; f++)
+	{
+		if (tune->kernel[f][0] != '\0')
+			fprintf(fp, "%s.kernel %s\n", families[f].name,
+				tune->kernel[f]);
+		if (tune->batch[f][0] != '\0')
+			fprintf(fp, "%s.batch %s\n", families[f].name,
+				tune->batch[f]);
+	}
+
+	fchmod(fd, 0644);
+	if (fclose(fp) != 0 || rename(tmp, path) != 0)
+	{
+		warn("%s", path);
+		unlink(tmp);
+		return (false);
+	}
+
+	return (true);
+}
+
+bool
+sha_tune_run(enum sha_type type, const char *path, struct sha_tune *tune)
+{
+	static bool (*const fcns[])(enum sha_type, int, byte *) = {
+		[SHA_IO_READ]   = sha_fd,
+		[SHA_IO_MMAP]   = sha_map,
+		[SHA_IO_DIRECT] = sha_cold
+	};
+	struct tree_entry *entries;
+	double best, t;
+	int cpus, i, threads;
+	struct sample s;
+	size_t num;
+
+	if (sha_hash_len(type) == 0)
+		return (false);
+
+	memset(tune, 0, sizeof(*tune));
+	tune_kernels(tune);
+	if (!sha_tune_apply(tune))
+		return (false);
+
+	memset(&s, 0, sizeof(s));
+	s.type = type;
+	if (!gather(path, &s, &entries, &num))
+		return (false);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+
+	// Read lengths first, then the other kinds of I/O against the best.
+	best = -1;
+	for (i = 0; i < num_read_lens; i++)
+	{
+		tune_read_len = read_lens[i];
+		t = trial(&s, sha_fd, cpus);
+		if (t >= 0 && (best < 0 || t < best))
+		{
+			best = t;
+			tune->read_len = read_lens[i];
+		}
+	}
+	tune_read_len = tune->read_len;
+	for (i = SHA_IO_MMAP; best >= 0 && i < num_io; i++)
+	{
+		t = trial(&s, fcns[i], cpus);
+		if (t >= 0 && t < best)
+		{
+			best = t;
+			tune->io = i;
+		}
+	}
+
+	// More threads only help when there are files to spread out.
+	for (threads = 1; best >= 0 && s.num > 1 && threads <= 4 * cpus &&
+	     threads <= MAX_THREADS; threads *= 2)
+	{
+		t = trial(&s, fcns[tune->io], threads);
+		if (t >= 0 && (tune->threads == 0 || t < best))
+		{
+			best = t;
+			tune->threads = threads;
+		}
+	}
+
+	free(s.paths);
+	tree_free(entries, num);
+	if (best < 0)
+	{
+		warnx("%s: Couldn't read the files to calibrate against.",
+		      path);
+		return (false);
+	}
+
+	return (sha_tune_apply(tune));
+}